@@ -7,7 +7,7 @@
  
  build command
  (Windows) gcc bindump.c textscreen.c -lm -o bindump.exe
- (Linux  ) gcc bindump.c textscreen.c -lm -o bindump.out
+ (Linux  ) gcc bindump.c textscreen.c -lm -lpthread -o bindump.out
  *****************************************/
 
 // MSVC: ignore C4996 warning (fopen -> fopen_s etc...)
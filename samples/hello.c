@@ -5,7 +5,7 @@
      Date: 20160430
  build command
  (Windows) gcc hello.c textscreen.c -lm -o hello.exe
- (Linux  ) gcc hello.c textscreen.c -lm -o hello.out
+ (Linux  ) gcc hello.c textscreen.c -lm -lpthread -o hello.out
 ****************************************/
 
 #include "textscreen.h"
@@ -7,7 +7,7 @@
  
  build command
  (Windows) gcc interrupt.c textscreen.c -lm -o interrupt.exe
- (Linux  ) gcc interrupt.c textscreen.c -lm -o interrupt.out
+ (Linux  ) gcc interrupt.c textscreen.c -lm -lpthread -o interrupt.out
  also easy to build with MSVC
  *****************************************/
 
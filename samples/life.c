@@ -8,7 +8,7 @@
  
  build:(-std=c99)
  gcc life.c textscreen.c -Wall -lm -o life.exe (Windows)
- gcc life.c textscreen.c -Wall -lm -o life.out (Linux)
+ gcc life.c textscreen.c -Wall -lm -lpthread -o life.out (Linux)
  Require 'xsel' command to use clipboard for Linux.
  **********************************************************/
 
@@ -19,6 +19,9 @@ samples="
   waveview
   bindump
   hello
+  replay
+  viewer
+  sharedlife
 "
 
 ${cp} ../textscreen.* .
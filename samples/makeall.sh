@@ -7,7 +7,7 @@ rm=rm
 outExt=".out"
 #outExt=".exe"
 libsrc="textscreen.c"
-opt="-Wall -lm"
+opt="-Wall -lm -lpthread"
 samples="
   interrupt
   life
@@ -19,6 +19,9 @@ samples="
   waveview
   bindump
   hello
+  replay
+  viewer
+  sharedlife
 "
 
 ${cp} ../textscreen.* .
@@ -7,21 +7,51 @@
  
  build command
  (Windows) gcc rectbench.c textscreen.c -lm -o rectbench.exe
- (Linux  ) gcc rectbench.c textscreen.c -lm -o rectbench.out
+ (Linux  ) gcc rectbench.c textscreen.c -lm -lpthread -o rectbench.out
+ 
+ usage
+   rectbench.out                          draw to console
+   rectbench.out headless [width height]  draw to memory (measure library cost only)
+   rectbench.out verify [width height]    draw to VT emulator (check shown screen and measure output)
  *****************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "textscreen.h"
 
-int main(void)
+int main(int argc, char **argv)
 {
     TextScreenBitmap *bitmap;
+    TextScreenBackend *backend = NULL;
+    int verify = 0, diff = 0;
     int i, j;
     unsigned int ticks;
     
     // init TextScreen
     TextScreen_Init(0);
+    if ((argc > 1) && (!strcmp(argv[1], "headless") || !strcmp(argv[1], "verify"))) {
+        TextScreenSetting setting;
+        
+        verify = !strcmp(argv[1], "verify");
+        if (verify) {
+            backend = TextScreen_CreateVtBackend((argc > 3) ? atoi(argv[2]) : 80, 
+                                                 (argc > 3) ? atoi(argv[3]) : 25);
+        } else {
+            backend = TextScreen_CreateMemoryBackend((argc > 3) ? atoi(argv[2]) : 80, 
+                                                     (argc > 3) ? atoi(argv[3]) : 25, 0);
+        }
+        if (!backend) {
+            printf("invalid size\n");
+            TextScreen_End();
+            return 1;
+        }
+        TextScreen_GetSetting(&setting);
+        setting.backend = backend;
+        TextScreen_SetSetting(&setting);
+        TextScreen_ResizeScreen(0, 0);  // fit to backend size
+    }
     bitmap = TextScreen_CreateBitmap(0, 0);
     TextScreen_ClearScreen();
     
@@ -31,6 +61,8 @@ int main(void)
         for (i = 'A'; i <= 'Z'; i++) {
             TextScreen_DrawFillRect(bitmap, 0, 0, bitmap->width, bitmap->height, (char)i);
             TextScreen_ShowBitmap(bitmap, 0, 0);
+            if (verify && TextScreen_CompareVtScreen(backend, bitmap, 0, 0))
+                diff++;
         }
     }
     ticks = TextScreen_GetTickCount() - ticks;
@@ -49,6 +81,26 @@ int main(void)
         printf("Time : %d.%03d sec (%.2f rect/sec, %.0f chars/sec)\n\n", ticks / 1000, ticks % 1000,
                 (double)numRect * 1000 / ticks, (double)charPerRect * numRect * 1000 / ticks);
     }
+    if (backend) {  // print output to memory
+        TextScreenSetting setting;
+        long bytes, frames;
+        
+        if (verify) {
+            TextScreenVtStats total;
+            
+            TextScreen_GetVtStats(backend, NULL, &total);
+            printf("Verify   : %ld frames, %d frames differ from bitmap\n", total.frames, diff);
+            printf("Output   : %ld bytes, %ld escapes, %ld cursor moves (%.1f bytes/frame)\n\n", 
+                   total.bytes, total.escapes, total.cursorMoves, total.frames ? (double)total.bytes / total.frames : 0.0);
+        } else {
+            TextScreen_GetMemoryBackendData(backend, NULL, &bytes, &frames);
+            printf("Headless : %ld bytes, %ld frames\n\n", bytes, frames);
+        }
+        TextScreen_GetSetting(&setting);
+        setting.backend = NULL;
+        TextScreen_SetSetting(&setting);
+        TextScreen_FreeBackend(backend);
+    }
     TextScreen_FreeBitmap(bitmap);
     TextScreen_End();
     
@@ -0,0 +1,140 @@
+/*****************************************
+ replay.c
+
+ Replay capture file recorded by TextScreen_StartRecording().
+     [Space] pause  [Left][Right] -10/+10 sec  [Up][Down] speed x2/x0.5  [Home] rewind  [q][Esc] exit
+
+ usage: replay capture [speed]
+        replay capture -cast output.cast   (export asciicast v2 file)
+
+ build command
+ (Windows) gcc replay.c textscreen.c -lm -o replay.exe
+ (Linux  ) gcc replay.c textscreen.c -lm -lpthread -o replay.out
+ *****************************************/
+
+// MSVC: ignore C4996 warning (fopen -> fopen_s etc...)
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#define  snprintf _snprintf
+#endif
+
+#include "textscreen.h"
+
+#define SEEK_STEP  10.0   // sec
+#define SPEED_MAX  64.0
+
+int main(int argc, char *argv[])
+{
+    TextScreenCapture *capture;
+    TextScreenBitmap  *view, *frame, *lastframe;
+    double duration, clock, speed, ftime, lastftime;
+    long   frames;
+    unsigned int tick, lasttick;
+    int    key, pause;
+    char   status[128], laststatus[128];
+
+    if (argc < 2) {
+        printf("usage: %s capture [speed]\n", argv[0]);
+        printf("       %s capture -cast output.cast\n", argv[0]);
+        return 1;
+    }
+    if ((argc >= 4) && !strcmp(argv[2], "-cast")) {
+        if (TextScreen_ExportAsciicast(argv[1], argv[3])) {
+            printf("could not export %s to %s\n", argv[1], argv[3]);
+            return 1;
+        }
+        return 0;
+    }
+    capture = TextScreen_OpenCapture(argv[1]);
+    if (!capture) {
+        printf("could not open capture file %s\n", argv[1]);
+        return 1;
+    }
+    speed = (argc >= 3) ? atof(argv[2]) : 1.0;
+    if ((speed <= 0) || (speed > SPEED_MAX))
+        speed = 1.0;
+    TextScreen_GetCaptureInfo(capture, &duration, &frames);
+
+    TextScreen_Init(0);
+    TextScreen_SetRenderingMethod(TEXTSCREEN_RENDERING_METHOD_DIFF);  // draw changed cells only
+    view = TextScreen_CreateBitmap(0, 0);
+    TextScreen_ClearScreen();
+
+    clock     = 0;
+    pause     = 0;
+    key       = 0;
+    lastframe = NULL;
+    lastftime = -1;
+    laststatus[0] = '\0';
+    lasttick  = TextScreen_GetTickCount();
+    while (key != 'q' && key != TSK_ESC) {
+        tick = TextScreen_GetTickCount();
+        if (!pause)
+            clock += (tick - lasttick) * speed / 1000.0;
+        lasttick = tick;
+        if (clock >= duration) {
+            clock = duration;
+            pause = 1;
+        }
+        // decode frames until clock (jump: decode from nearest keyframe)
+        TextScreen_SeekCapture(capture, clock);
+        frame = TextScreen_GetCaptureFrame(capture, &ftime);
+        snprintf(status, sizeof(status), "%s %8.1f / %.1f sec  x%g  (%ld frames)",
+                 pause ? "||" : "> ", clock, duration, speed, frames);
+        if ((frame != lastframe) || (ftime != lastftime) || strcmp(status, laststatus)) {
+            TextScreen_ClearBitmap(view);
+            if (frame) {
+                if (frame->attr && !view->attr)
+                    TextScreen_CreateAttrPlane(view);
+                if (frame->code && !view->code)
+                    TextScreen_CreateCodePlane(view);
+                TextScreen_CopyBitmap(view, frame, 0, 0);
+            }
+            TextScreen_DrawText(view, 0, view->height - 1, status);
+            TextScreen_ShowBitmap(view, 0, 0);
+            lastframe = frame;
+            lastftime = ftime;
+            strcpy(laststatus, status);
+        }
+        TextScreen_Wait(15);
+
+        key = TextScreen_GetKey() & TSK_KEYMASK;
+        switch (key) {
+            case ' ':
+                pause = !pause;
+                if (clock >= duration)
+                    clock = 0;
+                break;
+            case TSK_ARROW_LEFT:
+                clock = (clock > SEEK_STEP) ? clock - SEEK_STEP : 0;
+                break;
+            case TSK_ARROW_RIGHT:
+                clock = (clock + SEEK_STEP < duration) ? clock + SEEK_STEP : duration;
+                break;
+            case TSK_ARROW_UP:
+                if (speed * 2 <= SPEED_MAX)
+                    speed *= 2;
+                break;
+            case TSK_ARROW_DOWN:
+                if (speed / 2 >= 1.0 / SPEED_MAX)
+                    speed /= 2;
+                break;
+            case TSK_HOME:
+                clock = 0;
+                break;
+        }
+    }
+
+    TextScreen_ClearScreen();
+    TextScreen_FreeBitmap(view);
+    TextScreen_CloseCapture(capture);
+    TextScreen_End();
+    return 0;
+}
@@ -7,7 +7,7 @@
  
  build command
  (Windows) gcc resize.c textscreen.c -lm -o resize.exe
- (Linux  ) gcc resize.c textscreen.c -lm -o resize.out
+ (Linux  ) gcc resize.c textscreen.c -lm -lpthread -o resize.out
  also easy to build with MSVC
  *****************************************/
 
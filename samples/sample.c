@@ -5,14 +5,15 @@
 ****************************************/
 // build command (sample.c is this sample)
 // (Windows) gcc sample.c textscreen.c -lm -o sample.exe
-// (Linux  ) gcc sample.c textscreen.c -lm -o sample.out
+// (Linux  ) gcc sample.c textscreen.c -lm -lpthread -o sample.out
 
 #include "textscreen.h"
 
 int main(void)
 {
     TextScreenBitmap   *bitmap, *sprite;      // bitmap pointer
-    int  x, y, xd, yd, key;
+    TextScreenCompositor *comp;               // compositor pointer
+    int  x, y, xd, yd, key, layer;
     const char *helptext =  "Press [q] or [Esc] to exit";
     
     TextScreen_Init(0);                       // Initialize
@@ -20,7 +21,12 @@ int main(void)
     bitmap = TextScreen_CreateBitmap(0, 0);   // create bitmap same size of screen
     sprite = TextScreen_CreateBitmap(17, 9);  // create sprite bitmap. size(17,9)
     TextScreen_DrawFillCircle(sprite, 8, 4, 4, '$');  // draw circle. center(8,4) r=4
+    TextScreen_DrawText(bitmap, 0, bitmap->height - 1, helptext);  // draw text
+    comp = TextScreen_CreateCompositor(0, 0); // create compositor same size of screen
+    TextScreen_AddLayer(comp, bitmap, 0, 0, 0, 0);         // background layer
+    layer = TextScreen_AddLayer(comp, sprite, 5, 5, 1, 1); // sprite layer (space character '.' is transparent)
     TextScreen_ClearScreen();                 // clear console
+    TextScreen_SetFrameRate(10);              // 10 frames per second
     
     x   = 5;    // initial position x
     y   = 5;    // initial position y
@@ -28,11 +34,9 @@ int main(void)
     yd  = 1;    // stride y
     key = 0;
     while( key != 'q' && key != TSK_ESC ) {
-        TextScreen_ClearBitmap(bitmap);       // clear bitmap
-        TextScreen_OverlayBitmap(bitmap, sprite, x, y);  // copy sprite to bitmap
-        TextScreen_DrawText(bitmap, 0, bitmap->height - 1, helptext);  // draw text
-        TextScreen_ShowBitmap(bitmap, 0, 0);  // show bitmap to console
-        TextScreen_Wait(100);                 // wait 100ms
+        TextScreen_MoveLayer(comp, layer, x, y);  // move sprite
+        TextScreen_ShowBitmap(TextScreen_ComposeLayers(comp), 0, 0);  // composite moved area and show
+        TextScreen_WaitFrame();               // wait for next frame (100ms)
         x += xd;
         y += yd;
         // bounding check
@@ -46,6 +50,7 @@ int main(void)
         }
         key = TextScreen_GetKey() & TSK_KEYMASK;  // get key code without waiting
     }
+    TextScreen_FreeCompositor(comp);          // free compositor
     TextScreen_FreeBitmap(sprite);            // free sprite
     TextScreen_FreeBitmap(bitmap);            // free bitmap
     TextScreen_End();                         // end of TextScreen
@@ -7,7 +7,7 @@
  
  build command
  (Windows) gcc scroll.c textscreen.c -lm -o scroll.exe
- (Linux  ) gcc scroll.c textscreen.c -lm -o scroll.out
+ (Linux  ) gcc scroll.c textscreen.c -lm -lpthread -o scroll.out
  also easy to build with MSVC
  *****************************************/
  
@@ -0,0 +1,153 @@
+/*****************************************
+ sharedlife.c
+
+ Game of life in shared memory bitmap (TextScreen_CreateSharedBitmap()).
+ simulation writes cells in place, and viewer in other process shows them without copy of frames.
+     viewer: [q][Esc] exit
+
+ usage: sharedlife name [width height [wait]]   (simulation. stop by Ctrl+C)
+        sharedlife -view name                   (viewer)
+
+ build command
+ (Linux  ) gcc sharedlife.c textscreen.c -lm -lpthread -o sharedlife.out
+ *****************************************/
+
+// MSVC: ignore C4996 warning (fopen -> fopen_s etc...)
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#ifdef _MSC_VER
+#define  snprintf _snprintf
+#endif
+
+#include "textscreen.h"
+
+#define BOARD_SPACE_CHAR    '.'
+#define BOARD_SURVIVE_CHAR  '#'
+
+static volatile sig_atomic_t gQuit = 0;
+
+static void OnSignal(int sig)
+{
+    gQuit = 1;
+}
+
+static int Simulate(const char *name, int width, int height, unsigned int wait)
+{
+    TextScreenBitmap *board, *next;
+    long  gen;
+    int   x, y, dx, dy, n;
+    char  ch;
+
+    board = TextScreen_CreateSharedBitmap(name, width, height, 0);
+    next  = TextScreen_CreateBitmap(width, height);
+    if (!board || !next) {
+        printf("could not create shared bitmap %s\n", name);
+        TextScreen_FreeBitmap(board);
+        TextScreen_FreeBitmap(next);
+        return 1;
+    }
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    srand(1);
+    TextScreen_BeginSharedFrame(board);
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            TextScreen_PutCell(board, x, y, (rand() % 4) ? BOARD_SPACE_CHAR : BOARD_SURVIVE_CHAR);
+        }
+    }
+    TextScreen_EndSharedFrame(board);
+    printf("simulation: %s (%dx%d)  view: sharedlife -view %s\n", name, width, height, name);
+
+    for (gen = 0; !gQuit; gen++) {
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                n = 0;
+                for (dy = -1; dy <= 1; dy++) {
+                    for (dx = -1; dx <= 1; dx++) {
+                        if ((dx || dy) && (TextScreen_GetCell(board, (x + dx + width) % width, (y + dy + height) % height) == BOARD_SURVIVE_CHAR))
+                            n++;
+                    }
+                }
+                ch = TextScreen_GetCell(board, x, y);
+                TextScreen_PutCell(next, x, y, ((n == 3) || ((n == 2) && (ch == BOARD_SURVIVE_CHAR))) ? BOARD_SURVIVE_CHAR : BOARD_SPACE_CHAR);
+            }
+        }
+        // viewer gets whole generation (not half written)
+        TextScreen_BeginSharedFrame(board);
+        TextScreen_CopyBitmap(board, next, 0, 0);
+        TextScreen_EndSharedFrame(board);
+        TextScreen_Wait(wait);
+    }
+    printf("%ld generations\n", gen);
+    TextScreen_FreeBitmap(next);
+    TextScreen_FreeBitmap(board);  // remove shared memory
+    return 0;
+}
+
+static int View(const char *name)
+{
+    TextScreenBitmap *shared, *snapshot, *view;
+    unsigned long long generation;
+    long  frames;
+    int   key, ret;
+    char  status[128];
+
+    shared = TextScreen_OpenSharedBitmap(name);
+    if (!shared) {
+        printf("could not open shared bitmap %s\n", name);
+        return 1;
+    }
+    TextScreen_Init(0);
+    TextScreen_SetRenderingMethod(TEXTSCREEN_RENDERING_METHOD_DIFF);  // draw changed cells only
+    view     = TextScreen_CreateBitmap(0, 0);
+    snapshot = TextScreen_CreateBitmap(shared->width, shared->height);
+    TextScreen_ClearScreen();
+
+    generation = 0;
+    frames     = 0;
+    key        = 0;
+    ret        = 0;
+    while (key != 'q' && key != TSK_ESC) {
+        ret = TextScreen_SnapshotSharedBitmap(shared, snapshot, &generation);
+        if (ret < 0) break;
+        if (ret > 0) {
+            frames++;
+            snprintf(status, sizeof(status), "[%s] %dx%d  %ld frames", name, shared->width, shared->height, frames);
+            TextScreen_ClearBitmap(view);
+            TextScreen_CopyBitmap(view, snapshot, 0, 0);
+            TextScreen_DrawText(view, 0, view->height - 1, status);
+            TextScreen_ShowBitmap(view, 0, 0);
+        }
+        TextScreen_Wait(15);
+        key = TextScreen_GetKey() & TSK_KEYMASK;
+    }
+
+    TextScreen_ClearScreen();
+    TextScreen_FreeBitmap(view);
+    TextScreen_FreeBitmap(snapshot);
+    TextScreen_FreeBitmap(shared);
+    TextScreen_End();
+    if (ret < 0)
+        printf("simulation of %s is finished\n", name);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s name [width height [wait]]\n", argv[0]);
+        printf("       %s -view name\n", argv[0]);
+        return 1;
+    }
+    if (!strcmp(argv[1], "-view"))
+        return (argc >= 3) ? View(argv[2]) : 1;
+    return Simulate(argv[1], (argc >= 4) ? atoi(argv[2]) : 80, (argc >= 4) ? atoi(argv[3]) : 24, 
+                    (argc >= 5) ? atoi(argv[4]) : 50);
+}
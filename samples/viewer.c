@@ -0,0 +1,80 @@
+/*****************************************
+ viewer.c
+
+ Show frames broadcast by other process (TextScreen_StartBroadcast()).
+     [q][Esc] exit
+
+ usage: viewer socket
+        (run other sample with environment variable TEXTSCREEN_BROADCAST=socket)
+
+ build command
+ (Linux  ) gcc viewer.c textscreen.c -lm -lpthread -o viewer.out
+ *****************************************/
+
+// MSVC: ignore C4996 warning (fopen -> fopen_s etc...)
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#define  snprintf _snprintf
+#endif
+
+#include "textscreen.h"
+
+int main(int argc, char *argv[])
+{
+    TextScreenCapture *capture;
+    TextScreenBitmap  *view, *frame;
+    long   frames;
+    int    key, ret;
+    char   status[128];
+
+    if (argc < 2) {
+        printf("usage: %s socket\n", argv[0]);
+        return 1;
+    }
+    capture = TextScreen_ConnectBroadcast(argv[1]);
+    if (!capture) {
+        printf("could not connect to %s\n", argv[1]);
+        return 1;
+    }
+
+    TextScreen_Init(0);
+    TextScreen_SetRenderingMethod(TEXTSCREEN_RENDERING_METHOD_DIFF);  // draw changed cells only
+    view = TextScreen_CreateBitmap(0, 0);
+    TextScreen_ClearScreen();
+
+    frames = 0;
+    key    = 0;
+    while (key != 'q' && key != TSK_ESC) {
+        // wait for frame (newest frame only, if viewer is behind)
+        ret = TextScreen_ReceiveBroadcast(capture, &frame, 15);
+        if (ret < 0) break;
+        if (ret > 0) {
+            frames++;
+            snprintf(status, sizeof(status), "[%s] %ld frames", argv[1], frames);
+            TextScreen_ClearBitmap(view);
+            if (frame->attr && !view->attr)
+                TextScreen_CreateAttrPlane(view);
+            if (frame->code && !view->code)
+                TextScreen_CreateCodePlane(view);
+            TextScreen_CopyBitmap(view, frame, 0, 0);
+            TextScreen_DrawText(view, 0, view->height - 1, status);
+            TextScreen_ShowBitmap(view, 0, 0);
+        }
+        key = TextScreen_GetKey() & TSK_KEYMASK;
+    }
+
+    TextScreen_ClearScreen();
+    TextScreen_FreeBitmap(view);
+    TextScreen_CloseCapture(capture);
+    TextScreen_End();
+    if (ret < 0)
+        printf("disconnected from %s\n", argv[1]);
+    return 0;
+}
@@ -7,7 +7,7 @@
  
  build command
  (Windows) gcc waveview.c textscreen.c -lm -o waveview.exe
- (Linux  ) gcc waveview.c textscreen.c -lm -o waveview.out
+ (Linux  ) gcc waveview.c textscreen.c -lm -lpthread -o waveview.out
  *****************************************/
 
 // MSVC: ignore C4996 warning (fopen -> fopen_s etc...)
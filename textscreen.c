@@ -10,6 +10,7 @@
      Non Windows : console support ANSI escape sequence
      
      Require : libm.so (-lm) for sqrt()
+               libpthread.so (-lpthread) for asynchronous rendering (Non Windows)
  
  TextScreen is free software, and under the MIT License.
  
@@ -19,9 +20,13 @@
 // use timeGetTime()  (winmm.lib)
 #define USE_WINMM 0
 
+// use SIMD instructions for translate (SSE2 or NEON, if compiler supports)
+#define USE_SIMD 1
+
 #ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
+#include <time.h>
 #if USE_WINMM == 1
 #include <mmsystem.h>
 #endif
@@ -39,13 +44,34 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <sched.h>
 #endif
 
+#include <errno.h>
+#include <limits.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
+#if USE_SIMD == 1
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define TEXTSCREEN_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TEXTSCREEN_SIMD_NEON
+#endif
+#endif
+
 #include "textscreen.h"
 
 // default settings
@@ -63,26 +89,45 @@
 #else
 #define SCREEN_DEFAULT_RENDERING_METHOD   TEXTSCREEN_RENDERING_METHOD_FAST
 #endif
+// wait time for answer of terminal (TEXTSCREEN_RENDERING_FLAG_AUTO, msec)
+#define SCREEN_DEFAULT_DETECT_TIMEOUT     100
+
+// ANSI escape code for terminal (queue to output buffer. write by TextScreen_OutFlush())
+#define P_CURSOR_UP()       TextScreen_OutPutStr("\x1b[1A")
+#define P_CURSOR_DOWN()     TextScreen_OutPutStr("\x1b[1B")
+#define P_CURSOR_FORWARD()  TextScreen_OutPutStr("\x1b[1C")
+#define P_CURSOR_BACK()     TextScreen_OutPutStr("\x1b[1D")
+#define P_ERASE_BELOW()     TextScreen_OutPutStr("\x1b[0J")
+#define P_ERASE_ABOVE()     TextScreen_OutPutStr("\x1b[1J")
+#define P_ERASE_ALL()       TextScreen_OutPutStr("\x1b[2J")
+#define P_CLS()             TextScreen_OutPutStr("\x1b[2J")
+#define P_RESET_STATE()     TextScreen_OutPutStr("\x1b""c")
+#define P_CURSOR_POS(x,y)   TextScreen_OutPutCursorPos(x, y)
+#define P_CURSOR_SHOW()     TextScreen_OutPutStr("\x1b[?25h")
+#define P_CURSOR_HIDE()     TextScreen_OutPutStr("\x1b[?25l")
+#define P_SGR_RESET()       TextScreen_OutPutStr("\x1b[0m")
+
+// max length of "\x1b[%d;%dH" (x, y < TEXTSCREEN_MAXSIZE * 2)
+#define P_CURSOR_POS_MAXLEN  16
+// max length of "\x1b[%d;%dr\x1b[%dS\x1b[r"
+#define P_SCROLL_MAXLEN      32
+// max horizontal move amount for TEXTSCREEN_RENDERING_FLAG_PAN
+#define P_PAN_MAX            64
+// max length of "\x1b[%d;%d;%d;%dm" (SGR for cell attribute)
+#define P_SGR_MAXLEN         24
 
-// ANSI escape code for terminal
-#define P_CURSOR_UP()       {printf("\x1b[1A");fflush(stdout);}
-#define P_CURSOR_DOWN()     {printf("\x1b[1B");fflush(stdout);}
-#define P_CURSOR_FORWARD()  {printf("\x1b[1C");fflush(stdout);}
-#define P_CURSOR_BACK()     {printf("\x1b[1D");fflush(stdout);}
-#define P_ERASE_BELOW()     {printf("\x1b[0J");fflush(stdout);}
-#define P_ERASE_ABOVE()     {printf("\x1b[1J");fflush(stdout);}
-#define P_ERASE_ALL()       {printf("\x1b[2J");fflush(stdout);}
-#define P_CLS()             {printf("\x1b[2J");fflush(stdout);}
-#define P_RESET_STATE()     {printf("\x1b""c");fflush(stdout);}
-#define P_CURSOR_POS(x,y)  {                                    \
-    char strbuf[32];                                            \
-    snprintf(strbuf, sizeof(strbuf), "\x1b[%d;%dH", y+1, x+1);  \
-    printf("%s", strbuf);                                       \
-    fflush(stdout);                                             \
-}
-#define P_CURSOR_SHOW()      {printf("\x1b[?25h");fflush(stdout);}
-#define P_CURSOR_HIDE()      {printf("\x1b[?25l");fflush(stdout);}
-#define P_SGR_RESET()        {printf("\x1b[0m");fflush(stdout);}
+// max number of iovec for one writev()
+#if defined(IOV_MAX)
+#define TEXTSCREEN_IOV_MAX   IOV_MAX
+#else
+#define TEXTSCREEN_IOV_MAX   1024
+#endif
+// max bytes of one write() while console is not waited (console is writable: pipe and pty take this without blocking)
+#if defined(PIPE_BUF)
+#define TEXTSCREEN_NONBLOCK_WRITE  PIPE_BUF
+#else
+#define TEXTSCREEN_NONBLOCK_WRITE  512
+#endif
 
 // key sequence table
 struct KeySequence {
@@ -274,1082 +319,6913 @@ static unsigned char gTranslateTable[256] = {
 
 static TextScreenSetting gSetting = {0};
 
+// screen buffer for TEXTSCREEN_RENDERING_METHOD_DIFF
+// front: copy of console screen (translated character)  back: next screen
+static char *gFrontBuf    = NULL;
+static char *gBackBuf     = NULL;
+static int   gFrontWidth  = 0;
+static int   gFrontHeight = 0;
+static int   gFrontValid  = 0;   // 0: console screen is unknown (redraw whole screen)
+// hash of each row (TEXTSCREEN_RENDERING_FLAG_SCROLL)
+static unsigned int *gFrontHash = NULL;
+static unsigned int *gBackHash  = NULL;
+// console width at last whole screen redraw (TEXTSCREEN_RENDERING_FLAG_PAN)
+static int   gConsoleWidth = 0;
+// attribute of each cell of front/back screen (attribute of front is all 0 if gFrontAttrUsed = 0)
+static unsigned short *gFrontAttr = NULL;
+static unsigned short *gBackAttr  = NULL;
+static int   gFrontAttrUsed = 0;
+// code point of each cell of front/back screen (code point of front is all 0 if gFrontCodeUsed = 0)
+static unsigned int *gFrontCode = NULL;
+static unsigned int *gBackCode  = NULL;
+static int   gFrontCodeUsed = 0;
+// row buffer for TEXTSCREEN_RENDERING_METHOD_FAST with attribute or code point
+static char           *gRowBuf     = NULL;
+static unsigned short *gRowAttr    = NULL;
+static unsigned int   *gRowCode    = NULL;
+static int             gRowBufSize = 0;
+// max bytes of frame (TextScreen_SetFrameBudget), and first row of next frame (rows over budget are drawn first)
+static int   gFrameBudget  = 0;
+static int   gDiffStartRow = 0;
+static int   gDiffIncomplete = 0;  // 1: rows over budget were not drawn by last frame
+// frame skipped while console is busy (TEXTSCREEN_RENDERING_FLAG_NONBLOCK) or not drawn all (budget),
+// shown by TextScreen_ShowSkippedFrame() (TextScreen_WaitFrame(), TextScreen_Wait(), TextScreen_GetKey())
+static TextScreenBitmap *gSkipFrame = NULL;
+static int               gSkipFrameValid = 0;
+// screen of frame made by TextScreen_BeginFrame(), recorded and broadcast as one frame by TextScreen_EndFrame()
+static TextScreenBitmap *gUserFrame = NULL;
+static int               gUserFrameValid = 0;
+
+// wait for render thread of asynchronous rendering (TextScreen_SetAsyncRendering)
+static void TextScreen_AsyncWait(void);
+// show frame skipped by slow console (main thread),  return 0:successful  -1:error
+static int TextScreen_ShowSkippedFrame(void);
+// record and broadcast frame made by TextScreen_BeginFrame() (end of outermost frame)
+static void TextScreen_FlushUserFrame(void);
+static void TextScreen_DropSkippedFrame(void);
+// append shown frame to capture file (TextScreen_StartRecording)
+static void TextScreen_RecordFrame(TextScreenBitmap *bitmap, int dx, int dy);
+static int TextScreen_IsRecording(void);
+// send shown frame to viewers (TextScreen_StartBroadcast)
+static void TextScreen_BroadcastFrame(TextScreenBitmap *bitmap, int dx, int dy);
+static int TextScreen_IsBroadcasting(void);
+// monotonic time (sec)
+static double TextScreen_GetTime(void);
+// add statistics of current frame to total (end of frame)
+static void TextScreen_StatsEndFrame(void);
+// print summary of statistics at TextScreen_End() (TEXTSCREEN_STATS)
+static void TextScreen_PrintStats(void);
+// trace span (TextScreen_StartTrace): start = TextScreen_TraceBegin() (0: not tracing), TextScreen_TraceEnd() adds event
+static int gTraceRunning = 0;
+static unsigned long long TextScreen_TraceBegin(void);
+static void TextScreen_TraceEnd(const char *name, unsigned long long start, long arg);
+// bitmap is shared memory bitmap (TextScreen_CreateSharedBitmap, TextScreen_OpenSharedBitmap): size and planes are fixed
+static int TextScreen_IsSharedBitmap(const TextScreenBitmap *bitmap);
+static void TextScreen_FreeSharedBitmap(TextScreenBitmap *bitmap);
+
+// UTF-8 sequence of code point (direct mapped cache by low bits of code point)
+#define TEXTSCREEN_CODE_CACHE_SIZE 1024
+#define TEXTSCREEN_UTF8_MAXLEN     4
+struct CodeCache {
+    unsigned int  code;
+    unsigned char width;
+    unsigned char len;
+    char          utf8[TEXTSCREEN_UTF8_MAXLEN];
+};
+static struct CodeCache gCodeCache[TEXTSCREEN_CODE_CACHE_SIZE];
+static const struct CodeCache *TextScreen_LookupCode(unsigned int code);
+// code point of screen cell in renderer: 0 = character cell, TEXTSCREEN_CODE_RIGHT = right half of wide character
+#define TEXTSCREEN_CODE_RIGHT      0xffffffffU
+
+// translate table is identity (bitmap data can be output without translate)
+static int   gTranslateIdentity = 0;
+// translate table is identity except some ranges of character translated to one character (eg. control code to space)
+// gTranslateRangeNum  -1: other table  0: identity
+#define TEXTSCREEN_TRANSLATE_MAXRANGE 4
+static int            gTranslateRangeNum = -1;
+static unsigned char  gTranslateRangeLo[TEXTSCREEN_TRANSLATE_MAXRANGE];
+static unsigned char  gTranslateRangeLen[TEXTSCREEN_TRANSLATE_MAXRANGE];  // (last - first)
+static char           gTranslateRangeChar = 0;
+// copy of table checked last (table may be changed in place after TextScreen_SetSetting())
+static char           gTranslateCopy[256];
+
+// output queue: escape sequences and screen data are gathered, then written at once by TextScreen_OutFlush()
+// segment data is in gFrameBuf (ref = NULL) or refers to memory outside (ref != NULL, not copied)
+struct OutSegment {
+    const char *ref;
+    int  offset;
+    int  len;
+};
+
+static char              *gFrameBuf     = NULL;  // keep and reuse. grow only
+static int                gFrameBufSize = 0;
+static int                gFrameBufLen  = 0;
+static struct OutSegment *gOutSeg       = NULL;
+static int                gOutSegSize   = 0;
+static int                gOutSegNum    = 0;
+static int                gFrameDepth   = 0;  // nest level of frame
+static int                gUserFrameDepth = 0;  // nest level of TextScreen_BeginFrame()
+static int                gOutSaturated = 0;  // 1: last frame was not written at once (TEXTSCREEN_RENDERING_FLAG_NONBLOCK)
+// rendering statistics (TextScreen_GetStats): current frame, last frame, total, and histogram of frame time
+#define TEXTSCREEN_STATS_BUCKETS 96  // 4 buckets per octave from 1 usec
+static TextScreenStats    gStatsCur;
+static TextScreenStats    gStatsFrame;
+static TextScreenStats    gStatsTotal;
+static long               gStatsHist[TEXTSCREEN_STATS_BUCKETS];
 #ifdef _WIN32
 #else
-static int gSavedTermFlag = 0;
-static struct termios gSavedTerm;
-int TextScreen_SetNonBufferedTerm(void)
+static struct iovec      *gOutIov       = NULL;
+// output not written yet by nonblocking write (written before next output)
+static char              *gOutPending     = NULL;
+static int                gOutPendingSize = 0;
+static int                gOutPendingPos  = 0;
+static int                gOutPendingLen  = 0;
+#endif
+
+// put decimal number n (n >= 0) to buf (without null terminate),  return length
+static int TextScreen_PutNumber(char *buf, int n)
 {
-    struct termios term;
-    int ret = 0;
+    char num[12];
+    int  index, digit;
     
-    if (gSavedTermFlag) {
-        ret = tcsetattr(STDIN_FILENO, TCSANOW, &gSavedTerm);
-        gSavedTermFlag = 0;
+    digit = 0;
+    do {
+        num[digit++] = (char)('0' + (n % 10));
+        n /= 10;
+    } while (n);
+    index = 0;
+    while (digit) {
+        buf[index++] = num[--digit];
     }
-    ret = tcgetattr(STDIN_FILENO, &term);
-    if (ret < 0) return ret;
-    gSavedTerm = term;
-    gSavedTermFlag = 1;
-    term.c_lflag &= ~(ECHO | ICANON);
-    term.c_cc[VMIN]  = 1;
-    term.c_cc[VTIME] = 0;
-    ret = tcsetattr(STDIN_FILENO, TCSANOW, &term);
-    if (ret < 0) return ret;
-    // note: set non-blocking mode at TextScreen_GetKey()
-    
-    return ret;
+    return index;
 }
-int TextScreen_RestoreTerm(void)
+
+// number of digits of n (n >= 0)
+static int TextScreen_NumberLength(int n)
 {
-    int ret = 0;
+    int len = 1;
     
-    if (gSavedTermFlag) {
-        ret = tcsetattr(0, TCSANOW, &gSavedTerm);
+    while (n >= 10) {
+        n /= 10;
+        len++;
     }
-    return ret;
+    return len;
 }
-#endif
 
-// Windows prototype: BOOL HandlerRoutine(DWORD dwCtrlType)
-int TextScreen_SIGINT_handler(int sig)
+// put escape sequence of cursor position (x, y) to buf (without null terminate),  return length
+static int TextScreen_PutCursorPosSeq(char *buf, int x, int y)
 {
-    int ret = 0;
+    int  index;
     
-#ifdef _WIN32
-    // Windows sig value:
-    // CTRL_C_EVENT 0 : CTRL_BREAK_EVENT 1 : CTRL_CLOSE_EVENT 2
-    // CTRL_LOGOFF_EVENT 5 : CTRL_SHUTDOWN_EVENT 6
-    sig = 2;   // set sig value to same as linux SIGINT
-#endif
-    if (gSetting.sigintHandler) {
-        gSetting.sigintHandler(sig, gSetting.sigintHandlerUserData);
-        ret = 1;
-    } else {
-        // sigintHnadler is not defined...
-        TextScreen_End();
-#ifdef _WIN32
-        // Windows: use default ctrl handler (return=0)
-#else
-        // Lunux: force exit
-        _exit(sig);
-#endif
+    index = 0;
+    buf[index++] = 0x1b;
+    buf[index++] = '[';
+    index += TextScreen_PutNumber(buf + index, y + 1);
+    if (x) {  // column 1 is default
+        buf[index++] = ';';
+        index += TextScreen_PutNumber(buf + index, x + 1);
     }
-    return ret;
+    buf[index++] = 'H';
+    return index;
 }
 
-void TextScreen_SetSigintHandler(void (*handler)(int, void*), void *userdata)
+// put "ESC [ n final" to buf (without null terminate),  return length
+static int TextScreen_PutCsiSeq(char *buf, int n, char final)
 {
-    gSetting.sigintHandler = handler;
-    gSetting.sigintHandlerUserData = userdata;
+    int  index;
+    
+    index = 0;
+    buf[index++] = 0x1b;
+    buf[index++] = '[';
+    index += TextScreen_PutNumber(buf + index, n);
+    buf[index++] = final;
+    return index;
 }
 
-int TextScreen_Init(TextScreenSetting *usersetting)
+// length of horizontal cursor movement from x0 to x1 in same row
+// method  1: CUF "ESC [ n C"  2: CUB "ESC [ n D"  3: CR and CUF
+static int TextScreen_CursorMoveCostX(int x0, int x1, int *method)
 {
-    int ret = 0;
+    int cost, cr;
     
-    if (!usersetting) {
-        TextScreen_GetSettingDefault(&gSetting);
-    } else {
-        TextScreen_SetSetting(usersetting);
+    *method = 0;
+    if (x0 == x1) return 0;
+    if (x1 > x0) {
+        *method = 1;
+        return 3 + TextScreen_NumberLength(x1 - x0);
     }
-#ifdef _WIN32
-    ret = !SetConsoleCtrlHandler((PHANDLER_ROUTINE)TextScreen_SIGINT_handler, TRUE);
-#else
-#if _POSIX_C_SOURCE >= 200809L
-    {
-        struct sigaction new_sa;
-        
-        memset(&new_sa, 0, sizeof(new_sa));
-        new_sa.sa_handler = (void *)TextScreen_SIGINT_handler;
-        new_sa.sa_flags = SA_RESTART;  // SA_RESTART:restart, SA_RESETHAND:reset
-        if (sigaction(SIGINT, &new_sa, NULL))
-            return -1;
+    *method = 2;
+    cost = 3 + TextScreen_NumberLength(x0 - x1);
+    cr   = 1 + (x1 ? 3 + TextScreen_NumberLength(x1) : 0);
+    if (cr < cost) {
+        *method = 3;
+        cost = cr;
     }
-#else
-    // (old-school)
-    if (signal(SIGINT, (void *)TextScreen_SIGINT_handler) == SIG_ERR)
-        return -1;
-#endif  /* end of (_POSIX_C_SOURCE >= 200809L) */
-    ret = TextScreen_SetNonBufferedTerm();
-#endif
-    return ret;
-}
-
-int TextScreen_End(void)
-{
-    int ret = 0;
-#ifdef _WIN32
-#else
-    ret = TextScreen_RestoreTerm();
-#endif
-    TextScreen_SetCursorVisible(1);
-    return ret;
+    return cost;
 }
 
-int TextScreen_ClearScreen(void)
+// put cheapest cursor movement from (cx, cy) to (x, y) to buf: CUP, CUF/CUB, CR, CUU/CUD, or CR and LF
+// cx < 0: cursor position is unknown (use CUP),  return length
+static int TextScreen_PutCursorMoveSeq(char *buf, int cx, int cy, int x, int y)
 {
-#ifdef _WIN32
-    HANDLE stdh;
-    COORD  coord;
-    CONSOLE_SCREEN_BUFFER_INFO info;
-    DWORD bufsize;
-    DWORD len;
+    int  index, cost, best, n;
+    int  hmethod, hfrom;
     
-    stdh = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (!stdh) return -1;
-    GetConsoleScreenBufferInfo(stdh, &info);
+    if ((cx == x) && (cy == y)) return 0;
+    if (cx < 0) return TextScreen_PutCursorPosSeq(buf, x, y);
     
-    // fill console buffer to space
-    bufsize = info.dwSize.X * info.dwSize.Y;
-    coord.X = 0;
-    coord.Y = 0;
-    FillConsoleOutputCharacter(stdh, ' ', bufsize, coord, &len);
+    // 0: CUP  1: CUU/CUD and horizontal  2: CR, LF and CUF
+    best = 0;
+    cost = 3 + TextScreen_NumberLength(y + 1) + (x ? 1 + TextScreen_NumberLength(x + 1) : 0);  // ESC [ y ; x H
+    n = (y > cy) ? y - cy : cy - y;
+    if (((n ? 3 + TextScreen_NumberLength(n) : 0) + TextScreen_CursorMoveCostX(cx, x, &hmethod)) < cost) {
+        best = 1;
+        cost = (n ? 3 + TextScreen_NumberLength(n) : 0) + TextScreen_CursorMoveCostX(cx, x, &hmethod);
+    }
+    if ((y > cy) && (1 + n + (x ? 3 + TextScreen_NumberLength(x) : 0) < cost)) {
+        best = 2;
+    }
     
-    // set cursor position to (0,0)
-    coord.X = 0;
-    coord.Y = 0;
-    SetConsoleCursorPosition(stdh ,coord);
-#else
-    // P_RESET_STATE();
-    P_ERASE_ALL();
-    P_CURSOR_POS(0, 0);
-#endif
-    return 0;
+    index = 0;
+    if (best == 0)
+        return TextScreen_PutCursorPosSeq(buf, x, y);
+    hfrom = cx;
+    if (best == 1) {
+        if (n)
+            index += TextScreen_PutCsiSeq(buf + index, n, (y > cy) ? 'B' : 'A');
+    } else {
+        buf[index++] = 0x0d;
+        while (n--)
+            buf[index++] = 0x0a;
+        hfrom = 0;
+    }
+    TextScreen_CursorMoveCostX(hfrom, x, &hmethod);
+    if (hmethod == 1) {
+        index += TextScreen_PutCsiSeq(buf + index, x - hfrom, 'C');
+    } else if (hmethod == 2) {
+        index += TextScreen_PutCsiSeq(buf + index, hfrom - x, 'D');
+    } else if (hmethod == 3) {
+        buf[index++] = 0x0d;
+        if (x)
+            index += TextScreen_PutCsiSeq(buf + index, x, 'C');
+    }
+    return index;
 }
 
-int TextScreen_ResizeScreen(int width, int height)
+// put characters str (length len) to buf. run of same character is replaced
+// with REP "ESC [ n b" or ECH "ESC [ n X" when it is shorter.
+// cursorfree: 1 = cursor position after output is not used (next output sets cursor position)
+// erase: 1 = ECH can be used (erased cell is same as space of current attribute)
+// output is never longer than len, so buf may be same as str (in place)
+// return length of buf
+static int TextScreen_PutRepeatSeq(char *buf, const char *str, int len, int cursorfree, int erase)
 {
-    if ((width < 0) || (height < 0)) return -1;
+    int  index, i, n;
+    int  cost, repcost, echcost;
+    char ch;
     
-    if (!width || !height) {
-        int w, h;
-        TextScreen_GetConsoleSize(&w, &h);
-        if (!width) {
-            width = w - (SCREEN_DEFAULT_LEFT_MARGIN * 2);
-            if (width < 1) return -1;
-        }
-        if (!height) {
-            height = h - (SCREEN_DEFAULT_TOP_MARGIN * 2);
-            if (height < 1) return -1;
+    index = 0;
+    i = 0;
+    while (i < len) {
+        ch = str[i];
+        n = 1;
+        while ((i + n < len) && (str[i + n] == ch))
+            n++;
+        cost = n;
+        repcost = (n >= 2) ? 1 + 3 + TextScreen_NumberLength(n - 1) : n;
+        echcost = (erase && (ch == ' ')) ? (3 + TextScreen_NumberLength(n)) * (cursorfree && (i + n == len) ? 1 : 2) : n;
+        if ((echcost < cost) && (echcost <= repcost)) {
+            // erase n characters, then move cursor forward
+            index += TextScreen_PutCsiSeq(buf + index, n, 'X');
+            if (!(cursorfree && (i + n == len)))
+                index += TextScreen_PutCsiSeq(buf + index, n, 'C');
+        } else if (repcost < cost) {
+            buf[index++] = ch;
+            index += TextScreen_PutCsiSeq(buf + index, n - 1, 'b');
+        } else {
+            memmove(buf + index, str + i, n);
+            index += n;
         }
+        i += n;
     }
-    gSetting.width  = width;
-    gSetting.height = height;
-    return 0;
+    return index;
 }
 
-int TextScreen_GetConsoleSize(int *width, int *height)
+// put SGR parameters changing attribute cur to attr ("1;31" etc.),  return length
+static int TextScreen_PutSgrParams(char *buf, int cur, int attr)
 {
-#ifdef _WIN32
-	HANDLE stdouth;
-    CONSOLE_SCREEN_BUFFER_INFO info;
-    int ret;
+    int index = 0;
+    int c;
     
-    stdouth = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (!stdouth) {
-        *width  = 80;
-        *height = 25;
-        return -1;
+    if ((cur ^ attr) & TEXTSCREEN_ATTR_BOLD) {
+        index += TextScreen_PutNumber(buf + index, (attr & TEXTSCREEN_ATTR_BOLD) ? 1 : 22);
     }
-    ret = GetConsoleScreenBufferInfo(stdouth, &info);
-    if (ret) {
-        *width  = info.srWindow.Right-info.srWindow.Left + 1;
-        *height = info.srWindow.Bottom-info.srWindow.Top + 1;
-    } else {
-        *width  = 80;
-        *height = 25;
-        return -1;
+    if ((cur ^ attr) & TEXTSCREEN_ATTR_UNDERLINE) {
+        if (index) buf[index++] = ';';
+        index += TextScreen_PutNumber(buf + index, (attr & TEXTSCREEN_ATTR_UNDERLINE) ? 4 : 24);
     }
-    return 0;
-#else
-    struct winsize ws;
-    if (ioctl(0, TIOCGWINSZ, &ws) != -1) {
-        *width  = ws.ws_col;
-        *height = ws.ws_row;
+    if (TEXTSCREEN_ATTR_FG(cur) != TEXTSCREEN_ATTR_FG(attr)) {
+        if (index) buf[index++] = ';';
+        c = TEXTSCREEN_ATTR_FG(attr);
+        index += TextScreen_PutNumber(buf + index, ((c < 1) || (c > 16)) ? 39 : (c <= 8) ? 29 + c : 81 + c);
+    }
+    if (TEXTSCREEN_ATTR_BG(cur) != TEXTSCREEN_ATTR_BG(attr)) {
+        if (index) buf[index++] = ';';
+        c = TEXTSCREEN_ATTR_BG(attr);
+        index += TextScreen_PutNumber(buf + index, ((c < 1) || (c > 16)) ? 49 : (c <= 8) ? 39 + c : 91 + c);
+    }
+    return index;
+}
+
+// put SGR sequence changing attribute of console cur to attr (only changed parameters, or reset and set)
+// return length
+static int TextScreen_PutSgrSeq(char *buf, int cur, int attr)
+{
+    char params[P_SGR_MAXLEN];
+    int  index, n, nreset;
+    
+    if (cur == attr) return 0;
+    buf[0] = 0x1b;
+    buf[1] = '[';
+    index = 2;
+    n      = TextScreen_PutSgrParams(params, cur, attr);
+    nreset = TextScreen_PutSgrParams(buf + index + 2, 0, attr);
+    if (!attr) {
+        // "ESC [ m"
+    } else if (nreset + 2 < n) {
+        buf[index++] = '0';
+        buf[index++] = ';';
+        index += nreset;
     } else {
-        *width  = 80;
-        *height = 25;
-        return -1;
+        memcpy(buf + index, params, n);
+        index += n;
     }
-    return 0;
-#endif
+    buf[index++] = 'm';
+    return index;
 }
 
-int TextScreen_SetCursorPos(int x, int y)
+// put characters str with attribute (NULL: all 0) and code point (NULL: all 0, see TEXTSCREEN_CODE_RIGHT),
+// SGR is changed from *sgr (console attribute)
+// repeat: use REP/ECH  cursorfree: same as TextScreen_PutRepeatSeq(),  return length of buf
+static int TextScreen_PutCellRun(char *buf, const char *str, const unsigned short *attr, const unsigned int *code, 
+                                 int len, int repeat, int cursorfree, int *sgr)
 {
-    int  width, height;
-    int  ret;
+    const struct CodeCache *cache;
+    int index = 0;
+    int i, k, n, a, iscode;
     
-    ret = TextScreen_GetConsoleSize(&width, &height);
-    if (ret) return ret;
+    for (i = 0; i < len; i += n) {
+        a = attr ? attr[i] : 0;
+        iscode = code ? (code[i] != 0) : 0;
+        n = 1;
+        if (!attr && !code) {
+            n = len;
+        } else {
+            while ((i + n < len) && ((attr ? attr[i + n] : 0) == a) && ((code ? (code[i + n] != 0) : 0) == iscode))
+                n++;
+        }
+        index += TextScreen_PutSgrSeq(buf + index, *sgr, a);
+        *sgr = a;
+        if (iscode) {
+            for (k = i; k < i + n; k++) {
+                if (code[k] == TEXTSCREEN_CODE_RIGHT) continue;
+                cache = TextScreen_LookupCode(code[k]);
+                memcpy(buf + index, cache->utf8, cache->len);
+                index += cache->len;
+            }
+        } else if (repeat) {
+            index += TextScreen_PutRepeatSeq(buf + index, str + i, n, cursorfree && (i + n == len), 
+                                             !TEXTSCREEN_ATTR_BG(a) && !(a & TEXTSCREEN_ATTR_UNDERLINE));
+        } else {
+            memcpy(buf + index, str + i, n);
+            index += n;
+        }
+    }
+    return index;
+}
+
+// grow output buffer to keep len bytes more,  return 0:successful  -1:error
+static int TextScreen_OutGrow(int len)
+{
+    char *buf;
+    int  size;
     
-    if (x < 0) x = 0;
-    if (x >= width) x = width - 1;
-    if (y < 0) y = 0;
-    if (y >= height) y = height - 1;
+    if (gFrameBufLen + len <= gFrameBufSize) return 0;
+    size = gFrameBufSize * 2;
+    if (size < gFrameBufLen + len)
+        size = gFrameBufLen + len;
+    buf = (char *)realloc(gFrameBuf, size);
+    if (!buf) return -1;
+    gFrameBuf     = buf;
+    gFrameBufSize = size;
+    return 0;
+}
+
+// grow segment table to keep num segments,  return 0:successful  -1:error
+static int TextScreen_OutGrowSegment(int num)
+{
+    struct OutSegment *seg;
+    int  size;
     
+    if (num <= gOutSegSize) return 0;
+    size = gOutSegSize * 2;
+    if (size < num)
+        size = num;
+    seg = (struct OutSegment *)realloc(gOutSeg, sizeof(struct OutSegment) * size);
+    if (!seg) return -1;
+    gOutSeg = seg;
 #ifdef _WIN32
+#else
     {
-        HANDLE stdouth;
-        COORD  coord;
-        
-        stdouth = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (!stdouth) return -1;
+        struct iovec *iov;
         
-        coord.X = (SHORT)x;
-        coord.Y = (SHORT)y;
-        SetConsoleCursorPosition(stdouth, coord);
+        iov = (struct iovec *)realloc(gOutIov, sizeof(struct iovec) * size);
+        if (!iov) return -1;
+        gOutIov = iov;
     }
-#else
-    P_CURSOR_POS(x, y);
 #endif
+    gOutSegSize = size;
     return 0;
 }
 
-int TextScreen_SetCursorVisible(int visible)
+static void TextScreen_OutAddSegment(const char *ref, int offset, int len)
 {
-#ifdef _WIN32
-    HANDLE stdouth;
-    CONSOLE_CURSOR_INFO cursorinfo;  // DWORD dwSize, BOOL bVisible
-    
-    stdouth = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (!stdouth) return -1;
+    struct OutSegment *last;
     
-    GetConsoleCursorInfo(stdouth, &cursorinfo);
-    cursorinfo.bVisible = (visible != 0);
-    SetConsoleCursorInfo(stdouth, &cursorinfo);
-    return 0;
-#else
-    if (visible) {
-        P_CURSOR_SHOW();
-    } else {
-        P_CURSOR_HIDE();
+    if (len <= 0) return;
+    if (gOutSegNum) {  // join with last segment if continuous
+        last = &gOutSeg[gOutSegNum - 1];
+        if (!ref && !last->ref && (last->offset + last->len == offset)) {
+            last->len += len;
+            return;
+        }
+        if (ref && last->ref && (last->ref + last->len == ref)) {
+            last->len += len;
+            return;
+        }
     }
-    return 0;
-#endif
+    if (TextScreen_OutGrowSegment(gOutSegNum + 1)) return;
+    gOutSeg[gOutSegNum].ref    = ref;
+    gOutSeg[gOutSegNum].offset = offset;
+    gOutSeg[gOutSegNum].len    = len;
+    gOutSegNum++;
 }
 
-void TextScreen_Wait(unsigned int ms)
+// get write pointer of output buffer (keep len bytes),  return NULL:error
+// pointer is valid until next TextScreen_OutReserve() or TextScreen_OutPut*()
+static char *TextScreen_OutReserve(int len)
 {
-#ifdef _WIN32
-    Sleep(ms);
-#else
-    struct timespec t;
-    
-    t.tv_sec  = ms / 1000;
-    t.tv_nsec = (ms % 1000) * 1000000L;
-    nanosleep(&t, NULL);
-#endif
+    if (TextScreen_OutGrow(len)) return NULL;
+    return gFrameBuf + gFrameBufLen;
 }
 
-unsigned int TextScreen_GetTickCount(void)
+// queue len bytes written to pointer of TextScreen_OutReserve()
+static void TextScreen_OutCommit(int len)
 {
-#ifdef _WIN32
-    DWORD tick;
-    
-#if USE_WINMM == 1
-    tick = timeGetTime();
-#else
-    tick = GetTickCount();
-#endif
-    return tick;
-#else
-    struct timeval tv;
-    
-    gettimeofday(&tv, NULL);
-    return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
-#endif
+    TextScreen_OutAddSegment(NULL, gFrameBufLen, len);
+    gFrameBufLen += len;
 }
 
-void TextScreen_SetSpaceChar(char ch)
+// queue copy of str
+static void TextScreen_OutPut(const char *str, int len)
 {
-    gSetting.space = ch;
+    char *buf;
+    
+    buf = TextScreen_OutReserve(len);
+    if (!buf) return;
+    memcpy(buf, str, len);
+    TextScreen_OutCommit(len);
 }
 
-void TextScreen_SetRenderingMethod(int method)
+static void TextScreen_OutPutStr(const char *str)
 {
-    if ((method >= 0) && (method < TEXTSCREEN_RENDERING_METHOD_NB)) {
-        gSetting.renderingMethod = method;
-    }
+    TextScreen_OutPut(str, (int)strlen(str));
 }
 
-void TextScreen_GetSetting(TextScreenSetting *setting)
+// queue reference of str (not copied. str must be kept until TextScreen_OutFlush())
+static void TextScreen_OutPutRef(const char *str, int len)
 {
-    *setting = gSetting;
+    TextScreen_OutAddSegment(str, 0, len);
 }
 
-int TextScreen_SetSetting(TextScreenSetting *setting)
+static void TextScreen_OutPutCursorPos(int x, int y)
 {
-    if (!setting) return -1;
-    
-    gSetting = *setting;
-    if (gSetting.sar < 0.1)
-        gSetting.sar = 0.1;
-    if (gSetting.sar > 10.0)
-        gSetting.sar = 10.0;
+    char *buf;
     
-    return 0;
+    buf = TextScreen_OutReserve(P_CURSOR_POS_MAXLEN);
+    if (!buf) return;
+    TextScreen_OutCommit(TextScreen_PutCursorPosSeq(buf, x, y));
 }
 
-void TextScreen_GetSettingDefault(TextScreenSetting *setting)
+#ifdef _WIN32
+#else
+// append iov data to pending output,  return 0:successful  -1:error
+static int TextScreen_OutAddPending(struct iovec *iov, int iovcnt)
 {
-    int width, height;
+    char *p;
+    int   i, len;
     
-    if (!setting) return;
-    TextScreen_GetConsoleSize(&width, &height);
-    
-    setting->space      = SCREEN_DEFAULT_SPACE_CHAR;
-    // setting->width      = SCREEN_DEFAULT_SIZE_X;
-    // setting->height     = SCREEN_DEFAULT_SIZE_Y;
-    setting->width      = width  - (SCREEN_DEFAULT_LEFT_MARGIN * 2);
-    setting->height     = height - (SCREEN_DEFAULT_TOP_MARGIN * 2);
-    setting->topMargin  = SCREEN_DEFAULT_TOP_MARGIN;
-    setting->leftMargin = SCREEN_DEFAULT_LEFT_MARGIN;
-    setting->sar        = SCREEN_DEFAULT_SAR;
-    setting->renderingMethod = SCREEN_DEFAULT_RENDERING_METHOD;
-    setting->sigintHandler = NULL;
-    setting->sigintHandlerUserData = NULL;
-    setting->translate  = (char *)gTranslateTable;
+    if (gOutPendingPos > 0) {
+        memmove(gOutPending, gOutPending + gOutPendingPos, gOutPendingLen - gOutPendingPos);
+        gOutPendingLen -= gOutPendingPos;
+        gOutPendingPos  = 0;
+    }
+    for (i = 0, len = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (gOutPendingLen + len > gOutPendingSize) {
+        p = (char *)realloc(gOutPending, gOutPendingLen + len);
+        if (!p) return -1;
+        gOutPending     = p;
+        gOutPendingSize = gOutPendingLen + len;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memmove(gOutPending + gOutPendingLen, iov[i].iov_base, iov[i].iov_len);
+        gOutPendingLen += iov[i].iov_len;
+    }
+    return 0;
 }
 
-// #TODO: refactoring and improving code of TextScreen_GetKey()
-int TextScreen_GetKey(void) {
-#ifdef _WIN32
-    int key = 0;
-    int ch = 0;
+// write all iov to fd (retry short write, wait when EAGAIN)
+// block=0: don't wait for fd, rest of iov is kept in pending output
+// (file status flags of fd are not changed: they are shared with stdin of tty and other processes.
+//  fd is polled, and written by TEXTSCREEN_NONBLOCK_WRITE bytes at most while it is writable)
+// return 0:successful  1:rest is pending  -1:error
+static int TextScreen_OutWritev(int fd, struct iovec *iov, int iovcnt, int block)
+{
+    struct pollfd pfd;
+    ssize_t n;
+    size_t  len, cutlen = 0;
+    int     ret = 0;
+    int     cnt, cut;
     
-    if (_kbhit()) {
-        int j;
-        unsigned char seq[8] = {0}
-        ;
-        ch = _getch();
-        seq[0] = (unsigned char)ch;
-        if (ch == 0xe0 || ch == 0x00) {
-            ch = _getch();
-            seq[1] = (unsigned char)ch;
-            j = 0;
-            while (gKeyScanWin[j].keycode) {
-                if (gKeyScanWin[j].num == 2) {
-                    if ((gKeyScanWin[j].seq[0] == seq[0]) && (gKeyScanWin[j].seq[1] == seq[1])) {
-                        key = gKeyScanWin[j].keycode;
-                        return key;
-                    }
-                }
-                j++;
+    while (iovcnt > 0) {
+        pfd.fd      = fd;
+        pfd.events  = POLLOUT;
+        pfd.revents = 0;
+        cnt = iovcnt;
+        cut = -1;
+        if (!block) {
+            n = poll(&pfd, 1, 0);
+            if ((n < 0) && (errno == EINTR)) continue;
+            if (!n) {
+                ret = TextScreen_OutAddPending(iov, iovcnt) ? -1 : 1;
+                break;
             }
-            key = TSK_POSKEY + ch;
-        } else {
-            j = 0;
-            while (gKeyScanWin[j].keycode) {
-                if (gKeyScanWin[j].num == 1) {
-                    if (gKeyScanWin[j].seq[0] == seq[0]) {
-                        key = gKeyScanWin[j].keycode;
-                        return key;
-                    }
+            // write size which fd takes without blocking
+            for (cnt = 0, len = 0; (cnt < iovcnt) && (len < TEXTSCREEN_NONBLOCK_WRITE); cnt++)
+                len += iov[cnt].iov_len;
+            if (len > TEXTSCREEN_NONBLOCK_WRITE) {
+                cut    = cnt - 1;
+                cutlen = iov[cut].iov_len;
+                iov[cut].iov_len -= len - TEXTSCREEN_NONBLOCK_WRITE;
+            }
+        }
+        n = writev(fd, iov, cnt);
+        if (cut >= 0)
+            iov[cut].iov_len = cutlen;
+        gStatsCur.writes++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                // fd is nonblocking (set by other process)
+                if (!block) {
+                    ret = TextScreen_OutAddPending(iov, iovcnt) ? -1 : 1;
+                    break;
                 }
-                j++;
+                poll(&pfd, 1, -1);
+                continue;
             }
-            key = seq[0];
+            ret = -1;
+            break;
+        }
+        while ((iovcnt > 0) && ((size_t)n >= iov->iov_len)) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
         }
     }
-    return key;
+    return ret;
+}
+#endif
+
+// write pending output of nonblocking write (block=0: don't wait for console)
+// return 0:successful (nothing is pending)  1:still pending  -1:error
+static int TextScreen_OutDrain(int block)
+{
+#ifdef _WIN32
+    return 0;
 #else
-    int key = 0;
-    int ch = 0;
+    struct iovec iov;
     
-    int nkey;
-    int savefflag = 0;
-    int ret;
-    
-    // set non-blocking mode
-    savefflag = fcntl(STDIN_FILENO, F_GETFL);
-    ret = fcntl(STDIN_FILENO, F_SETFL, savefflag | O_NONBLOCK);
-    if (ret < 0) return 0;
+    if (gOutPendingPos >= gOutPendingLen) return 0;
+    iov.iov_base = gOutPending + gOutPendingPos;
+    iov.iov_len  = gOutPendingLen - gOutPendingPos;
+    gOutPendingPos = 0;  // rest is added again (moved to top of buffer)
+    gOutPendingLen = 0;
+    return TextScreen_OutWritev(STDOUT_FILENO, &iov, 1, block);
+#endif
+}
+
+// write queued data to console (or backend) now (block=0: don't wait for console, rest is written later)
+// endOfFrame=1: end of frame (for backend),  return 0:successful  1:rest is pending  -1:error
+static int TextScreen_OutWrite(int block, int endOfFrame)
+{
+    double start = TextScreen_GetTime();
+    unsigned long long trace = TextScreen_TraceBegin();
+    long bytes = gStatsCur.bytes;
+    int ret = 0;
+    int i;
     
-    nkey = read(STDIN_FILENO, &ch, 1);
-    if (nkey == 1) {
-        key = ch;
-        if (ch == 0x0a) {
-            key = TSK_ENTER;
+    if (gSetting.backend) {
+        TextScreenBackend *backend = gSetting.backend;
+        
+        for (i = 0; (i < gOutSegNum) && !ret; i++) {
+            ret = backend->write(backend->userdata, 
+                                 gOutSeg[i].ref ? gOutSeg[i].ref : gFrameBuf + gOutSeg[i].offset, gOutSeg[i].len);
+            gStatsCur.bytes += gOutSeg[i].len;
+            gStatsCur.writes++;
         }
-        if (ch == 0x1b) {
-            int i, j;
-            unsigned char seq[8] = {0};
-            
-            seq[0] = ch;
-            for (i = 2; i < 7; i++) {
-                nkey = read(STDIN_FILENO, &ch, 1);
-                if (nkey != 1) {
-                    if (i == 2) {
-                        fcntl(STDIN_FILENO, F_SETFL, savefflag);
-                        return TSK_ESC;
-                    } else {
-                        fcntl(STDIN_FILENO, F_SETFL, savefflag);
-                        return 0;
-                    }
-                }
-                seq[i - 1] = ch;
-                j = 0;
-                while (gKeyEscSequence[j].keycode) {
-                    if (gKeyEscSequence[j].num == i) {
-                        if(!strcmp((char *)seq, (char *)gKeyEscSequence[j].seq)) {
-                            key = gKeyEscSequence[j].keycode;
-                            while (read(STDIN_FILENO, &ch, 1) == 1);
-                            fcntl(STDIN_FILENO, F_SETFL, savefflag);
-                            return key;
-                        }
-                    }
-                    j++;
-                }
-            }
-            while (read(STDIN_FILENO, &ch, 1) == 1);
-            key = 0;
+        if (backend->flush && backend->flush(backend->userdata, endOfFrame))
+            ret = -1;
+        gOutSegNum   = 0;
+        gFrameBufLen = 0;
+        gStatsCur.writeTime += (TextScreen_GetTime() - start) * 1000;
+        TextScreen_TraceEnd("write", trace, gStatsCur.bytes - bytes);
+        return ret;
+    }
+    if (!gOutSegNum) {
+        ret = TextScreen_OutDrain(block);
+        gStatsCur.writeTime += (TextScreen_GetTime() - start) * 1000;
+        TextScreen_TraceEnd("write", trace, 0);
+        return ret;
+    }
+#ifdef _WIN32
+    for (i = 0; i < gOutSegNum; i++) {
+        gStatsCur.bytes += gOutSeg[i].len;
+        gStatsCur.writes++;
+        if (gOutSeg[i].ref) {
+            fwrite(gOutSeg[i].ref, 1, gOutSeg[i].len, stdout);
+        } else {
+            fwrite(gFrameBuf + gOutSeg[i].offset, 1, gOutSeg[i].len, stdout);
+        }
+    }
+    fflush(stdout);
+#else
+    // keep order with output of stdio (printf etc.) and pending output
+    fflush(stdout);
+    ret = TextScreen_OutDrain(block);
+    for (i = 0; i < gOutSegNum; i++) {
+        if (gOutSeg[i].ref) {
+            gOutIov[i].iov_base = (void *)gOutSeg[i].ref;
+        } else {
+            gOutIov[i].iov_base = gFrameBuf + gOutSeg[i].offset;
+        }
+        gOutIov[i].iov_len = gOutSeg[i].len;
+        gStatsCur.bytes += gOutSeg[i].len;
+    }
+    for (i = 0; (i < gOutSegNum) && (ret >= 0); i += TEXTSCREEN_IOV_MAX) {
+        int n = (gOutSegNum - i < TEXTSCREEN_IOV_MAX) ? gOutSegNum - i : TEXTSCREEN_IOV_MAX;
+        
+        if (ret == 1) {
+            ret = TextScreen_OutAddPending(gOutIov + i, n) ? -1 : 1;
+        } else {
+            ret = TextScreen_OutWritev(STDOUT_FILENO, gOutIov + i, n, block);
         }
-    } else {
-        key = 0;
     }
-    // restore file mode
-    fcntl(STDIN_FILENO, F_SETFL, savefflag);
-    return key;
 #endif
+    gOutSegNum   = 0;
+    gFrameBufLen = 0;
+    gStatsCur.writeTime += (TextScreen_GetTime() - start) * 1000;
+    TextScreen_TraceEnd("write", trace, gStatsCur.bytes - bytes);
+    return ret;
 }
 
+// write queued data to console (in frame: keep until TextScreen_EndFrame()),  return 0:successful  -1:error
+static int TextScreen_OutFlush(void)
+{
+    if (gFrameDepth > 0) return 0;
+    return TextScreen_OutWrite(1, 0);
+}
 
-/********************************
- Bitmap Draw Tools
- ********************************/
+// begin frame: keep output until end of frame,  return 0:successful  -1:error
+static int TextScreen_OutBeginFrame(void)
+{
+    gFrameDepth++;
+#ifdef _WIN32
+#else
+    if ((gFrameDepth == 1) && (gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_SYNC)) {
+        // begin synchronized update: console shows frame after end of synchronized update
+        TextScreen_OutPutStr("\x1b[?2026h");
+    }
+#endif
+    return 0;
+}
 
-void TextScreen_DrawFillCircle(TextScreenBitmap *bitmap, int x, int y, int r, char ch)
+// end frame: write output of frame (at end of outermost frame)
+// block=0: don't wait for console (rest of frame is written later),  return 0:successful  -1:error
+static int TextScreen_OutEndFrame(int block)
 {
-    int xd, yd, last_yd, last_xd;
-    double m;
-    
-    if (!bitmap) return;
-    if (r < 0)   return;
+    int ret;
     
-    xd = 0;
-    yd = r;
-    while(xd <= r * gSetting.sar) {
-        last_yd = yd;
-        m = (double)(r * r) - (double)(xd * xd) / (gSetting.sar * gSetting.sar);
-        yd = (int)(sqrt(fabs(m)) + 0.5);
-        if (last_yd - yd > 1) break;
-        TextScreen_DrawLine(bitmap, x + xd, y + yd, x + xd, y - yd, ch);
-        TextScreen_DrawLine(bitmap, x - xd, y + yd, x - xd, y - yd, ch);
-        xd += 1;
-    }
-    xd = r;
-    yd = 0;
-    while(yd <= r) {
-        last_xd = xd;
-        m = (double)(r * r) - (double)(yd * yd);
-        xd = (int)(sqrt(m) * gSetting.sar + 0.5);
-        if (last_xd - xd > 1) break;
-        TextScreen_DrawLine(bitmap, x + xd, y + yd, x - xd, y + yd, ch);
-        TextScreen_DrawLine(bitmap, x + xd, y - yd, x - xd, y - yd, ch);
-        yd += 1;
+    if (gFrameDepth <= 0) return -1;
+    gFrameDepth--;
+    if (gFrameDepth > 0) return 0;
+#ifdef _WIN32
+#else
+    if (gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_SYNC) {
+        TextScreen_OutPutStr("\x1b[?2026l");
     }
+#endif
+    ret = TextScreen_OutWrite(block, 1);
+    if (!block)
+        gOutSaturated = (ret == 1);
+    TextScreen_StatsEndFrame();
+    return (ret < 0) ? -1 : 0;
 }
 
-void TextScreen_DrawCircle(TextScreenBitmap *bitmap, int x, int y, int r, char ch, int mode)
+// prepare output buffer for current screen setting,  return 0:successful  -1:error
+static int TextScreen_PrepareFrameBuffer(void)
 {
-    int xd, yd, last_xd, last_yd;
-    double m;
+    int  size;
     
-    if (!bitmap) return;
-    if (r < 0)   return;
+    if ((gSetting.width < 0) || (gSetting.height < 0) || (gSetting.topMargin < 0) || (gSetting.leftMargin < 0))
+        return -1;
+    // large enough for all rendering method (and some escape sequences)
+    size = (gSetting.topMargin * 2) + 
+           (gSetting.width + gSetting.leftMargin + P_CURSOR_POS_MAXLEN) * gSetting.height + 64;
+    if (TextScreen_OutGrow(size - gFrameBufLen)) return -1;
+    // segment: (margin, row) x height
+    if (TextScreen_OutGrowSegment(gSetting.height * 2 + 16)) return -1;
+    return 0;
+}
+
+// check translate table is identity
+static void TextScreen_CheckTranslate(void)
+{
+    int i, n;
     
-    if (mode == 1) {
-        TextScreen_DrawFillCircle(bitmap, x, y, r, ch);
-        return;
+    gTranslateIdentity = 0;
+    gTranslateRangeNum = -1;
+    if (!gSetting.translate) return;
+    memcpy(gTranslateCopy, gSetting.translate, sizeof(gTranslateCopy));
+    // ranges of character not translated to itself
+    n = 0;
+    for (i = 0; i < 256; i++) {
+        if ((unsigned char)gSetting.translate[i] == i) continue;
+        if (!n) {
+            gTranslateRangeChar = gSetting.translate[i];
+        } else if (gSetting.translate[i] != gTranslateRangeChar) {
+            return;
+        }
+        if (n && (gTranslateRangeLo[n - 1] + gTranslateRangeLen[n - 1] + 1 == i)) {
+            gTranslateRangeLen[n - 1]++;
+            continue;
+        }
+        if (n >= TEXTSCREEN_TRANSLATE_MAXRANGE) return;
+        gTranslateRangeLo[n]  = (unsigned char)i;
+        gTranslateRangeLen[n] = 0;
+        n++;
     }
-    if (mode == 2)
-        TextScreen_DrawFillCircle(bitmap, x, y, r, gSetting.space);
+    gTranslateRangeNum = n;
+    gTranslateIdentity = !n;
+}
+
+// check translate table again if it is changed in place (before frame)
+static void TextScreen_UpdateTranslate(void)
+{
+    if (gSetting.translate && memcmp(gSetting.translate, gTranslateCopy, sizeof(gTranslateCopy)))
+        TextScreen_CheckTranslate();
+}
+
+// translate len characters of src to dst by table
+static void TextScreen_TranslateSpan(char *dst, const unsigned char *src, int len, const char *translate)
+{
+    int x = 0;
     
-    xd = 0;
-    yd = r;
-    while(xd <= r * gSetting.sar) {
-        last_yd = yd;
-        m = (double)(r * r) - (double)(xd * xd) / (gSetting.sar * gSetting.sar);
-        yd = (int)(sqrt(fabs(m)) + 0.5);
-        if (last_yd - yd > 1) break;
+    if ((translate != gSetting.translate) || (gTranslateRangeNum < 0)) {
+        for (x = 0; x < len; x++)
+            dst[x] = translate[src[x]];
+        return;
+    }
+    if (gTranslateRangeNum == 0) {
+        memcpy(dst, src, len);
+        return;
+    }
+    // (identity except ranges) compare and blend 16 characters at once
+#if defined(TEXTSCREEN_SIMD_SSE2)
+    {
+        __m128i lo[TEXTSCREEN_TRANSLATE_MAXRANGE], range[TEXTSCREEN_TRANSLATE_MAXRANGE];
+        __m128i ch, d, mask, rep;
+        int  i;
+        
+        for (i = 0; i < gTranslateRangeNum; i++) {
+            lo[i]    = _mm_set1_epi8((char)gTranslateRangeLo[i]);
+            range[i] = _mm_set1_epi8((char)gTranslateRangeLen[i]);
+        }
+        rep = _mm_set1_epi8(gTranslateRangeChar);
+        for (; x + 16 <= len; x += 16) {
+            ch   = _mm_loadu_si128((const __m128i *)(src + x));
+            mask = _mm_setzero_si128();
+            for (i = 0; i < gTranslateRangeNum; i++) {
+                // (unsigned)(ch - lo) <= range
+                d    = _mm_sub_epi8(ch, lo[i]);
+                mask = _mm_or_si128(mask, _mm_cmpeq_epi8(_mm_min_epu8(d, range[i]), d));
+            }
+            ch = _mm_or_si128(_mm_and_si128(mask, rep), _mm_andnot_si128(mask, ch));
+            _mm_storeu_si128((__m128i *)(dst + x), ch);
+        }
+    }
+#elif defined(TEXTSCREEN_SIMD_NEON)
+    {
+        uint8x16_t lo[TEXTSCREEN_TRANSLATE_MAXRANGE], range[TEXTSCREEN_TRANSLATE_MAXRANGE];
+        uint8x16_t ch, mask, rep;
+        int  i;
+        
+        for (i = 0; i < gTranslateRangeNum; i++) {
+            lo[i]    = vdupq_n_u8(gTranslateRangeLo[i]);
+            range[i] = vdupq_n_u8(gTranslateRangeLen[i]);
+        }
+        rep = vdupq_n_u8((unsigned char)gTranslateRangeChar);
+        for (; x + 16 <= len; x += 16) {
+            ch   = vld1q_u8(src + x);
+            mask = vdupq_n_u8(0);
+            for (i = 0; i < gTranslateRangeNum; i++) {
+                mask = vorrq_u8(mask, vcleq_u8(vsubq_u8(ch, lo[i]), range[i]));
+            }
+            vst1q_u8((unsigned char *)dst + x, vbslq_u8(mask, rep, ch));
+        }
+    }
+#endif
+    for (; x < len; x++)
+        dst[x] = translate[src[x]];
+}
+
+// copy screen row of bitmap (dst[x] = cell(sx + x, sy)) to dst (width chars), translate by table (NULL: no translate)
+// cells outside of bitmap are 0 (same as TextScreen_GetCell())
+static void TextScreen_ClipRow(char *dst, int width, TextScreenBitmap *bitmap, int sx, int sy, const char *translate)
+{
+    const unsigned char *src;
+    char out;
+    int  x0, x1;
+    
+    out = translate ? translate[0] : 0;
+    if ((sy < 0) || (sy >= bitmap->height) || (sx >= bitmap->width) || (sx + width <= 0)) {
+        memset(dst, out, width);
+        return;
+    }
+    // visible span [x0, x1)
+    x0 = (sx < 0) ? -sx : 0;
+    x1 = (bitmap->width - sx < width) ? bitmap->width - sx : width;
+    src = (const unsigned char *)bitmap->data + sy * bitmap->width + sx;
+    memset(dst, out, x0);
+    if (translate) {
+        TextScreen_TranslateSpan(dst + x0, src + x0, x1 - x0, translate);
+    } else {
+        memcpy(dst + x0, src + x0, x1 - x0);
+    }
+    memset(dst + x1, out, width - x1);
+}
+
+// copy attribute of screen row of bitmap (same as TextScreen_ClipRow()). 0 outside of bitmap or no attribute plane
+static void TextScreen_ClipAttrRow(unsigned short *dst, int width, TextScreenBitmap *bitmap, int sx, int sy)
+{
+    int x0, x1;
+    
+    if (!bitmap->attr || (sy < 0) || (sy >= bitmap->height) || (sx >= bitmap->width) || (sx + width <= 0)) {
+        memset(dst, 0, sizeof(unsigned short) * width);
+        return;
+    }
+    x0 = (sx < 0) ? -sx : 0;
+    x1 = (bitmap->width - sx < width) ? bitmap->width - sx : width;
+    memset(dst, 0, sizeof(unsigned short) * x0);
+    memcpy(dst + x0, bitmap->attr + sy * bitmap->width + sx + x0, sizeof(unsigned short) * (x1 - x0));
+    memset(dst + x1, 0, sizeof(unsigned short) * (width - x1));
+}
+
+// copy code point of screen row of bitmap (same as TextScreen_ClipRow()). 0 outside of bitmap or no code point plane
+// raw: 0 = for renderer (0: character cell, TEXTSCREEN_CODE_RIGHT: right half)  1 = copy code point plane
+// return 1: row has code point cell (raw = 0)
+static int TextScreen_ClipCodeRow(unsigned int *dst, int width, TextScreenBitmap *bitmap, int sx, int sy, int raw)
+{
+    const char *data, *p;
+    const unsigned int *code;
+    int x, x0, x1;
+    
+    if (!bitmap->code || (sy < 0) || (sy >= bitmap->height) || (sx >= bitmap->width) || (sx + width <= 0)) {
+        memset(dst, 0, sizeof(unsigned int) * width);
+        return 0;
+    }
+    x0 = (sx < 0) ? -sx : 0;
+    x1 = (bitmap->width - sx < width) ? bitmap->width - sx : width;
+    code = bitmap->code + sy * bitmap->width + sx;
+    data = bitmap->data + sy * bitmap->width + sx;
+    if (raw) {
+        memset(dst, 0, sizeof(unsigned int) * x0);
+        memcpy(dst + x0, code + x0, sizeof(unsigned int) * (x1 - x0));
+        memset(dst + x1, 0, sizeof(unsigned int) * (width - x1));
+        return 0;
+    }
+    memset(dst, 0, sizeof(unsigned int) * width);
+    p = (const char *)memchr(data + x0, TEXTSCREEN_CHAR_CODE, x1 - x0);
+    if (!p) return 0;  // character cells only (ASCII row)
+    for (x = (int)(p - data); x < x1; x++) {
+        if (data[x] == TEXTSCREEN_CHAR_CODE)
+            dst[x] = code[x] ? code[x] : TEXTSCREEN_CODE_RIGHT;
+    }
+    return 1;
+}
+
+// make code point row (by TextScreen_ClipCodeRow()) printable. not printable code point, wide character
+// without right half and right half without wide character are changed to blank.
+// str (character) of code point cell is blank, and attribute of right half is same as wide character
+static void TextScreen_FixCodeRow(char *str, unsigned short *attr, unsigned int *code, int width)
+{
+    const struct CodeCache *cache;
+    const char *translate = gSetting.translate ? gSetting.translate : (const char *)gTranslateTable;
+    char blank = translate[(unsigned char)' '];
+    int  x;
+    
+    for (x = 0; x < width; x++) {
+        if (!code[x]) continue;
+        str[x] = blank;
+        if (code[x] == TEXTSCREEN_CODE_RIGHT) {
+            code[x] = 0;
+            continue;
+        }
+        cache = TextScreen_LookupCode(code[x]);
+        if (cache->width == 2) {
+            if ((x + 1 < width) && (code[x + 1] == TEXTSCREEN_CODE_RIGHT)) {
+                str[x + 1] = blank;
+                if (attr)
+                    attr[x + 1] = attr[x];
+                x++;
+                continue;
+            }
+        } else if (cache->width == 1) {
+            continue;
+        }
+        code[x] = 0;
+    }
+}
+
+// prepare row buffer (gRowBuf, gRowAttr, gRowCode) for width,  return 0:successful  -1:error
+static int TextScreen_PrepareRowBuffer(int width)
+{
+    char *buf;
+    unsigned short *attr;
+    unsigned int *code;
+    
+    if (width <= gRowBufSize) return 0;
+    buf  = (char *)realloc(gRowBuf, width);
+    if (!buf) return -1;
+    gRowBuf = buf;
+    attr = (unsigned short *)realloc(gRowAttr, sizeof(unsigned short) * width);
+    if (!attr) return -1;
+    gRowAttr = attr;
+    code = (unsigned int *)realloc(gRowCode, sizeof(unsigned int) * width);
+    if (!code) return -1;
+    gRowCode = code;
+    gRowBufSize = width;
+    return 0;
+}
+
+#ifdef _WIN32
+#else
+static int gSavedTermFlag = 0;
+static struct termios gSavedTerm;
+int TextScreen_SetNonBufferedTerm(void)
+{
+    struct termios term;
+    int ret = 0;
+    
+    if (gSavedTermFlag) {
+        ret = tcsetattr(STDIN_FILENO, TCSANOW, &gSavedTerm);
+        gSavedTermFlag = 0;
+    }
+    ret = tcgetattr(STDIN_FILENO, &term);
+    if (ret < 0) return ret;
+    gSavedTerm = term;
+    gSavedTermFlag = 1;
+    term.c_lflag &= ~(ECHO | ICANON);
+    term.c_cc[VMIN]  = 1;
+    term.c_cc[VTIME] = 0;
+    ret = tcsetattr(STDIN_FILENO, TCSANOW, &term);
+    if (ret < 0) return ret;
+    // note: set non-blocking mode at TextScreen_GetKey()
+    
+    return ret;
+}
+int TextScreen_RestoreTerm(void)
+{
+    int ret = 0;
+    
+    if (gSavedTermFlag) {
+        ret = tcsetattr(0, TCSANOW, &gSavedTerm);
+    }
+    return ret;
+}
+#endif
+
+// Windows prototype: BOOL HandlerRoutine(DWORD dwCtrlType)
+int TextScreen_SIGINT_handler(int sig)
+{
+    int ret = 0;
+    
+#ifdef _WIN32
+    // Windows sig value:
+    // CTRL_C_EVENT 0 : CTRL_BREAK_EVENT 1 : CTRL_CLOSE_EVENT 2
+    // CTRL_LOGOFF_EVENT 5 : CTRL_SHUTDOWN_EVENT 6
+    sig = 2;   // set sig value to same as linux SIGINT
+#endif
+    if (gSetting.sigintHandler) {
+        gSetting.sigintHandler(sig, gSetting.sigintHandlerUserData);
+        ret = 1;
+    } else {
+        // sigintHnadler is not defined...
+        TextScreen_End();
+#ifdef _WIN32
+        // Windows: use default ctrl handler (return=0)
+#else
+        // Lunux: force exit
+        _exit(sig);
+#endif
+    }
+    return ret;
+}
+
+void TextScreen_SetSigintHandler(void (*handler)(int, void*), void *userdata)
+{
+    gSetting.sigintHandler = handler;
+    gSetting.sigintHandlerUserData = userdata;
+}
+
+int TextScreen_Init(TextScreenSetting *usersetting)
+{
+    int ret = 0;
+    
+    TextScreen_AsyncWait();
+    if (!usersetting) {
+        TextScreen_GetSettingDefault(&gSetting);
+        TextScreen_CheckTranslate();
+        TextScreen_InvalidateScreen();
+        TextScreen_PrepareFrameBuffer();
+    } else {
+        TextScreen_SetSetting(usersetting);
+    }
+#ifdef _WIN32
+    ret = !SetConsoleCtrlHandler((PHANDLER_ROUTINE)TextScreen_SIGINT_handler, TRUE);
+#else
+#if _POSIX_C_SOURCE >= 200809L
+    {
+        struct sigaction new_sa;
+        
+        memset(&new_sa, 0, sizeof(new_sa));
+        new_sa.sa_handler = (void *)TextScreen_SIGINT_handler;
+        new_sa.sa_flags = SA_RESTART;  // SA_RESTART:restart, SA_RESETHAND:reset
+        if (sigaction(SIGINT, &new_sa, NULL))
+            return -1;
+    }
+#else
+    // (old-school)
+    if (signal(SIGINT, (void *)TextScreen_SIGINT_handler) == SIG_ERR)
+        return -1;
+#endif  /* end of (_POSIX_C_SOURCE >= 200809L) */
+    ret = TextScreen_SetNonBufferedTerm();
+    if (gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_AUTO) {
+        TextScreen_DetectCapability(1, SCREEN_DEFAULT_DETECT_TIMEOUT);
+        gSetting.renderingFlags |= TextScreen_GetCapabilityFlags();
+    }
+#endif
+    if (getenv("TEXTSCREEN_TRACE") && !gTraceRunning)
+        TextScreen_StartTrace(getenv("TEXTSCREEN_TRACE"));
+    if (getenv("TEXTSCREEN_BROADCAST") && !TextScreen_IsBroadcasting())
+        TextScreen_StartBroadcast(getenv("TEXTSCREEN_BROADCAST"));
+    return ret;
+}
+
+int TextScreen_End(void)
+{
+    int ret = 0;
+    
+    // write all output (last frame of render thread, unfinished frame) before terminal mode is restored
+    TextScreen_SetAsyncRendering(0);
+    TextScreen_FlushUserFrame();
+    TextScreen_StopRecording();
+    TextScreen_StopBroadcast();
+    // close unfinished frame
+    if (gFrameDepth > 0) {
+        gFrameDepth = 1;
+        gUserFrameDepth = 0;
+        TextScreen_OutEndFrame(1);
+    }
+    TextScreen_SetCursorVisible(1);
+#ifdef _WIN32
+#else
+    ret = TextScreen_RestoreTerm();
+#endif
+    TextScreen_PrintStats();
+    TextScreen_StopTrace();
+    return ret;
+}
+
+int TextScreen_ClearScreen(void)
+{
+#ifdef _WIN32
+    HANDLE stdh;
+    COORD  coord;
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    DWORD bufsize;
+    DWORD len;
+    
+    TextScreen_AsyncWait();
+    stdh = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (!stdh) return -1;
+    GetConsoleScreenBufferInfo(stdh, &info);
+    
+    // fill console buffer to space
+    bufsize = info.dwSize.X * info.dwSize.Y;
+    coord.X = 0;
+    coord.Y = 0;
+    FillConsoleOutputCharacter(stdh, ' ', bufsize, coord, &len);
+    
+    // set cursor position to (0,0)
+    coord.X = 0;
+    coord.Y = 0;
+    SetConsoleCursorPosition(stdh ,coord);
+#else
+    TextScreen_AsyncWait();
+    // P_RESET_STATE();
+    P_ERASE_ALL();
+    P_CURSOR_POS(0, 0);
+    TextScreen_OutFlush();
+#endif
+    TextScreen_InvalidateScreen();
+    TextScreen_DropSkippedFrame();
+    return 0;
+}
+
+int TextScreen_ResizeScreen(int width, int height)
+{
+    if ((width < 0) || (height < 0)) return -1;
+    
+    TextScreen_AsyncWait();
+    if (!width || !height) {
+        int w, h;
+        TextScreen_GetConsoleSize(&w, &h);
+        if (!width) {
+            width = w - (SCREEN_DEFAULT_LEFT_MARGIN * 2);
+            if (width < 1) return -1;
+        }
+        if (!height) {
+            height = h - (SCREEN_DEFAULT_TOP_MARGIN * 2);
+            if (height < 1) return -1;
+        }
+    }
+    gSetting.width  = width;
+    gSetting.height = height;
+    TextScreen_InvalidateScreen();
+    return TextScreen_PrepareFrameBuffer();
+}
+
+int TextScreen_GetConsoleSize(int *width, int *height)
+{
+    if (gSetting.backend && gSetting.backend->getSize)
+        return gSetting.backend->getSize(gSetting.backend->userdata, width, height);
+#ifdef _WIN32
+	HANDLE stdouth;
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    int ret;
+    
+    stdouth = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (!stdouth) {
+        *width  = 80;
+        *height = 25;
+        return -1;
+    }
+    ret = GetConsoleScreenBufferInfo(stdouth, &info);
+    if (ret) {
+        *width  = info.srWindow.Right-info.srWindow.Left + 1;
+        *height = info.srWindow.Bottom-info.srWindow.Top + 1;
+    } else {
+        *width  = 80;
+        *height = 25;
+        return -1;
+    }
+    return 0;
+#else
+    struct winsize ws;
+    if (ioctl(0, TIOCGWINSZ, &ws) != -1) {
+        *width  = ws.ws_col;
+        *height = ws.ws_row;
+    } else {
+        *width  = 80;
+        *height = 25;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+int TextScreen_SetCursorPos(int x, int y)
+{
+    int  width, height;
+    int  ret;
+    
+    ret = TextScreen_GetConsoleSize(&width, &height);
+    if (ret) return ret;
+    
+    if (x < 0) x = 0;
+    if (x >= width) x = width - 1;
+    if (y < 0) y = 0;
+    if (y >= height) y = height - 1;
+    
+    TextScreen_AsyncWait();
+#ifdef _WIN32
+    {
+        HANDLE stdouth;
+        COORD  coord;
+        
+        stdouth = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (!stdouth) return -1;
+        
+        coord.X = (SHORT)x;
+        coord.Y = (SHORT)y;
+        SetConsoleCursorPosition(stdouth, coord);
+    }
+#else
+    P_CURSOR_POS(x, y);
+    TextScreen_OutFlush();
+#endif
+    return 0;
+}
+
+int TextScreen_SetCursorVisible(int visible)
+{
+#ifdef _WIN32
+    HANDLE stdouth;
+    CONSOLE_CURSOR_INFO cursorinfo;  // DWORD dwSize, BOOL bVisible
+    
+    TextScreen_AsyncWait();
+    stdouth = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (!stdouth) return -1;
+    
+    GetConsoleCursorInfo(stdouth, &cursorinfo);
+    cursorinfo.bVisible = (visible != 0);
+    SetConsoleCursorInfo(stdouth, &cursorinfo);
+    return 0;
+#else
+    TextScreen_AsyncWait();
+    if (visible) {
+        P_CURSOR_SHOW();
+    } else {
+        P_CURSOR_HIDE();
+    }
+    TextScreen_OutFlush();
+    return 0;
+#endif
+}
+
+int TextScreen_BeginFrame(void)
+{
+    TextScreen_AsyncWait();
+    gUserFrameDepth++;
+    return TextScreen_OutBeginFrame();
+}
+
+int TextScreen_EndFrame(void)
+{
+    if (gUserFrameDepth <= 0) return -1;
+    gUserFrameDepth--;
+    if (gUserFrameDepth == 0)
+        TextScreen_FlushUserFrame();
+    return TextScreen_OutEndFrame(1);
+}
+
+void TextScreen_Wait(unsigned int ms)
+{
+    TextScreen_ShowSkippedFrame();
+    TextScreen_PollBroadcast();
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec t;
+    
+    t.tv_sec  = ms / 1000;
+    t.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&t, NULL);
+#endif
+}
+
+unsigned int TextScreen_GetTickCount(void)
+{
+#ifdef _WIN32
+    DWORD tick;
+    
+#if USE_WINMM == 1
+    tick = timeGetTime();
+#else
+    tick = GetTickCount();
+#endif
+    return tick;
+#else
+    struct timeval tv;
+    
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+#endif
+}
+
+void TextScreen_SetSpaceChar(char ch)
+{
+    gSetting.space = ch;
+}
+
+void TextScreen_SetRenderingMethod(int method)
+{
+    TextScreen_AsyncWait();
+    if ((method >= 0) && (method < TEXTSCREEN_RENDERING_METHOD_NB)) {
+        gSetting.renderingMethod = method;
+        TextScreen_InvalidateScreen();
+    }
+}
+
+void TextScreen_SetFrameBudget(int bytes)
+{
+    TextScreen_AsyncWait();
+    gFrameBudget = (bytes > 0) ? bytes : 0;
+}
+
+void TextScreen_SetRenderingFlags(int flags)
+{
+    TextScreen_AsyncWait();
+    if (flags & TEXTSCREEN_RENDERING_FLAG_AUTO)
+        flags |= TextScreen_GetCapabilityFlags();
+    gSetting.renderingFlags = flags;
+    TextScreen_InvalidateScreen();
+}
+
+void TextScreen_InvalidateScreen(void)
+{
+    TextScreen_AsyncWait();
+    gFrontValid = 0;
+}
+
+void TextScreen_GetSetting(TextScreenSetting *setting)
+{
+    *setting = gSetting;
+}
+
+int TextScreen_SetSetting(TextScreenSetting *setting)
+{
+    if (!setting) return -1;
+    
+    TextScreen_AsyncWait();
+    TextScreen_OutDrain(1);  // output may be changed to backend
+    gSetting = *setting;
+    if (gSetting.sar < 0.1)
+        gSetting.sar = 0.1;
+    if (gSetting.sar > 10.0)
+        gSetting.sar = 10.0;
+    TextScreen_CheckTranslate();
+    TextScreen_InvalidateScreen();
+    
+    return TextScreen_PrepareFrameBuffer();
+}
+
+void TextScreen_GetSettingDefault(TextScreenSetting *setting)
+{
+    int width, height;
+    
+    if (!setting) return;
+    TextScreen_GetConsoleSize(&width, &height);
+    
+    setting->space      = SCREEN_DEFAULT_SPACE_CHAR;
+    // setting->width      = SCREEN_DEFAULT_SIZE_X;
+    // setting->height     = SCREEN_DEFAULT_SIZE_Y;
+    setting->width      = width  - (SCREEN_DEFAULT_LEFT_MARGIN * 2);
+    setting->height     = height - (SCREEN_DEFAULT_TOP_MARGIN * 2);
+    setting->topMargin  = SCREEN_DEFAULT_TOP_MARGIN;
+    setting->leftMargin = SCREEN_DEFAULT_LEFT_MARGIN;
+    setting->sar        = SCREEN_DEFAULT_SAR;
+    setting->renderingMethod = SCREEN_DEFAULT_RENDERING_METHOD;
+    setting->sigintHandler = NULL;
+    setting->sigintHandlerUserData = NULL;
+    setting->translate  = (char *)gTranslateTable;
+    setting->renderingFlags = 0;
+    setting->backend    = NULL;
+}
+
+// #TODO: refactoring and improving code of TextScreen_GetKey()
+static int TextScreen_ReadKey(void) {
+#ifdef _WIN32
+    int key = 0;
+    int ch = 0;
+    
+    if (_kbhit()) {
+        int j;
+        unsigned char seq[8] = {0}
+        ;
+        ch = _getch();
+        seq[0] = (unsigned char)ch;
+        if (ch == 0xe0 || ch == 0x00) {
+            ch = _getch();
+            seq[1] = (unsigned char)ch;
+            j = 0;
+            while (gKeyScanWin[j].keycode) {
+                if (gKeyScanWin[j].num == 2) {
+                    if ((gKeyScanWin[j].seq[0] == seq[0]) && (gKeyScanWin[j].seq[1] == seq[1])) {
+                        key = gKeyScanWin[j].keycode;
+                        return key;
+                    }
+                }
+                j++;
+            }
+            key = TSK_POSKEY + ch;
+        } else {
+            j = 0;
+            while (gKeyScanWin[j].keycode) {
+                if (gKeyScanWin[j].num == 1) {
+                    if (gKeyScanWin[j].seq[0] == seq[0]) {
+                        key = gKeyScanWin[j].keycode;
+                        return key;
+                    }
+                }
+                j++;
+            }
+            key = seq[0];
+        }
+    }
+    return key;
+#else
+    int key = 0;
+    int ch = 0;
+    
+    int nkey;
+    int savefflag = 0;
+    int ret;
+    
+    // set non-blocking mode
+    savefflag = fcntl(STDIN_FILENO, F_GETFL);
+    ret = fcntl(STDIN_FILENO, F_SETFL, savefflag | O_NONBLOCK);
+    if (ret < 0) return 0;
+    
+    nkey = read(STDIN_FILENO, &ch, 1);
+    if (nkey == 1) {
+        key = ch;
+        if (ch == 0x0a) {
+            key = TSK_ENTER;
+        }
+        if (ch == 0x1b) {
+            int i, j;
+            unsigned char seq[8] = {0};
+            
+            seq[0] = ch;
+            for (i = 2; i < 7; i++) {
+                nkey = read(STDIN_FILENO, &ch, 1);
+                if (nkey != 1) {
+                    if (i == 2) {
+                        fcntl(STDIN_FILENO, F_SETFL, savefflag);
+                        return TSK_ESC;
+                    } else {
+                        fcntl(STDIN_FILENO, F_SETFL, savefflag);
+                        return 0;
+                    }
+                }
+                seq[i - 1] = ch;
+                j = 0;
+                while (gKeyEscSequence[j].keycode) {
+                    if (gKeyEscSequence[j].num == i) {
+                        if(!strcmp((char *)seq, (char *)gKeyEscSequence[j].seq)) {
+                            key = gKeyEscSequence[j].keycode;
+                            while (read(STDIN_FILENO, &ch, 1) == 1);
+                            fcntl(STDIN_FILENO, F_SETFL, savefflag);
+                            return key;
+                        }
+                    }
+                    j++;
+                }
+            }
+            while (read(STDIN_FILENO, &ch, 1) == 1);
+            key = 0;
+        }
+    } else {
+        key = 0;
+    }
+    // restore file mode
+    fcntl(STDIN_FILENO, F_SETFL, savefflag);
+    return key;
+#endif
+}
+
+int TextScreen_GetKey(void)
+{
+    unsigned long long trace = TextScreen_TraceBegin();
+    int key;
+    
+    TextScreen_ShowSkippedFrame();
+    TextScreen_PollBroadcast();
+    key = TextScreen_ReadKey();
+    TextScreen_TraceEnd("GetKey", trace, key);
+    return key;
+}
+
+
+/********************************
+ Terminal Capability
+ ********************************/
+
+// detected capabilities (all 0: not detected yet)
+static TextScreenCapability gCapability;
+
+// features of known terminals by prefix of TERM (used only when terminal did not answer)
+struct TermFeature {
+    const char *term;
+    int  repeat;
+    int  scrollMargins;
+    int  insertDelete;
+};
+static const struct TermFeature gTermFeature[] = {
+    {"xterm",     1, 1, 1},  // xterm and compatible (VTE, kitty, Konsole, iTerm2, ...)
+    {"alacritty", 1, 1, 1},
+    {"foot",      1, 1, 1},
+    {"wezterm",   1, 1, 1},
+    {"tmux",      1, 1, 1},
+    {"screen",    0, 1, 1},
+    {"rxvt",      0, 1, 1},
+    {"vt220",     0, 1, 1},
+    {"vt102",     0, 0, 1},
+    {"linux",     0, 0, 1},
+    {NULL,        0, 0, 0}
+};
+
+// set features of cap by answers of terminal (deviceClass, deviceType)
+static void TextScreen_DeriveCapability(TextScreenCapability *cap)
+{
+    // ICH/DCH: VT102 or later  SU/SD: VT220 or later  REP: xterm (DA2 type 41), others are known by TERM
+    cap->insertDelete  = (cap->deviceClass >= 6);
+    cap->scrollMargins = (cap->deviceClass >= 62);
+    cap->repeat        = (cap->deviceType == 41);
+}
+
+// add features of cap guessed by TERM and COLORTERM
+static void TextScreen_GuessCapability(TextScreenCapability *cap)
+{
+    const char *term = getenv("TERM");
+    const char *colorterm = getenv("COLORTERM");
+    int i;
+    
+    // features by TERM: only when terminal did not answer (TERM is xterm* for most terminals)
+    if (term && !cap->detected) {
+        for (i = 0; gTermFeature[i].term; i++) {
+            if (!strncmp(term, gTermFeature[i].term, strlen(gTermFeature[i].term))) {
+                cap->repeat        |= gTermFeature[i].repeat;
+                cap->scrollMargins |= gTermFeature[i].scrollMargins;
+                cap->insertDelete  |= gTermFeature[i].insertDelete;
+                break;
+            }
+        }
+    }
+    // true color is not answered by queries
+    if (term) {
+        if (strstr(term, "-direct"))  // eg. xterm-direct
+            cap->trueColor = 1;
+    }
+    if (colorterm && (!strcmp(colorterm, "truecolor") || !strcmp(colorterm, "24bit")))
+        cap->trueColor = 1;
+}
+
+// parse answers of queries (buf, len bytes) to cap
+// return 1: answer of DA1 (last query) is found
+static int TextScreen_ParseCapabilityAnswer(TextScreenCapability *cap, const char *buf, int len)
+{
+    int  i, n, found = 0;
+    int  param[3];
+    char prefix;
+    
+    i = 0;
+    while (i + 2 < len) {
+        if ((buf[i] != 0x1b) || (buf[i + 1] != '[')) {
+            i++;
+            continue;
+        }
+        i += 2;
+        prefix = 0;
+        if ((buf[i] == '?') || (buf[i] == '>'))
+            prefix = buf[i++];
+        n = 0;
+        param[0] = param[1] = param[2] = 0;
+        while ((i < len) && (((buf[i] >= '0') && (buf[i] <= '9')) || (buf[i] == ';'))) {
+            if (buf[i] == ';') {
+                if (n < 2) n++;
+            } else if (param[n] < 100000) {
+                param[n] = param[n] * 10 + (buf[i] - '0');
+            }
+            i++;
+        }
+        if (i >= len) break;
+        if ((prefix == '?') && (buf[i] == 'c')) {
+            // DA1: CSI ? class ; features c
+            cap->deviceClass = param[0];
+            found = 1;
+        } else if ((prefix == '>') && (buf[i] == 'c')) {
+            // DA2: CSI > type ; version ; rom c
+            cap->deviceType    = param[0];
+            cap->deviceVersion = param[1];
+        } else if ((prefix == '?') && (buf[i] == '$') && (i + 1 < len) && (buf[i + 1] == 'y')) {
+            // DECRQM: CSI ? mode ; value $ y  (value 1:set 2:reset 3:permanently set 0,4:not supported)
+            int supported = (param[1] >= 1) && (param[1] <= 3);
+            
+            if (param[0] == 2026)
+                cap->syncOutput = supported;
+            if ((param[0] == 1000) && supported && !cap->mouse)
+                cap->mouse = 1;
+            if ((param[0] == 1006) && supported)
+                cap->mouse = 2;
+            i++;
+        }
+    }
+    return found;
+}
+
+#ifdef _WIN32
+#else
+// query terminal, and wait for answers (timeout msec),  return 0:successful  -1:no answer
+// Note: keys typed while waiting for answers are dropped
+static int TextScreen_QueryCapability(TextScreenCapability *cap, int timeout)
+{
+    // DA1 is the last: all terminals answer it, so answers of other queries are arrived before it
+    static const char query[] = "\x1b[?2026$p\x1b[?1000$p\x1b[?1006$p\x1b[>c\x1b[c";
+    struct termios saved, term;
+    struct pollfd  pfd;
+    char  buf[256];
+    int   len, n, found, savedterm;
+    int   elapsed, timeout0 = timeout;
+    unsigned int start;
+    
+    // don't echo answers (before TextScreen_Init())
+    savedterm = !tcgetattr(STDIN_FILENO, &saved);
+    if (savedterm) {
+        term = saved;
+        term.c_lflag &= ~(ECHO | ICANON);
+        term.c_cc[VMIN]  = 1;
+        term.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &term);
+    }
+    len   = 0;
+    found = 0;
+    TextScreen_OutPut(query, sizeof(query) - 1);
+    if (TextScreen_OutWrite(1, 0) == 0) {
+        start = TextScreen_GetTickCount();
+        while (!found && (len < (int)sizeof(buf))) {
+            elapsed = (int)(TextScreen_GetTickCount() - start);
+            if ((elapsed >= timeout) && (len > 0) && (timeout == timeout0))
+                timeout += timeout0;  // answers are arriving: wait for the rest once more (slow connection)
+            if (elapsed >= timeout) break;
+            pfd.fd     = STDIN_FILENO;
+            pfd.events = POLLIN;
+            n = poll(&pfd, 1, timeout - elapsed);
+            if (!n || ((n < 0) && (errno == EINTR))) continue;  // (timeout is checked)
+            if (n < 0) break;
+            n = read(STDIN_FILENO, buf + len, sizeof(buf) - len);
+            if (n <= 0) break;
+            len += n;
+            found = TextScreen_ParseCapabilityAnswer(cap, buf, len);
+        }
+    }
+    // drop answers arriving late (not to be read as keys)
+    tcflush(STDIN_FILENO, TCIFLUSH);
+    if (savedterm)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    return found ? 0 : -1;
+}
+
+// append name (unsafe characters for file name are changed to '_') to path,  return length of path
+static int TextScreen_AppendFileName(char *path, int len, int size, const char *name)
+{
+    for (; *name && (len < size - 1); name++) {
+        char ch = *name;
+        
+        if (!(((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) || ((ch >= '0') && (ch <= '9')) ||
+              (ch == '-') || (ch == '.') || (ch == '+')))
+            ch = '_';
+        path[len++] = ch;
+    }
+    path[len] = '\0';
+    return len;
+}
+
+// path of cache file: $XDG_CACHE_HOME/textscreen/TERM[.TERM_PROGRAM] (or ~/.cache/textscreen/)
+// TERM_PROGRAM is added because terminals share TERM (eg. xterm-256color)
+// makedir=1: make directories,  return 0:successful  -1:error
+static int TextScreen_CapabilityCachePath(char *path, int size, int makedir)
+{
+    const char *term    = getenv("TERM");
+    const char *program = getenv("TERM_PROGRAM");
+    const char *cache   = getenv("XDG_CACHE_HOME");
+    const char *home    = getenv("HOME");
+    int len;
+    
+    if (!term || !*term) return -1;
+    if (cache && *cache) {
+        if (makedir)
+            mkdir(cache, 0700);
+        len = snprintf(path, size, "%s/textscreen", cache);
+    } else if (home && *home) {
+        len = snprintf(path, size, "%s/.cache", home);
+        if (makedir && (len < size))
+            mkdir(path, 0700);
+        len = snprintf(path, size, "%s/.cache/textscreen", home);
+    } else {
+        return -1;
+    }
+    if (len >= size - 2) return -1;
+    if (makedir)
+        mkdir(path, 0700);
+    path[len++] = '/';
+    len = TextScreen_AppendFileName(path, len, size, term);
+    if (program && *program && (len < size - 1)) {
+        path[len++] = '.';
+        TextScreen_AppendFileName(path, len, size, program);
+    }
+    return 0;
+}
+
+// cache file: "TEXTSCREEN_CAPABILITY 1 class type version sync mouse" (class 0: terminal did not answer)
+static int TextScreen_LoadCapability(TextScreenCapability *cap)
+{
+    char  path[1024];
+    FILE *fp;
+    int   version, ret;
+    
+    if (TextScreen_CapabilityCachePath(path, sizeof(path), 0)) return -1;
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    ret = fscanf(fp, "TEXTSCREEN_CAPABILITY %d %d %d %d %d %d", &version, &cap->deviceClass, 
+                 &cap->deviceType, &cap->deviceVersion, &cap->syncOutput, &cap->mouse);
+    fclose(fp);
+    return ((ret == 6) && (version == 1)) ? 0 : -1;
+}
+
+static int TextScreen_SaveCapability(const TextScreenCapability *cap)
+{
+    char  path[1024];
+    FILE *fp;
+    int   ret;
+    
+    if (TextScreen_CapabilityCachePath(path, sizeof(path), 1)) return -1;
+    fp = fopen(path, "w");
+    if (!fp) return -1;
+    ret = fprintf(fp, "TEXTSCREEN_CAPABILITY 1 %d %d %d %d %d\n", cap->deviceClass, 
+                  cap->deviceType, cap->deviceVersion, cap->syncOutput, cap->mouse);
+    if (fclose(fp)) ret = -1;
+    return (ret > 0) ? 0 : -1;
+}
+#endif
+
+int TextScreen_DetectCapability(int useCache, int timeout)
+{
+    TextScreenCapability cap;
+    int ret = -1;
+    int queried = 0;
+    
+    TextScreen_AsyncWait();
+    memset(&cap, 0, sizeof(cap));
+    cap.deviceType    = -1;
+    cap.deviceVersion = -1;
+#ifdef _WIN32
+    // Windows: escape sequences are not used
+    gCapability = cap;
+    return ret;
+#else
+    if (useCache && !TextScreen_LoadCapability(&cap)) {
+        ret = cap.deviceClass ? 0 : -1;
+    } else if (!gSetting.backend && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) {
+        ret = TextScreen_QueryCapability(&cap, timeout);
+        queried = 1;
+    }
+    if (ret) {
+        memset(&cap, 0, sizeof(cap));
+        cap.deviceType    = -1;
+        cap.deviceVersion = -1;
+    }
+    // no answer is cached too (don't wait for timeout at every start)
+    if (queried && useCache)
+        TextScreen_SaveCapability(&cap);
+    cap.detected = !ret;
+    TextScreen_DeriveCapability(&cap);
+    TextScreen_GuessCapability(&cap);
+    gCapability = cap;
+    return ret;
+#endif
+}
+
+void TextScreen_GetCapability(TextScreenCapability *cap)
+{
+    if (cap)
+        *cap = gCapability;
+}
+
+int TextScreen_GetCapabilityFlags(void)
+{
+    int flags = 0;
+    
+    if (gCapability.repeat)
+        flags |= TEXTSCREEN_RENDERING_FLAG_REPEAT;
+    if (gCapability.scrollMargins)
+        flags |= TEXTSCREEN_RENDERING_FLAG_SCROLL;
+    if (gCapability.insertDelete)
+        flags |= TEXTSCREEN_RENDERING_FLAG_PAN;
+    if (gCapability.syncOutput)
+        flags |= TEXTSCREEN_RENDERING_FLAG_SYNC;
+    return flags;
+}
+
+
+/********************************
+ Unicode
+ ********************************/
+
+// East Asian Width W and F (unassigned code points are merged into neighbor range)
+static const unsigned int gWideTable[][2] = {
+    {0x01100, 0x0115f}, {0x0231a, 0x0231b}, {0x02329, 0x0232a}, {0x023e9, 0x023ec}, {0x023f0, 0x023f0},
+    {0x023f3, 0x023f3}, {0x025fd, 0x025fe}, {0x02614, 0x02615}, {0x02648, 0x02653}, {0x0267f, 0x0267f},
+    {0x02693, 0x02693}, {0x026a1, 0x026a1}, {0x026aa, 0x026ab}, {0x026bd, 0x026be}, {0x026c4, 0x026c5},
+    {0x026ce, 0x026ce}, {0x026d4, 0x026d4}, {0x026ea, 0x026ea}, {0x026f2, 0x026f3}, {0x026f5, 0x026f5},
+    {0x026fa, 0x026fa}, {0x026fd, 0x026fd}, {0x02705, 0x02705}, {0x0270a, 0x0270b}, {0x02728, 0x02728},
+    {0x0274c, 0x0274c}, {0x0274e, 0x0274e}, {0x02753, 0x02755}, {0x02757, 0x02757}, {0x02795, 0x02797},
+    {0x027b0, 0x027b0}, {0x027bf, 0x027bf}, {0x02b1b, 0x02b1c}, {0x02b50, 0x02b50}, {0x02b55, 0x02b55},
+    {0x02e80, 0x03029}, {0x0302e, 0x0303e}, {0x03041, 0x03096}, {0x0309b, 0x03247}, {0x03250, 0x04dbf},
+    {0x04e00, 0x0a4c6}, {0x0a960, 0x0a97c}, {0x0ac00, 0x0d7a3}, {0x0f900, 0x0fad9}, {0x0fe10, 0x0fe19},
+    {0x0fe30, 0x0fe6b}, {0x0ff01, 0x0ff60}, {0x0ffe0, 0x0ffe6}, {0x16fe0, 0x16fe3}, {0x16ff0, 0x1b2fb},
+    {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f320},
+    {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c}, {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3},
+    {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4}, {0x1f3f8, 0x1f43e}, {0x1f440, 0x1f440}, {0x1f442, 0x1f4fc},
+    {0x1f4ff, 0x1f53d}, {0x1f54b, 0x1f54e}, {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a}, {0x1f595, 0x1f596},
+    {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f}, {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2},
+    {0x1f6d5, 0x1f6df}, {0x1f6eb, 0x1f6ec}, {0x1f6f4, 0x1f6fc}, {0x1f7e0, 0x1f7f0}, {0x1f90c, 0x1f93a},
+    {0x1f93c, 0x1f945}, {0x1f947, 0x1f9ff}, {0x1fa70, 0x1faf6}, {0x20000, 0x3fffd},
+};
+
+// nonspacing, enclosing mark and format character (zero width, Unicode 14.0.0)
+static const unsigned int gZeroWidthTable[][2] = {
+    {0x00300, 0x0036f}, {0x00483, 0x00489}, {0x00591, 0x005bd}, {0x005bf, 0x005bf}, {0x005c1, 0x005c2},
+    {0x005c4, 0x005c5}, {0x005c7, 0x005c7}, {0x00600, 0x00605}, {0x00610, 0x0061a}, {0x0061c, 0x0061c},
+    {0x0064b, 0x0065f}, {0x00670, 0x00670}, {0x006d6, 0x006dd}, {0x006df, 0x006e4}, {0x006e7, 0x006e8},
+    {0x006ea, 0x006ed}, {0x0070f, 0x0070f}, {0x00711, 0x00711}, {0x00730, 0x0074a}, {0x007a6, 0x007b0},
+    {0x007eb, 0x007f3}, {0x007fd, 0x007fd}, {0x00816, 0x00819}, {0x0081b, 0x00823}, {0x00825, 0x00827},
+    {0x00829, 0x0082d}, {0x00859, 0x0085b}, {0x00890, 0x0089f}, {0x008ca, 0x00902}, {0x0093a, 0x0093a},
+    {0x0093c, 0x0093c}, {0x00941, 0x00948}, {0x0094d, 0x0094d}, {0x00951, 0x00957}, {0x00962, 0x00963},
+    {0x00981, 0x00981}, {0x009bc, 0x009bc}, {0x009c1, 0x009c4}, {0x009cd, 0x009cd}, {0x009e2, 0x009e3},
+    {0x009fe, 0x00a02}, {0x00a3c, 0x00a3c}, {0x00a41, 0x00a51}, {0x00a70, 0x00a71}, {0x00a75, 0x00a75},
+    {0x00a81, 0x00a82}, {0x00abc, 0x00abc}, {0x00ac1, 0x00ac8}, {0x00acd, 0x00acd}, {0x00ae2, 0x00ae3},
+    {0x00afa, 0x00b01}, {0x00b3c, 0x00b3c}, {0x00b3f, 0x00b3f}, {0x00b41, 0x00b44}, {0x00b4d, 0x00b56},
+    {0x00b62, 0x00b63}, {0x00b82, 0x00b82}, {0x00bc0, 0x00bc0}, {0x00bcd, 0x00bcd}, {0x00c00, 0x00c00},
+    {0x00c04, 0x00c04}, {0x00c3c, 0x00c3c}, {0x00c3e, 0x00c40}, {0x00c46, 0x00c56}, {0x00c62, 0x00c63},
+    {0x00c81, 0x00c81}, {0x00cbc, 0x00cbc}, {0x00cbf, 0x00cbf}, {0x00cc6, 0x00cc6}, {0x00ccc, 0x00ccd},
+    {0x00ce2, 0x00ce3}, {0x00d00, 0x00d01}, {0x00d3b, 0x00d3c}, {0x00d41, 0x00d44}, {0x00d4d, 0x00d4d},
+    {0x00d62, 0x00d63}, {0x00d81, 0x00d81}, {0x00dca, 0x00dca}, {0x00dd2, 0x00dd6}, {0x00e31, 0x00e31},
+    {0x00e34, 0x00e3a}, {0x00e47, 0x00e4e}, {0x00eb1, 0x00eb1}, {0x00eb4, 0x00ebc}, {0x00ec8, 0x00ecd},
+    {0x00f18, 0x00f19}, {0x00f35, 0x00f35}, {0x00f37, 0x00f37}, {0x00f39, 0x00f39}, {0x00f71, 0x00f7e},
+    {0x00f80, 0x00f84}, {0x00f86, 0x00f87}, {0x00f8d, 0x00fbc}, {0x00fc6, 0x00fc6}, {0x0102d, 0x01030},
+    {0x01032, 0x01037}, {0x01039, 0x0103a}, {0x0103d, 0x0103e}, {0x01058, 0x01059}, {0x0105e, 0x01060},
+    {0x01071, 0x01074}, {0x01082, 0x01082}, {0x01085, 0x01086}, {0x0108d, 0x0108d}, {0x0109d, 0x0109d},
+    {0x01160, 0x011ff}, {0x0135d, 0x0135f}, {0x01712, 0x01714}, {0x01732, 0x01733}, {0x01752, 0x01753},
+    {0x01772, 0x01773}, {0x017b4, 0x017b5}, {0x017b7, 0x017bd}, {0x017c6, 0x017c6}, {0x017c9, 0x017d3},
+    {0x017dd, 0x017dd}, {0x0180b, 0x0180f}, {0x01885, 0x01886}, {0x018a9, 0x018a9}, {0x01920, 0x01922},
+    {0x01927, 0x01928}, {0x01932, 0x01932}, {0x01939, 0x0193b}, {0x01a17, 0x01a18}, {0x01a1b, 0x01a1b},
+    {0x01a56, 0x01a56}, {0x01a58, 0x01a60}, {0x01a62, 0x01a62}, {0x01a65, 0x01a6c}, {0x01a73, 0x01a7f},
+    {0x01ab0, 0x01b03}, {0x01b34, 0x01b34}, {0x01b36, 0x01b3a}, {0x01b3c, 0x01b3c}, {0x01b42, 0x01b42},
+    {0x01b6b, 0x01b73}, {0x01b80, 0x01b81}, {0x01ba2, 0x01ba5}, {0x01ba8, 0x01ba9}, {0x01bab, 0x01bad},
+    {0x01be6, 0x01be6}, {0x01be8, 0x01be9}, {0x01bed, 0x01bed}, {0x01bef, 0x01bf1}, {0x01c2c, 0x01c33},
+    {0x01c36, 0x01c37}, {0x01cd0, 0x01cd2}, {0x01cd4, 0x01ce0}, {0x01ce2, 0x01ce8}, {0x01ced, 0x01ced},
+    {0x01cf4, 0x01cf4}, {0x01cf8, 0x01cf9}, {0x01dc0, 0x01dff}, {0x0200b, 0x0200f}, {0x0202a, 0x0202e},
+    {0x02060, 0x0206f}, {0x020d0, 0x020f0}, {0x02cef, 0x02cf1}, {0x02d7f, 0x02d7f}, {0x02de0, 0x02dff},
+    {0x0302a, 0x0302d}, {0x03099, 0x0309a}, {0x0a66f, 0x0a672}, {0x0a674, 0x0a67d}, {0x0a69e, 0x0a69f},
+    {0x0a6f0, 0x0a6f1}, {0x0a802, 0x0a802}, {0x0a806, 0x0a806}, {0x0a80b, 0x0a80b}, {0x0a825, 0x0a826},
+    {0x0a82c, 0x0a82c}, {0x0a8c4, 0x0a8c5}, {0x0a8e0, 0x0a8f1}, {0x0a8ff, 0x0a8ff}, {0x0a926, 0x0a92d},
+    {0x0a947, 0x0a951}, {0x0a980, 0x0a982}, {0x0a9b3, 0x0a9b3}, {0x0a9b6, 0x0a9b9}, {0x0a9bc, 0x0a9bd},
+    {0x0a9e5, 0x0a9e5}, {0x0aa29, 0x0aa2e}, {0x0aa31, 0x0aa32}, {0x0aa35, 0x0aa36}, {0x0aa43, 0x0aa43},
+    {0x0aa4c, 0x0aa4c}, {0x0aa7c, 0x0aa7c}, {0x0aab0, 0x0aab0}, {0x0aab2, 0x0aab4}, {0x0aab7, 0x0aab8},
+    {0x0aabe, 0x0aabf}, {0x0aac1, 0x0aac1}, {0x0aaec, 0x0aaed}, {0x0aaf6, 0x0aaf6}, {0x0abe5, 0x0abe5},
+    {0x0abe8, 0x0abe8}, {0x0abed, 0x0abed}, {0x0fb1e, 0x0fb1e}, {0x0fe00, 0x0fe0f}, {0x0fe20, 0x0fe2f},
+    {0x0feff, 0x0feff}, {0x0fff9, 0x0fffb}, {0x101fd, 0x101fd}, {0x102e0, 0x102e0}, {0x10376, 0x1037a},
+    {0x10a01, 0x10a0f}, {0x10a38, 0x10a3f}, {0x10ae5, 0x10ae6}, {0x10d24, 0x10d27}, {0x10eab, 0x10eac},
+    {0x10f46, 0x10f50}, {0x10f82, 0x10f85}, {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070},
+    {0x11073, 0x11074}, {0x1107f, 0x11081}, {0x110b3, 0x110b6}, {0x110b9, 0x110ba}, {0x110bd, 0x110bd},
+    {0x110c2, 0x110cd}, {0x11100, 0x11102}, {0x11127, 0x1112b}, {0x1112d, 0x11134}, {0x11173, 0x11173},
+    {0x11180, 0x11181}, {0x111b6, 0x111be}, {0x111c9, 0x111cc}, {0x111cf, 0x111cf}, {0x1122f, 0x11231},
+    {0x11234, 0x11234}, {0x11236, 0x11237}, {0x1123e, 0x1123e}, {0x112df, 0x112df}, {0x112e3, 0x112ea},
+    {0x11300, 0x11301}, {0x1133b, 0x1133c}, {0x11340, 0x11340}, {0x11366, 0x11374}, {0x11438, 0x1143f},
+    {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145e, 0x1145e}, {0x114b3, 0x114b8}, {0x114ba, 0x114ba},
+    {0x114bf, 0x114c0}, {0x114c2, 0x114c3}, {0x115b2, 0x115b5}, {0x115bc, 0x115bd}, {0x115bf, 0x115c0},
+    {0x115dc, 0x115dd}, {0x11633, 0x1163a}, {0x1163d, 0x1163d}, {0x1163f, 0x11640}, {0x116ab, 0x116ab},
+    {0x116ad, 0x116ad}, {0x116b0, 0x116b5}, {0x116b7, 0x116b7}, {0x1171d, 0x1171f}, {0x11722, 0x11725},
+    {0x11727, 0x1172b}, {0x1182f, 0x11837}, {0x11839, 0x1183a}, {0x1193b, 0x1193c}, {0x1193e, 0x1193e},
+    {0x11943, 0x11943}, {0x119d4, 0x119db}, {0x119e0, 0x119e0}, {0x11a01, 0x11a0a}, {0x11a33, 0x11a38},
+    {0x11a3b, 0x11a3e}, {0x11a47, 0x11a47}, {0x11a51, 0x11a56}, {0x11a59, 0x11a5b}, {0x11a8a, 0x11a96},
+    {0x11a98, 0x11a99}, {0x11c30, 0x11c3d}, {0x11c3f, 0x11c3f}, {0x11c92, 0x11ca7}, {0x11caa, 0x11cb0},
+    {0x11cb2, 0x11cb3}, {0x11cb5, 0x11cb6}, {0x11d31, 0x11d45}, {0x11d47, 0x11d47}, {0x11d90, 0x11d91},
+    {0x11d95, 0x11d95}, {0x11d97, 0x11d97}, {0x11ef3, 0x11ef4}, {0x13430, 0x13438}, {0x16af0, 0x16af4},
+    {0x16b30, 0x16b36}, {0x16f4f, 0x16f4f}, {0x16f8f, 0x16f92}, {0x16fe4, 0x16fe4}, {0x1bc9d, 0x1bc9e},
+    {0x1bca0, 0x1cf46}, {0x1d167, 0x1d169}, {0x1d173, 0x1d182}, {0x1d185, 0x1d18b}, {0x1d1aa, 0x1d1ad},
+    {0x1d242, 0x1d244}, {0x1da00, 0x1da36}, {0x1da3b, 0x1da6c}, {0x1da75, 0x1da75}, {0x1da84, 0x1da84},
+    {0x1da9b, 0x1daaf}, {0x1e000, 0x1e02a}, {0x1e130, 0x1e136}, {0x1e2ae, 0x1e2ae}, {0x1e2ec, 0x1e2ef},
+    {0x1e8d0, 0x1e8d6}, {0x1e944, 0x1e94a}, {0xe0001, 0xe01ef},
+};
+
+// search code in range table,  return 1:found
+static int TextScreen_SearchRange(const unsigned int (*table)[2], int num, unsigned int code)
+{
+    int lo = 0, hi = num - 1, mid;
+    
+    if ((code < table[0][0]) || (code > table[num - 1][1])) return 0;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (code < table[mid][0]) {
+            hi = mid - 1;
+        } else if (code > table[mid][1]) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int TextScreen_GetCodeWidth(unsigned int code)
+{
+    if ((code < 0x20) || ((code >= 0x7f) && (code < 0xa0))) return 0;
+    if (code < 0x300) return 1;
+    if (((code >= 0xd800) && (code < 0xe000)) || (code > 0x10ffff)) return 0;
+    if (TextScreen_SearchRange(gZeroWidthTable, sizeof(gZeroWidthTable) / sizeof(gZeroWidthTable[0]), code)) 
+        return 0;
+    if (TextScreen_SearchRange(gWideTable, sizeof(gWideTable) / sizeof(gWideTable[0]), code)) 
+        return 2;
+    return 1;
+}
+
+// UTF-8 sequence and width of code point (cached),  width 0: not printable (len = 0)
+static const struct CodeCache *TextScreen_LookupCode(unsigned int code)
+{
+    struct CodeCache *cache = &gCodeCache[code & (TEXTSCREEN_CODE_CACHE_SIZE - 1)];
+    
+    if (cache->code == code) return cache;
+    cache->code  = code;
+    cache->width = (unsigned char)TextScreen_GetCodeWidth(code);
+    if (!cache->width) {
+        cache->len = 0;
+    } else if (code < 0x80) {
+        cache->len = 1;
+        cache->utf8[0] = (char)code;
+    } else if (code < 0x800) {
+        cache->len = 2;
+        cache->utf8[0] = (char)(0xc0 | (code >> 6));
+        cache->utf8[1] = (char)(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        cache->len = 3;
+        cache->utf8[0] = (char)(0xe0 | (code >> 12));
+        cache->utf8[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+        cache->utf8[2] = (char)(0x80 | (code & 0x3f));
+    } else {
+        cache->len = 4;
+        cache->utf8[0] = (char)(0xf0 | (code >> 18));
+        cache->utf8[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+        cache->utf8[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+        cache->utf8[3] = (char)(0x80 | (code & 0x3f));
+    }
+    return cache;
+}
+
+// decode one character of UTF-8 string *str (*str is moved to next character),  return code point (0xfffd: invalid)
+static unsigned int TextScreen_DecodeUtf8(const char **str)
+{
+    const unsigned char *p = (const unsigned char *)*str;
+    unsigned int code;
+    int  n, i;
+    
+    if (p[0] < 0x80) {
+        *str += 1;
+        return p[0];
+    }
+    if ((p[0] & 0xe0) == 0xc0) {
+        n = 1;
+        code = p[0] & 0x1f;
+    } else if ((p[0] & 0xf0) == 0xe0) {
+        n = 2;
+        code = p[0] & 0x0f;
+    } else if ((p[0] & 0xf8) == 0xf0) {
+        n = 3;
+        code = p[0] & 0x07;
+    } else {
+        *str += 1;
+        return 0xfffd;
+    }
+    for (i = 1; i <= n; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            *str += i;
+            return 0xfffd;
+        }
+        code = (code << 6) | (p[i] & 0x3f);
+    }
+    *str += n + 1;
+    return code;
+}
+
+
+/********************************
+ Bitmap Draw Tools
+ ********************************/
+
+void TextScreen_DrawFillCircle(TextScreenBitmap *bitmap, int x, int y, int r, char ch)
+{
+    int xd, yd, last_yd, last_xd;
+    double m;
+    
+    if (!bitmap) return;
+    if (r < 0)   return;
+    
+    xd = 0;
+    yd = r;
+    while(xd <= r * gSetting.sar) {
+        last_yd = yd;
+        m = (double)(r * r) - (double)(xd * xd) / (gSetting.sar * gSetting.sar);
+        yd = (int)(sqrt(fabs(m)) + 0.5);
+        if (last_yd - yd > 1) break;
+        TextScreen_DrawLine(bitmap, x + xd, y + yd, x + xd, y - yd, ch);
+        TextScreen_DrawLine(bitmap, x - xd, y + yd, x - xd, y - yd, ch);
+        xd += 1;
+    }
+    xd = r;
+    yd = 0;
+    while(yd <= r) {
+        last_xd = xd;
+        m = (double)(r * r) - (double)(yd * yd);
+        xd = (int)(sqrt(m) * gSetting.sar + 0.5);
+        if (last_xd - xd > 1) break;
+        TextScreen_DrawLine(bitmap, x + xd, y + yd, x - xd, y + yd, ch);
+        TextScreen_DrawLine(bitmap, x + xd, y - yd, x - xd, y - yd, ch);
+        yd += 1;
+    }
+}
+
+void TextScreen_DrawCircle(TextScreenBitmap *bitmap, int x, int y, int r, char ch, int mode)
+{
+    int xd, yd, last_xd, last_yd;
+    double m;
+    
+    if (!bitmap) return;
+    if (r < 0)   return;
+    
+    if (mode == 1) {
+        TextScreen_DrawFillCircle(bitmap, x, y, r, ch);
+        return;
+    }
+    if (mode == 2)
+        TextScreen_DrawFillCircle(bitmap, x, y, r, gSetting.space);
+    
+    xd = 0;
+    yd = r;
+    while(xd <= r * gSetting.sar) {
+        last_yd = yd;
+        m = (double)(r * r) - (double)(xd * xd) / (gSetting.sar * gSetting.sar);
+        yd = (int)(sqrt(fabs(m)) + 0.5);
+        if (last_yd - yd > 1) break;
         TextScreen_PutCell(bitmap, x + xd, y + yd, ch);
         TextScreen_PutCell(bitmap, x + xd, y - yd, ch);
         TextScreen_PutCell(bitmap, x - xd, y + yd, ch);
         TextScreen_PutCell(bitmap, x - xd, y - yd, ch);
         xd++;
     }
-    xd = r;
-    yd = 0;
-    while(yd <= r) {
-        last_xd = xd;
-        m = (double)(r * r) - (double)(yd * yd);
-        xd = (int)(sqrt(m) * gSetting.sar + 0.5);
-        if (last_xd - xd > 1) break;
-        TextScreen_PutCell(bitmap, x + xd, y + yd, ch);
-        TextScreen_PutCell(bitmap, x + xd, y - yd, ch);
-        TextScreen_PutCell(bitmap, x - xd, y + yd, ch);
-        TextScreen_PutCell(bitmap, x - xd, y - yd, ch);
-        yd++;
+    xd = r;
+    yd = 0;
+    while(yd <= r) {
+        last_xd = xd;
+        m = (double)(r * r) - (double)(yd * yd);
+        xd = (int)(sqrt(m) * gSetting.sar + 0.5);
+        if (last_xd - xd > 1) break;
+        TextScreen_PutCell(bitmap, x + xd, y + yd, ch);
+        TextScreen_PutCell(bitmap, x + xd, y - yd, ch);
+        TextScreen_PutCell(bitmap, x - xd, y + yd, ch);
+        TextScreen_PutCell(bitmap, x - xd, y - yd, ch);
+        yd++;
+    }
+}
+
+void TextScreen_DrawFillRect(TextScreenBitmap *bitmap, int x, int y, int w, int h, char ch)
+{
+    int xmin, xmax, ymin, ymax;
+    int xc, yc;
+    
+    if (!bitmap) return;
+    xmin = x;
+    xmax = x + w;
+    ymin = y;
+    ymax = y + h;
+    
+    if (xmin < 0) xmin = 0;
+    if (xmax > bitmap->width) xmax = bitmap->width;
+    if (ymin < 0) ymin = 0;
+    if (ymax > bitmap->height) ymax = bitmap->height;
+    
+    for (yc = ymin; yc < ymax; yc++) {
+        for (xc = xmin; xc < xmax; xc++) {
+            TextScreen_PutCell(bitmap, xc, yc, ch);
+        }
+    }
+}
+
+void TextScreen_DrawRect(TextScreenBitmap *bitmap, int x, int y, int w, int h, char ch, int mode)
+{
+    int xc, yc;
+    
+    if (!bitmap) return;
+    if (mode == 1) {
+        TextScreen_DrawFillRect(bitmap, x, y, w, h, ch);
+        return;
+    }
+    if (mode == 2) {
+        TextScreen_DrawFillRect(bitmap, x+1, y+1, w-2, h-2, gSetting.space); 
+    }
+    
+    for (xc = x; xc < x + w; xc++) {
+        TextScreen_PutCell(bitmap, xc, y        , ch);
+        TextScreen_PutCell(bitmap, xc, y + h - 1, ch);
+    }
+    for (yc = y; yc < y + h; yc++) {
+        TextScreen_PutCell(bitmap, x        , yc, ch);
+        TextScreen_PutCell(bitmap, x + w - 1, yc, ch);
+    }
+}
+
+void TextScreen_DrawFillRectP(TextScreenBitmap *bitmap, int x, int y, int x1, int y1, char ch)
+{
+    TextScreen_DrawRectP(bitmap, x, y, x1, y1, ch, 1);
+}
+
+void TextScreen_DrawRectP(TextScreenBitmap *bitmap, int x, int y, int x1, int y1, char ch, int mode)
+{
+    int xs, ys, w, h;
+    
+    if (x <= x1) {
+        xs = x;
+        w  = x1 - x + 1;
+    } else {
+        xs = x1;
+        w  = x - x1 + 1;
+    }
+    if (y <= y1) {
+        ys = y;
+        h  = y1 - y + 1;
+    } else {
+        ys = y1;
+        h  = y - y1 + 1;
+    }
+    TextScreen_DrawRect(bitmap, xs, ys, w, h, ch, mode);
+}
+
+void TextScreen_DrawLine(TextScreenBitmap *bitmap, int x1, int y1, int x2, int y2, char ch)
+{
+    int xd, yd;
+    int xda, yda;
+    int xn, yn;
+    int x, y;
+    
+    xd = x2 - x1;
+    yd = y2 - y1;
+    xda = (xd >= 0) ? xd : -xd;
+    yda = (yd >= 0) ? yd : -yd;
+    
+    if (!bitmap) return;
+    if (!xd) {
+        if (yd >= 0) {
+            for (y = y1; y <= y2; y++)
+                TextScreen_PutCell(bitmap, x1, y, ch);
+        } else {
+            for (y = y1; y >= y2; y--)
+                TextScreen_PutCell(bitmap, x1, y, ch);
+        }
+        return;
+    }
+    if (!yd) {
+        if (xd >= 0) {
+            for (x = x1; x <= x2; x++)
+                TextScreen_PutCell(bitmap, x, y1, ch);
+        } else {
+            for (x = x1; x >= x2; x--)
+                TextScreen_PutCell(bitmap, x, y1, ch);
+        }
+        return;
+    }
+    
+    if (xda >= yda) {
+       if ((xd >= 0) && (yd >= 0)) {
+           for (x = x1; x <= x2; x++) {
+               yn = y1 + ((yda*(x-x1)*256)/(xda) +128)/256;
+               TextScreen_PutCell(bitmap, x, yn, ch);
+           }
+       }
+       if ((xd >= 0) && (yd < 0)) {
+           for (x = x1; x <= x2; x++) {
+               yn = y1 - ((yda*(x-x1)*256)/(xda) +128)/256;
+               TextScreen_PutCell(bitmap, x, yn, ch);
+           }
+       }
+       if ((xd < 0) && (yd >= 0)) {
+           for (x = x1; x >= x2; x--) {
+               yn = y1 + ((yda*(x1-x)*256)/(xda) +128)/256;
+               TextScreen_PutCell(bitmap, x, yn, ch);
+           }
+       }
+       if ((xd < 0) && (yd < 0)) {
+           for (x = x1; x >= x2; x--) {
+               yn = y1 - ((yda*(x1-x)*256)/(xda) +128)/256;
+               TextScreen_PutCell(bitmap, x, yn, ch);
+           }
+       }
+    } else {
+       if ((xd >= 0) && (yd >= 0)) {
+           for (y = y1; y <= y2; y++) {
+               xn = x1 + ((xda*(y-y1)*256)/(yda) +128)/256;
+               TextScreen_PutCell(bitmap, xn, y, ch);
+           }
+       }
+       if ((xd < 0) && (yd >= 0)) {
+           for (y = y1; y <= y2; y++) {
+               xn = x1 - ((xda*(y-y1)*256)/(yda) +128)/256;
+               TextScreen_PutCell(bitmap, xn, y, ch);
+           }
+       }
+       if ((xd >= 0) && (yd < 0)) {
+           for (y = y1; y >= y2; y--) {
+               xn = x1 + ((xda*(y1-y)*256)/(yda) +128)/256;
+               TextScreen_PutCell(bitmap, xn, y, ch);
+           }
+       }
+       if ((xd < 0) && (yd < 0)) {
+           for (y = y1; y >= y2; y--) {
+               xn = x1 - ((xda*(y1-y)*256)/(yda) +128)/256;
+               TextScreen_PutCell(bitmap, xn, y, ch);
+           }
+       }
+    }
+}
+
+void TextScreen_DrawText(TextScreenBitmap *bitmap, int x, int y, const char *str)
+{
+    if ((!bitmap) || (!str)) return;
+    while (*str != '\0') {
+        TextScreen_PutCell(bitmap, x, y, *str);
+        x++;
+        str++;
+    }
+}
+
+char TextScreen_GetCell(TextScreenBitmap *bitmap, int x, int y)
+{
+    if (!bitmap) return 0;
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+        return *(bitmap->data + y * bitmap->width + x);
+    else
+        return 0;
+}
+
+void TextScreen_PutCell(TextScreenBitmap *bitmap, int x, int y, char ch)
+{
+    if (!bitmap) return;
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+        *(bitmap->data + y * bitmap->width + x) = ch;
+}
+
+void TextScreen_ClearCell(TextScreenBitmap *bitmap, int x, int y)
+{
+    if (!bitmap) return;
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+        *(bitmap->data + y * bitmap->width + x) = gSetting.space;
+}
+
+unsigned short TextScreen_GetAttr(TextScreenBitmap *bitmap, int x, int y)
+{
+    if (!bitmap || !bitmap->attr) return 0;
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+        return *(bitmap->attr + y * bitmap->width + x);
+    else
+        return 0;
+}
+
+void TextScreen_PutAttr(TextScreenBitmap *bitmap, int x, int y, unsigned short attr)
+{
+    if (!bitmap || !bitmap->attr) return;
+    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
+        *(bitmap->attr + y * bitmap->width + x) = attr;
+}
+
+void TextScreen_FillAttr(TextScreenBitmap *bitmap, int x, int y, int w, int h, unsigned short attr)
+{
+    int xc, yc;
+    
+    if (!bitmap || !bitmap->attr) return;
+    for (yc = y; yc < y + h; yc++) {
+        for (xc = x; xc < x + w; xc++) {
+            TextScreen_PutAttr(bitmap, xc, yc, attr);
+        }
+    }
+}
+
+unsigned int TextScreen_GetCode(TextScreenBitmap *bitmap, int x, int y)
+{
+    char ch;
+    
+    ch = TextScreen_GetCell(bitmap, x, y);
+    if ((ch != TEXTSCREEN_CHAR_CODE) || !bitmap->code) return (unsigned char)ch;
+    return *(bitmap->code + y * bitmap->width + x);
+}
+
+int TextScreen_PutCode(TextScreenBitmap *bitmap, int x, int y, unsigned int code)
+{
+    int width, i;
+    
+    if (!bitmap) return 0;
+    width = TextScreen_GetCodeWidth(code);
+    if (!width) return 0;
+    if (code < 0x80) {
+        TextScreen_PutCell(bitmap, x, y, (char)code);
+        return 1;
+    }
+    for (i = 0; i < width; i++) {
+        if ((x + i < 0) || (x + i >= bitmap->width) || (y < 0) || (y >= bitmap->height)) continue;
+        if (bitmap->code) {
+            *(bitmap->data + y * bitmap->width + x + i) = TEXTSCREEN_CHAR_CODE;
+            *(bitmap->code + y * bitmap->width + x + i) = i ? 0 : code;
+        } else {
+            *(bitmap->data + y * bitmap->width + x + i) = '?';
+        }
+    }
+    return width;
+}
+
+int TextScreen_DrawTextUtf8(TextScreenBitmap *bitmap, int x, int y, const char *str)
+{
+    int xs = x;
+    
+    if ((!bitmap) || (!str)) return 0;
+    while (*str != '\0') {
+        x += TextScreen_PutCode(bitmap, x, y, TextScreen_DecodeUtf8(&str));
+    }
+    return x - xs;
+}
+
+// copy code point of srcmap(sx,sy) to dstmap(dx,dy) with cell (for code point plane of dstmap)
+static void TextScreen_CopyCodeCell(TextScreenBitmap *dstmap, int dx, int dy, TextScreenBitmap *srcmap, int sx, int sy)
+{
+    unsigned int code = 0;
+    
+    if (!dstmap->code || (dx < 0) || (dx >= dstmap->width) || (dy < 0) || (dy >= dstmap->height)) return;
+    if (srcmap->code && (sx >= 0) && (sx < srcmap->width) && (sy >= 0) && (sy < srcmap->height))
+        code = *(srcmap->code + sy * srcmap->width + sx);
+    *(dstmap->code + dy * dstmap->width + dx) = code;
+}
+
+void TextScreen_CopyRect(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, 
+                         int dstx, int dsty, 
+                         int srcx, int srcy, int srcw, int srch, 
+                         int transparent)
+{
+    int  x, y;
+    char ch;
+    TextScreenBitmap *src, *dst, *tmp = NULL;
+    unsigned long long trace;
+    
+    if (!srcmap || !dstmap) return;
+    
+    trace = TextScreen_TraceBegin();
+    src = srcmap;
+    dst = dstmap;
+    if (src == dst) {  // duplicate bitmap when source = destinate
+        tmp = TextScreen_DupBitmap(src);
+        src = tmp;
+    }
+    for (y = 0; y < srch; y++) {
+        for (x = 0; x < srcw; x++) {
+            ch = TextScreen_GetCell(src, srcx + x, srcy + y);
+            if (ch != gSetting.space || !transparent) {
+                TextScreen_PutCell(dst, dstx + x, dsty + y, ch);
+                TextScreen_PutAttr(dst, dstx + x, dsty + y, TextScreen_GetAttr(src, srcx + x, srcy + y));
+                TextScreen_CopyCodeCell(dst, dstx + x, dsty + y, src, srcx + x, srcy + y);
+            }
+        }
+    }
+    if (tmp)
+        TextScreen_FreeBitmap(tmp);
+    TextScreen_TraceEnd("CopyRect", trace, 0);
+}
+
+/********************************
+ Bitmap Tools
+ ********************************/
+
+TextScreenBitmap *TextScreen_CreateBitmap(int width, int height)
+{
+    TextScreenBitmap *bitmap;
+    char *data;
+    
+    if ((width < 0) || (width > TEXTSCREEN_MAXSIZE) || (height < 0) || (height > TEXTSCREEN_MAXSIZE)) {
+        return NULL;
+    }
+    if (width == 0)
+        width = gSetting.width;
+    if (height == 0)
+        height = gSetting.height;
+    
+    bitmap = (TextScreenBitmap *)malloc(sizeof(TextScreenBitmap));
+    data   = (char *)malloc(width * height);
+    if (!bitmap || !data) {
+        if (bitmap) free(bitmap);
+        if (data)   free(data);
+        return NULL;
+    }
+    
+    bitmap->width  = width;
+    bitmap->height = height;
+    bitmap->exdata = NULL;
+    bitmap->data   = data;
+    bitmap->attr   = NULL;
+    bitmap->code   = NULL;
+    TextScreen_ClearBitmap(bitmap);
+    
+    return bitmap;
+}
+
+void TextScreen_FreeBitmap(TextScreenBitmap *bitmap)
+{
+    if (TextScreen_IsSharedBitmap(bitmap)) {
+        TextScreen_FreeSharedBitmap(bitmap);
+        return;
+    }
+    if (bitmap) {
+        if (bitmap->data)
+            free(bitmap->data);
+        if (bitmap->attr)
+            free(bitmap->attr);
+        if (bitmap->code)
+            free(bitmap->code);
+        free(bitmap);
+    }
+}
+
+void TextScreen_CopyBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy)
+{
+    int x, y;
+    unsigned long long trace;
+    
+    if (!srcmap || !dstmap) return;
+    
+    trace = TextScreen_TraceBegin();
+    for (y = 0; y < srcmap->height; y++) {
+        for (x = 0; x < srcmap->width; x++) {
+            TextScreen_PutCell(dstmap, x + dx, y + dy, TextScreen_GetCell(srcmap, x, y));
+        }
+    }
+    if (dstmap->attr) {
+        for (y = 0; y < srcmap->height; y++) {
+            for (x = 0; x < srcmap->width; x++) {
+                TextScreen_PutAttr(dstmap, x + dx, y + dy, TextScreen_GetAttr(srcmap, x, y));
+            }
+        }
+    }
+    if (dstmap->code) {
+        for (y = 0; y < srcmap->height; y++) {
+            for (x = 0; x < srcmap->width; x++) {
+                TextScreen_CopyCodeCell(dstmap, x + dx, y + dy, srcmap, x, y);
+            }
+        }
+    }
+    TextScreen_TraceEnd("CopyBitmap", trace, 0);
+}
+
+TextScreenBitmap *TextScreen_DupBitmap(TextScreenBitmap *bitmap)
+{
+    TextScreenBitmap *newmap;
+    
+    if (!bitmap) return NULL;
+    
+    newmap = TextScreen_CreateBitmap(bitmap->width, bitmap->height);
+    if (newmap) {
+        if ((bitmap->attr && TextScreen_CreateAttrPlane(newmap)) || 
+            (bitmap->code && TextScreen_CreateCodePlane(newmap))) {
+            TextScreen_FreeBitmap(newmap);
+            return NULL;
+        }
+        TextScreen_CopyBitmap(newmap, bitmap, 0, 0);
+    }
+    return newmap;
+}
+
+void TextScreen_OverlayBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy)
+{
+    char ch;
+    int x, y;
+    unsigned long long trace;
+    
+    if (!srcmap || !dstmap) return;
+    
+    trace = TextScreen_TraceBegin();
+    for (y = 0; y < srcmap->height; y++) {
+        for (x = 0; x < srcmap->width; x++) {
+            ch = TextScreen_GetCell(srcmap, x, y);
+            if (ch != gSetting.space) {
+                TextScreen_PutCell(dstmap, x + dx, y + dy, ch);
+                TextScreen_PutAttr(dstmap, x + dx, y + dy, TextScreen_GetAttr(srcmap, x, y));
+                TextScreen_CopyCodeCell(dstmap, x + dx, y + dy, srcmap, x, y);
+            }
+        }
+    }
+    TextScreen_TraceEnd("OverlayBitmap", trace, 0);
+}
+
+int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int height)
+{
+    char *data, *olddata;
+    unsigned short *attr, *oldattr;
+    unsigned int *code, *oldcode;
+    int  oldwidth, oldheight;
+    int  xc, yc;
+    char ch;
+    
+    if (!bitmap || TextScreen_IsSharedBitmap(bitmap)) return -1;
+    if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
+        return -1;
+    }
+    data   = (char *)malloc(width * height);
+    if (!data) return -1;
+    attr   = NULL;
+    if (bitmap->attr) {
+        attr = (unsigned short *)calloc(width * height, sizeof(unsigned short));
+        if (!attr) {
+            free(data);
+            return -1;
+        }
+    }
+    code   = NULL;
+    if (bitmap->code) {
+        code = (unsigned int *)calloc(width * height, sizeof(unsigned int));
+        if (!code) {
+            free(data);
+            if (attr) free(attr);
+            return -1;
+        }
+    }
+    
+    oldwidth  = bitmap->width;
+    oldheight = bitmap->height;
+    olddata   = bitmap->data;
+    oldattr   = bitmap->attr;
+    oldcode   = bitmap->code;
+    
+    bitmap->width  = width;
+    bitmap->height = height;
+    bitmap->data   = data;
+    bitmap->attr   = attr;
+    bitmap->code   = code;
+    
+    TextScreen_ClearBitmap(bitmap);
+    
+    for (yc = 0; yc < height; yc++) {
+        for (xc = 0; xc < width; xc++) {
+            if (((xc + x) >= 0) && ((yc + y) >= 0) && ((xc + x) < oldwidth) && ((yc + y) < oldheight)) {
+                ch = *(olddata + ((yc + y) * oldwidth + (xc + x)));
+                *(data + (yc * width + xc)) = ch;
+                if (attr)
+                    *(attr + (yc * width + xc)) = *(oldattr + ((yc + y) * oldwidth + (xc + x)));
+                if (code)
+                    *(code + (yc * width + xc)) = *(oldcode + ((yc + y) * oldwidth + (xc + x)));
+            }
+        }
+    }
+    
+    free(olddata);
+    if (oldattr)
+        free(oldattr);
+    if (oldcode)
+        free(oldcode);
+    
+    return 0;
+}
+
+int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height)
+{
+    char *data, *olddata;
+    unsigned short *attr, *oldattr;
+    unsigned int *code, *oldcode;
+    int  oldwidth, oldheight;
+    int  xc, yc;
+    char ch;
+    unsigned long long trace;
+    
+    if (!bitmap || TextScreen_IsSharedBitmap(bitmap)) return -1;
+    if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
+        return -1;
+    }
+    trace  = TextScreen_TraceBegin();
+    data   = (char *)malloc(width * height);
+    if (!data) return -1;
+    attr   = NULL;
+    if (bitmap->attr) {
+        attr = (unsigned short *)calloc(width * height, sizeof(unsigned short));
+        if (!attr) {
+            free(data);
+            return -1;
+        }
+    }
+    code   = NULL;
+    if (bitmap->code) {
+        code = (unsigned int *)calloc(width * height, sizeof(unsigned int));
+        if (!code) {
+            free(data);
+            if (attr) free(attr);
+            return -1;
+        }
+    }
+    
+    oldwidth  = bitmap->width;
+    oldheight = bitmap->height;
+    olddata   = bitmap->data;
+    oldattr   = bitmap->attr;
+    oldcode   = bitmap->code;
+    
+    bitmap->width  = width;
+    bitmap->height = height;
+    bitmap->data   = data;
+    bitmap->attr   = attr;
+    bitmap->code   = code;
+    
+    TextScreen_ClearBitmap(bitmap);
+    // scaling with nearest neighbor
+    for (yc = 0; yc < height; yc++) {
+        for (xc = 0; xc < width; xc++) {
+            ch = *(olddata + ((oldheight * yc / height) * oldwidth) + (oldwidth * xc / width));
+            *(data + (yc * width + xc)) = ch;
+            if (attr)
+                *(attr + (yc * width + xc)) = *(oldattr + ((oldheight * yc / height) * oldwidth) + (oldwidth * xc / width));
+            if (code)
+                *(code + (yc * width + xc)) = *(oldcode + ((oldheight * yc / height) * oldwidth) + (oldwidth * xc / width));
+        }
+    }
+    
+    free(olddata);
+    if (oldattr)
+        free(oldattr);
+    if (oldcode)
+        free(oldcode);
+    
+    TextScreen_TraceEnd("ResizeBitmap", trace, 0);
+    return 0;
+}
+
+int TextScreen_CompareBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy)
+{
+    int  x, y;
+    char chsrc, chdst;
+    
+    if (!srcmap || !dstmap) return -1;
+    
+    for (y = 0; y < srcmap->height; y++) {
+        for (x = 0; x < srcmap->width; x++) {
+            chsrc = TextScreen_GetCell(srcmap, x, y);
+            chdst = TextScreen_GetCell(dstmap, x + dx, y + dy);
+            if (chsrc > chdst) return 1;
+            if (chsrc < chdst) return -1;
+        }
+    }
+    return 0;
+}
+
+void TextScreen_ClearBitmap(TextScreenBitmap *bitmap)
+{
+    if (!bitmap) return;
+    TextScreen_DrawFillRect(bitmap, 0, 0, bitmap->width, bitmap->height, gSetting.space);
+    if (bitmap->attr)
+        memset(bitmap->attr, 0, sizeof(unsigned short) * bitmap->width * bitmap->height);
+}
+
+int TextScreen_CreateAttrPlane(TextScreenBitmap *bitmap)
+{
+    if (!bitmap) return -1;
+    if (bitmap->attr) return 0;
+    if (TextScreen_IsSharedBitmap(bitmap)) return -1;
+    bitmap->attr = (unsigned short *)calloc(bitmap->width * bitmap->height + 1, sizeof(unsigned short));
+    return bitmap->attr ? 0 : -1;
+}
+
+void TextScreen_FreeAttrPlane(TextScreenBitmap *bitmap)
+{
+    if (!bitmap || !bitmap->attr || TextScreen_IsSharedBitmap(bitmap)) return;
+    free(bitmap->attr);
+    bitmap->attr = NULL;
+}
+
+int TextScreen_CreateCodePlane(TextScreenBitmap *bitmap)
+{
+    if (!bitmap) return -1;
+    if (bitmap->code) return 0;
+    if (TextScreen_IsSharedBitmap(bitmap)) return -1;
+    bitmap->code = (unsigned int *)calloc(bitmap->width * bitmap->height + 1, sizeof(unsigned int));
+    return bitmap->code ? 0 : -1;
+}
+
+void TextScreen_FreeCodePlane(TextScreenBitmap *bitmap)
+{
+    if (!bitmap || !bitmap->code || TextScreen_IsSharedBitmap(bitmap)) return;
+    free(bitmap->code);
+    bitmap->code = NULL;
+}
+
+// prepare front and back screen buffer for TEXTSCREEN_RENDERING_METHOD_DIFF,  return 0:successful  -1:error
+static int TextScreen_PrepareScreenBuffer(void)
+{
+    int size;
+    
+    if (gFrontBuf && gBackBuf && (gFrontWidth == gSetting.width) && (gFrontHeight == gSetting.height))
+        return 0;
+    
+    if (gFrontBuf)  free(gFrontBuf);
+    if (gBackBuf)   free(gBackBuf);
+    if (gFrontHash) free(gFrontHash);
+    if (gBackHash)  free(gBackHash);
+    if (gFrontAttr) free(gFrontAttr);
+    if (gBackAttr)  free(gBackAttr);
+    if (gFrontCode) free(gFrontCode);
+    if (gBackCode)  free(gBackCode);
+    size = gSetting.width * gSetting.height;
+    gFrontBuf    = (char *)malloc(size);
+    gBackBuf     = (char *)malloc(size);
+    gFrontHash   = (unsigned int *)malloc(sizeof(unsigned int) * gSetting.height);
+    gBackHash    = (unsigned int *)malloc(sizeof(unsigned int) * gSetting.height);
+    gFrontAttr   = (unsigned short *)malloc(sizeof(unsigned short) * size);
+    gBackAttr    = (unsigned short *)malloc(sizeof(unsigned short) * size);
+    gFrontCode   = (unsigned int *)malloc(sizeof(unsigned int) * size);
+    gBackCode    = (unsigned int *)malloc(sizeof(unsigned int) * size);
+    gFrontWidth  = gSetting.width;
+    gFrontHeight = gSetting.height;
+    gFrontValid  = 0;
+    if (!gFrontBuf || !gBackBuf || !gFrontHash || !gBackHash || !gFrontAttr || !gBackAttr || 
+        !gFrontCode || !gBackCode) {
+        if (gFrontBuf)  free(gFrontBuf);
+        if (gBackBuf)   free(gBackBuf);
+        if (gFrontHash) free(gFrontHash);
+        if (gBackHash)  free(gBackHash);
+        if (gFrontAttr) free(gFrontAttr);
+        if (gBackAttr)  free(gBackAttr);
+        if (gFrontCode) free(gFrontCode);
+        if (gBackCode)  free(gBackCode);
+        gFrontBuf    = NULL;
+        gBackBuf     = NULL;
+        gFrontHash   = NULL;
+        gBackHash    = NULL;
+        gFrontAttr   = NULL;
+        gBackAttr    = NULL;
+        gFrontCode   = NULL;
+        gBackCode    = NULL;
+        gFrontWidth  = 0;
+        gFrontHeight = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// hash of row (FNV-1a)
+static unsigned int TextScreen_RowHash(const char *row, int len)
+{
+    unsigned int hash = 2166136261u;
+    int i;
+    
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)row[i]) * 16777619u;
+    }
+    return hash;
+}
+
+#ifdef _WIN32
+#else
+// number of rows which become same as back buffer (minus rows which become different)
+// when front buffer is scrolled up n rows (n < 0: scroll down)
+static int TextScreen_ScrollGain(int n, unsigned int blankhash)
+{
+    int gain = 0;
+    int y, height;
+    unsigned int moved;
+    
+    height = gSetting.height;
+    for (y = 0; y < height; y++) {
+        moved = ((y + n >= 0) && (y + n < height)) ? gFrontHash[y + n] : blankhash;
+        if (moved == gFrontHash[y]) continue;
+        if (gBackHash[y] == moved) gain++;
+        if (gBackHash[y] == gFrontHash[y]) gain--;
+    }
+    return gain;
+}
+
+// TEXTSCREEN_RENDERING_FLAG_SCROLL
+// find scroll of screen (compare row hash of front and back buffer), then scroll console and front buffer
+// return length of escape sequence in buf (0: not scrolled)
+static int TextScreen_MakeScrollSequence(char *buf)
+{
+    unsigned int blankhash;
+    int  candidate[8];
+    int  ncandidate, nchanged;
+    int  gain, bestgain, best;
+    int  i, n, y, j;
+    int  width, height, index;
+    
+    width  = gSetting.width;
+    height = gSetting.height;
+    
+    // blank row (console fills scrolled-in rows with space)
+    blankhash = 2166136261u;
+    for (i = 0; i < width; i++) {
+        blankhash = (blankhash ^ (unsigned char)' ') * 16777619u;
+    }
+    
+    // collect scroll amount candidates from first some changed rows
+    ncandidate = 0;
+    nchanged   = 0;
+    for (y = 0; (y < height) && (nchanged < 4); y++) {
+        if ((gBackHash[y] == gFrontHash[y]) || (gBackHash[y] == blankhash)) continue;
+        nchanged++;
+        for (j = 0; (j < height) && (ncandidate < (int)(sizeof(candidate) / sizeof(candidate[0]))); j++) {
+            if ((j != y) && (gFrontHash[j] == gBackHash[y])) {
+                n = j - y;
+                for (i = 0; i < ncandidate; i++) {
+                    if (candidate[i] == n) break;
+                }
+                if (i == ncandidate)
+                    candidate[ncandidate++] = n;
+            }
+        }
+    }
+    
+    best = 0;
+    bestgain = 0;
+    for (i = 0; i < ncandidate; i++) {
+        gain = TextScreen_ScrollGain(candidate[i], blankhash);
+        if (gain > bestgain) {
+            bestgain = gain;
+            best = candidate[i];
+        }
+    }
+    // scroll sequence costs about 20 bytes: same as redraw of short row
+    if (!best || (bestgain * width <= P_SCROLL_MAXLEN)) return 0;
+    
+    // scroll console: set scroll region, scroll up(SU)/down(SD), reset scroll region
+    index = 0;
+    buf[index++] = 0x1b;
+    buf[index++] = '[';
+    index += TextScreen_PutNumber(buf + index, gSetting.topMargin + 1);
+    buf[index++] = ';';
+    index += TextScreen_PutNumber(buf + index, gSetting.topMargin + height);
+    buf[index++] = 'r';
+    index += TextScreen_PutCsiSeq(buf + index, (best > 0) ? best : -best, (best > 0) ? 'S' : 'T');
+    buf[index++] = 0x1b;
+    buf[index++] = '[';
+    buf[index++] = 'r';
+    
+    // scroll front buffer same as console
+    n = (best > 0) ? best : -best;
+    if (best > 0) {
+        memmove(gFrontBuf, gFrontBuf + n * width, (height - n) * width);
+        memmove(gFrontHash, gFrontHash + n, (height - n) * sizeof(unsigned int));
+        memmove(gFrontAttr, gFrontAttr + n * width, (height - n) * width * sizeof(unsigned short));
+        memmove(gFrontCode, gFrontCode + n * width, (height - n) * width * sizeof(unsigned int));
+        memset(gFrontBuf + (height - n) * width, ' ', n * width);
+        memset(gFrontAttr + (height - n) * width, 0, n * width * sizeof(unsigned short));
+        memset(gFrontCode + (height - n) * width, 0, n * width * sizeof(unsigned int));
+        for (y = height - n; y < height; y++)
+            gFrontHash[y] = blankhash;
+    } else {
+        memmove(gFrontBuf + n * width, gFrontBuf, (height - n) * width);
+        memmove(gFrontHash + n, gFrontHash, (height - n) * sizeof(unsigned int));
+        memmove(gFrontAttr + n * width, gFrontAttr, (height - n) * width * sizeof(unsigned short));
+        memmove(gFrontCode + n * width, gFrontCode, (height - n) * width * sizeof(unsigned int));
+        memset(gFrontBuf, ' ', n * width);
+        memset(gFrontAttr, 0, n * width * sizeof(unsigned short));
+        memset(gFrontCode, 0, n * width * sizeof(unsigned int));
+        for (y = 0; y < n; y++)
+            gFrontHash[y] = blankhash;
+    }
+    return index;
+}
+#endif
+
+#ifdef _WIN32
+#else
+// TEXTSCREEN_RENDERING_FLAG_PAN
+// find horizontal move amount k of row (back[x] = front[x + k]),  return k (0: not found)
+static int TextScreen_FindPan(const char *front, const char *back, int width)
+{
+    int k, x, xs, xe, maxk;
+    int match, best, bestmatch;
+    
+    maxk = width / 2;
+    if (maxk > P_PAN_MAX)
+        maxk = P_PAN_MAX;
+    best = 0;
+    bestmatch = 0;
+    for (k = -maxk; k <= maxk; k++) {
+        if (!k) continue;
+        xs = (k < 0) ? -k : 0;
+        xe = (k < 0) ? width : width - k;
+        match = 0;
+        for (x = xs; x < xe; x++) {
+            if (back[x] == front[x + k]) match++;
+        }
+        if (match > bestmatch) {
+            bestmatch = match;
+            best = k;
+        }
+    }
+    // most of row must be matched
+    k = (best < 0) ? -best : best;
+    if (bestmatch * 4 < (width - k) * 3) return 0;
+    return best;
+}
+
+// TEXTSCREEN_RENDERING_FLAG_PAN
+// move row y of console and front buffer horizontally when it is cheaper than rewrite
+// candidate: move amount k (back[x] = front[x + k])
+// return length of escape sequence in buf (0: not moved)
+static int TextScreen_MakePanSequence(char *buf, int y, const int *candidate, int ncandidate)
+{
+    char seq[P_CURSOR_POS_MAXLEN * 2 + 16];
+    char *front, *back;
+    unsigned short *fattr;
+    int  width, left, top;
+    int  before, after, best, bestafter;
+    int  i, k, n, x, xs, xe;
+    int  index;
+    
+    width = gSetting.width;
+    left  = gSetting.leftMargin;
+    top   = gSetting.topMargin;
+    front = gFrontBuf + y * width;
+    back  = gBackBuf  + y * width;
+    
+    // number of different characters (= bytes to rewrite) without and with move
+    before = 0;
+    for (x = 0; x < width; x++) {
+        if (front[x] != back[x]) before++;
+    }
+    best = 0;
+    bestafter = before;
+    for (i = 0; i < ncandidate; i++) {
+        k = candidate[i];
+        n = (k < 0) ? -k : k;
+        if (n >= width) continue;
+        xs = (k < 0) ? n : 0;
+        xe = (k < 0) ? width : width - n;
+        after = n;
+        for (x = xs; x < xe; x++) {
+            if (back[x] != front[x + k]) after++;
+        }
+        if (after < bestafter) {
+            bestafter = after;
+            best = k;
+        }
+    }
+    if (!best) return 0;
+    
+    // delete(DCH) or insert(ICH) characters at left of screen
+    n = (best < 0) ? -best : best;
+    index = TextScreen_PutCursorPosSeq(seq, left, top + y);
+    index += TextScreen_PutCsiSeq(seq + index, n, (best > 0) ? 'P' : '@');
+    if ((best < 0) && (gConsoleWidth > left + width)) {
+        // erase characters pushed out to right of screen
+        index += TextScreen_PutCursorPosSeq(seq + index, left + width, top + y);
+        index += TextScreen_PutCsiSeq(seq + index, 
+                    (n < gConsoleWidth - left - width) ? n : gConsoleWidth - left - width, 'X');
+    }
+    if (before - bestafter <= index) return 0;
+    memcpy(buf, seq, index);
+    
+    // move front buffer same as console
+    fattr = gFrontAttr + y * width;
+    if (best > 0) {
+        memmove(front, front + n, width - n);
+        memmove(fattr, fattr + n, (width - n) * sizeof(unsigned short));
+        for (x = width - n; x < width; x++) {  // unknown characters from right of screen
+            front[x] = (char)(back[x] ^ 1);
+            fattr[x] = 0;
+        }
+    } else {
+        memmove(front + n, front, width - n);
+        memmove(fattr + n, fattr, (width - n) * sizeof(unsigned short));
+        memset(front, ' ', n);
+        memset(fattr, 0, n * sizeof(unsigned short));
+    }
+    return index;
+}
+#endif
+
+#ifdef _WIN32
+// write string to console position (x, y) with Windows console api
+static void TextScreen_WriteConsoleAt(HANDLE stdh, int x, int y, const char *str, int len)
+{
+    COORD  coord;
+    DWORD  wlen;
+    
+    coord.X = (SHORT)x;
+    coord.Y = (SHORT)y;
+    SetConsoleCursorPosition(stdh, coord);
+    WriteConsole(stdh, str, len, &wlen, NULL);
+}
+#endif
+
+// TEXTSCREEN_RENDERING_METHOD_DIFF
+// make back buffer from bitmap, then output changed characters (compare with front buffer)
+// Windows: write to console directly  Non Windows: make escape sequence to buf
+// return length of buf
+static int TextScreen_MakeDiffSequence(TextScreenBitmap *bitmap, int dx, int dy, char *buf)
+{
+    char *front, *back;
+    unsigned short *fattr, *battr;
+    unsigned int *fcode, *bcode;
+    int  index, rowindex, rowlimit;
+    int  redraw;
+    int  x, y, xs;
+    int  width, height, left, top;
+    int  budget, i;
+    int  useattr, usecode;
+    long changed, rowchanged;  // changed cells (statistics)
+#ifdef _WIN32
+    HANDLE stdh;
+    
+    stdh = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (!stdh) return 0;
+    useattr = 0;
+    usecode = 0;
+#else
+    int  repeat;
+    int  pan[4], npan;
+    int  sgr, rowsgr;
+    int  cx, cy, rowcx, rowcy, n, k;  // console cursor position (cx < 0: unknown)
+    
+    repeat = gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_REPEAT;
+    // attribute is compared while front buffer may have attribute
+    if (!gFrontValid)
+        gFrontAttrUsed = 0;
+    useattr = (bitmap->attr || gFrontAttrUsed);
+    if (useattr)
+        gFrontAttrUsed = 1;
+    // same as code point
+    if (!gFrontValid)
+        gFrontCodeUsed = 0;
+    usecode = (bitmap->code || gFrontCodeUsed);
+    if (usecode)
+        gFrontCodeUsed = 1;
+    sgr = 0;  // console attribute is default between frames
+    cx  = -1;
+    cy  = -1;
+#endif
+    
+    width  = gSetting.width;
+    height = gSetting.height;
+    left   = gSetting.leftMargin;
+    top    = gSetting.topMargin;
+    
+    // make next screen
+    for (y = 0; y < height; y++) {
+        TextScreen_ClipRow(gBackBuf + y * width, width, bitmap, dx, y + dy, gSetting.translate);
+        if (useattr)
+            TextScreen_ClipAttrRow(gBackAttr + y * width, width, bitmap, dx, y + dy);
+        if (usecode && TextScreen_ClipCodeRow(gBackCode + y * width, width, bitmap, dx, y + dy, 0)) {
+            TextScreen_FixCodeRow(gBackBuf + y * width, useattr ? gBackAttr + y * width : NULL, 
+                                  gBackCode + y * width, width);
+        }
+    }
+    
+    index = 0;
+#ifdef _WIN32
+#else
+    if (useattr && !gFrontValid) {
+        // console attribute is unknown
+        index += TextScreen_PutSgrSeq(buf + index, -1, 0);
+    }
+    if (gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_SCROLL) {
+        for (y = 0; y < height; y++) {
+            gBackHash[y] = TextScreen_RowHash(gBackBuf + y * width, width);
+        }
+        if (gFrontValid)
+            index += TextScreen_MakeScrollSequence(buf + index);
+    }
+#endif
+    
+#ifdef _WIN32
+#else
+    npan = 0;
+    if (!gFrontValid) {
+        TextScreen_GetConsoleSize(&gConsoleWidth, &x);
+    } else if ((gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_PAN) && !usecode) {
+        // move amount candidates from first some changed rows (not with code point: wide character may be split)
+        for (y = 0, x = 0; (y < height) && (x < 4); y++) {
+            if (!memcmp(gFrontBuf + y * width, gBackBuf + y * width, width)) continue;
+            x++;
+            xs = TextScreen_FindPan(gFrontBuf + y * width, gBackBuf + y * width, width);
+            if (xs && (!npan || (pan[npan - 1] != xs)))
+                pan[npan++] = xs;
+        }
+    }
+#endif
+    
+    // rows over budget are kept as changed (drawn by next frame, from the first row not drawn)
+    budget = gFrameBudget;
+    if ((gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_NONBLOCK) && !gOutSaturated)
+        budget = 0;
+    if (!gFrontValid || (gDiffStartRow >= height))
+        gDiffStartRow = 0;
+    gDiffIncomplete = 0;
+    
+    // row with many changes is cheaper to redraw whole row
+    rowlimit = P_CURSOR_POS_MAXLEN + left + width;
+    changed  = 0;
+    for (i = 0; i < height; i++) {
+        y = (gDiffStartRow + i) % height;
+        if (gFrontValid && (budget > 0) && (index >= budget)) {
+            gDiffStartRow = y;
+            gDiffIncomplete = 1;
+            break;
+        }
+        front = gFrontBuf  + y * width;
+        back  = gBackBuf   + y * width;
+        fattr = gFrontAttr + y * width;
+        battr = gBackAttr  + y * width;
+        fcode = gFrontCode + y * width;
+        bcode = gBackCode  + y * width;
+        rowindex = index;
+        redraw = !gFrontValid;
+        rowchanged = 0;
+#ifdef _WIN32
+#else
+        rowsgr = sgr;
+        rowcx  = cx;
+        rowcy  = cy;
+        if (npan && !redraw && memcmp(front, back, width)) {
+            // inserted cells have current attribute
+            x  = TextScreen_PutSgrSeq(buf + index, sgr, 0);
+            xs = TextScreen_MakePanSequence(buf + index + x, y, pan, npan);
+            if (xs) {
+                index += x + xs;
+                sgr = 0;
+                cx  = -1;
+            }
+        }
+#endif
+        x = 0;
+        while (!redraw && (x < width)) {
+            if ((front[x] == back[x]) && (!useattr || (fattr[x] == battr[x])) && 
+                    (!usecode || (fcode[x] == bcode[x]))) {
+                x++;
+                continue;
+            }
+            xs = x;
+            while ((x < width) && ((front[x] != back[x]) || (useattr && (fattr[x] != battr[x])) || 
+                                   (usecode && (fcode[x] != bcode[x]))))
+                x++;
+            if (usecode && (bcode[xs] == TEXTSCREEN_CODE_RIGHT))
+                xs--;  // output from wide character
+            rowchanged += x - xs;
+#ifdef _WIN32
+            TextScreen_WriteConsoleAt(stdh, left + xs, top + y, back + xs, x - xs);
+#else
+            if ((index - rowindex) + P_CURSOR_POS_MAXLEN + (x - xs) > rowlimit) {
+                redraw = 1;
+                break;
+            }
+            // move cursor, or rewrite unchanged cells from cursor when it is not longer
+            n = TextScreen_PutCursorMoveSeq(buf + index, cx, cy, left + xs, top + y);
+            if ((cy == top + y) && (cx >= left) && (cx < left + xs) && (left + xs - cx <= n)) {
+                for (k = cx - left; k < xs; k++) {
+                    if ((useattr && (battr[k] != sgr)) || (usecode && bcode[k])) break;
+                }
+                if (k == xs) {
+                    xs = cx - left;
+                    n  = 0;
+                }
+            }
+            index += n;
+            index += TextScreen_PutCellRun(buf + index, back + xs, useattr ? battr + xs : NULL, usecode ? bcode + xs : NULL, x - xs, 
+                                           repeat, 1, &sgr);
+            cx = left + x;
+            cy = top + y;
+            if (usecode && (x < width) && (bcode[x] == TEXTSCREEN_CODE_RIGHT))
+                cx++;  // run ends with wide character
+            if ((repeat && (back[x - 1] == ' ')) || (cx >= gConsoleWidth))
+                cx = -1;  // cursor may not be moved by ECH, or waiting for wrap at right end
+#endif
+        }
+        if (redraw) {
+            index = rowindex;
+            rowchanged = width;
+#ifdef _WIN32
+            {
+                COORD  coord;
+                DWORD  len;
+                
+                coord.X = 0;
+                coord.Y = (SHORT)(top + y);
+                FillConsoleOutputCharacter(stdh, ' ', left, coord, &len);
+            }
+            TextScreen_WriteConsoleAt(stdh, left, top + y, back, width);
+#else
+            sgr = rowsgr;
+            cx  = rowcx;
+            cy  = rowcy;
+            index += TextScreen_PutCursorMoveSeq(buf + index, cx, cy, 0, top + y);
+            if (left) {
+                index += TextScreen_PutSgrSeq(buf + index, sgr, 0);
+                sgr = 0;
+            }
+            memset(buf + index, ' ', left);
+            index += left;
+            index += TextScreen_PutCellRun(buf + index, back, useattr ? battr : NULL, usecode ? bcode : NULL, width, 
+                                           repeat, 1, &sgr);
+            cx = left + width;
+            cy = top + y;
+            if ((repeat && (back[width - 1] == ' ')) || (cx >= gConsoleWidth))
+                cx = -1;
+#endif
+        }
+        memcpy(front, back, width);
+        if (useattr) {
+            memcpy(fattr, battr, sizeof(unsigned short) * width);
+        } else if (!gFrontValid) {
+            memset(fattr, 0, sizeof(unsigned short) * width);
+        }
+        if (usecode) {
+            memcpy(fcode, bcode, sizeof(unsigned int) * width);
+        } else if (!gFrontValid) {
+            memset(fcode, 0, sizeof(unsigned int) * width);
+        }
+        if (gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_SCROLL)
+            gFrontHash[y] = gBackHash[y];
+        changed += rowchanged;
+    }
+#ifdef _WIN32
+#else
+    index += TextScreen_PutSgrSeq(buf + index, sgr, 0);
+#endif
+    gStatsCur.cellsChanged += changed;
+    gFrontValid = 1;
+    return index;
+}
+
+static int TextScreen_ShowBitmapFrame(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    char *buf;
+    char ch;
+    int  index, rest;
+    int  repeat;
+    int  i, x, y;
+    int  method;
+#ifdef _WIN32
+#else
+    int  useattr, usecode, rowcode, sgr;
+#endif
+    
+    if (!bitmap) return 0;
+    method = gSetting.renderingMethod;
+    if (gSetting.backend && ((method == TEXTSCREEN_RENDERING_METHOD_NORMAL) || 
+                             (method == TEXTSCREEN_RENDERING_METHOD_SLOW))) {
+        // stdio is not used with backend (FAST makes same output)
+        method = TEXTSCREEN_RENDERING_METHOD_FAST;
+    }
+    switch (method) {  // Prepare buffer
+        case TEXTSCREEN_RENDERING_METHOD_DIFF:
+            if (TextScreen_PrepareScreenBuffer()) return -1;
+            break;
+        default:
+            break;
+    }
+    if (TextScreen_PrepareFrameBuffer()) return -1;
+    
+    // these 'change sign' is historical reason.
+    dx = -dx;
+    dy = -dy;
+    
+    if (method == TEXTSCREEN_RENDERING_METHOD_DIFF) {
+        // output changed characters only (cursor position is included in sequence)
+        rest = (gSetting.width+gSetting.leftMargin+P_CURSOR_POS_MAXLEN) * gSetting.height + P_SCROLL_MAXLEN;
+        if (bitmap->attr || gFrontAttrUsed)
+            rest += (gSetting.width + 2) * gSetting.height * P_SGR_MAXLEN + P_SGR_MAXLEN * 2;
+        if (bitmap->code || gFrontCodeUsed)
+            rest += gSetting.width * gSetting.height * (TEXTSCREEN_UTF8_MAXLEN - 1);
+        buf = TextScreen_OutReserve(rest);
+        if (!buf) return -1;
+        index = TextScreen_MakeDiffSequence(bitmap, dx, dy, buf);
+        TextScreen_OutCommit(index);
+        return TextScreen_OutFlush();
+    }
+    // other method redraw whole screen. console screen is not same as front buffer
+    gFrontValid = 0;
+    
+#ifdef _WIN32
+    {  // set cursor position to 0,0 (top-left corner)
+        HANDLE stdh;
+        COORD  coord;
+        stdh = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (stdh) {
+            coord.X = 0;
+            coord.Y = 0;
+            SetConsoleCursorPosition(stdh ,coord);
+        } else {
+            return -1;
+        }
+    }
+#else
+    P_CURSOR_POS(0, 0);
+#endif
+    
+    if (method == TEXTSCREEN_RENDERING_METHOD_NORMAL) {
+        TextScreen_OutWrite(1, 0);
+        buf = TextScreen_OutReserve(gSetting.width+gSetting.leftMargin+2);
+        if (!buf) return -1;
+        
+        for (i = 0; i < gSetting.topMargin; i++)
+            printf("\n");
+        
+        for (y = 0; y < gSetting.height; y++) {
+            if (y) { printf("\n"); };
+            index = 0;
+            for (i = 0; i < gSetting.leftMargin; i++) {
+                buf[index++] = ' ';
+            }
+            TextScreen_ClipRow(buf + index, gSetting.width, bitmap, dx, y + dy, gSetting.translate);
+            index += gSetting.width;
+            fwrite(buf, 1, index, stdout);
+        }
+        fflush(stdout);
+    }
+    
+    if (method == TEXTSCREEN_RENDERING_METHOD_SLOW) {
+        TextScreen_OutWrite(1, 0);
+        
+        for (i = 0; i < gSetting.topMargin; i++)
+            printf("\n");
+        
+        for (y = 0; y < gSetting.height; y++) {
+            if (y) { printf("\n"); };
+            index = 0;
+            for (i = 0; i < gSetting.leftMargin; i++) {
+                fputc(' ', stdout);
+            }
+            for (x = 0; x < gSetting.width; x++) {
+                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
+                fputc(gSetting.translate[(unsigned char)ch], stdout);
+            }
+            TextScreen_Wait(0);
+        }
+        fflush(stdout);
+    }
+    
+    if (method == TEXTSCREEN_RENDERING_METHOD_FAST) {
+#ifdef _WIN32
+        repeat = 0;
+#else
+        repeat = (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_FAST) && 
+                 (gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_REPEAT);
+#endif
+        rest = gSetting.topMargin + (gSetting.width + gSetting.leftMargin + 1) * gSetting.height;
+#ifdef _WIN32
+#else
+        useattr = (bitmap->attr != NULL);
+        usecode = (bitmap->code != NULL);
+        if (useattr || usecode) {
+            if (TextScreen_PrepareRowBuffer(gSetting.width)) return -1;
+        }
+        if (useattr)
+            rest += (gSetting.width + 1) * gSetting.height * P_SGR_MAXLEN;
+        if (usecode)
+            rest += gSetting.width * gSetting.height * (TEXTSCREEN_UTF8_MAXLEN - 1);
+        sgr = 0;
+#endif
+        buf = TextScreen_OutReserve(rest);
+        if (!buf) return -1;
+        index = 0;
+        for (i = 0; i < gSetting.topMargin; i++) {
+#ifdef _WIN32
+            // buf[index++] = 0x0d;
+            buf[index++] = 0x0a;
+#else
+            buf[index++] = 0x0a;
+#endif
+        }
+        for (y = 0; y < gSetting.height; y++) {
+            if (y) {
+#ifdef _WIN32
+                // buf[index++] = 0x0d;
+                buf[index++] = 0x0a;
+#else
+                buf[index++] = 0x0a;
+#endif
+            }
+#ifdef _WIN32
+#else
+            if (gSetting.leftMargin) {
+                index += TextScreen_PutSgrSeq(buf + index, sgr, 0);
+                sgr = 0;
+            }
+#endif
+            for (i = 0; i < gSetting.leftMargin; i++) {
+                buf[index++] = ' ';
+            }
+#ifdef _WIN32
+#else
+            if (useattr || usecode) {
+                // cursor position at end of row is not used (next is new line)
+                TextScreen_ClipRow(gRowBuf, gSetting.width, bitmap, dx, y + dy, gSetting.translate);
+                if (useattr)
+                    TextScreen_ClipAttrRow(gRowAttr, gSetting.width, bitmap, dx, y + dy);
+                rowcode = usecode && TextScreen_ClipCodeRow(gRowCode, gSetting.width, bitmap, dx, y + dy, 0);
+                if (rowcode)
+                    TextScreen_FixCodeRow(gRowBuf, useattr ? gRowAttr : NULL, gRowCode, gSetting.width);
+                index += TextScreen_PutCellRun(buf + index, gRowBuf, useattr ? gRowAttr : NULL, 
+                                               rowcode ? gRowCode : NULL, gSetting.width, repeat, 1, &sgr);
+                continue;
+            }
+#endif
+            if (gTranslateIdentity && !repeat && (gFrameDepth <= 1) && 
+                    (y + dy >= 0) && (y + dy < bitmap->height) && 
+                    (dx >= 0) && (dx + gSetting.width <= bitmap->width)) {
+                // row is inside of bitmap: output bitmap data directly (without copy)
+                // (not in user frame: bitmap may be changed before TextScreen_EndFrame())
+                TextScreen_OutCommit(index);
+                TextScreen_OutPutRef(bitmap->data + (y + dy) * bitmap->width + dx, gSetting.width);
+                rest -= index + gSetting.width;
+                buf = TextScreen_OutReserve(rest);
+                if (!buf) return -1;
+                index = 0;
+                continue;
+            }
+            TextScreen_ClipRow(buf + index, gSetting.width, bitmap, dx, y + dy, gSetting.translate);
+            if (repeat) {
+                // cursor position at end of row is not used (next is new line)
+                index += TextScreen_PutRepeatSeq(buf + index, buf + index, gSetting.width, 1, 1);
+            } else {
+                index += gSetting.width;
+            }
+        }
+#ifdef _WIN32
+#else
+        index += TextScreen_PutSgrSeq(buf + index, sgr, 0);
+#endif
+        TextScreen_OutCommit(index);
+        return TextScreen_OutFlush();
+    }
+    
+    if (method == TEXTSCREEN_RENDERING_METHOD_WINCONSOLE) { // Windows only
+#ifdef _WIN32
+        HANDLE stdh;
+        DWORD  wlen;
+        
+        buf = TextScreen_OutReserve(gSetting.topMargin + (gSetting.width + gSetting.leftMargin + 1) * gSetting.height);
+        if (!buf) return -1;
+        index = 0;
+        for (i = 0; i < gSetting.topMargin; i++) {
+            // buf[index++] = 0x0d;
+            buf[index++] = 0x0a;
+        }
+        for (y = 0; y < gSetting.height; y++) {
+            if (y) {
+                // buf[index++] = 0x0d;
+                buf[index++] = 0x0a;
+            }
+            for (i = 0; i < gSetting.leftMargin; i++) {
+                buf[index++] = ' ';
+            }
+            TextScreen_ClipRow(buf + index, gSetting.width, bitmap, dx, y + dy, gSetting.translate);
+            index += gSetting.width;
+        }
+        stdh = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (stdh) {
+            WriteConsole(stdh, buf, index, &wlen, NULL);
+        }
+#endif
+    }
+    
+    return 0;
+}
+
+// TextScreen_ShowBitmapFrame() and statistics of encoding (time to write is not included)
+static int TextScreen_EncodeFrame(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    double start   = TextScreen_GetTime();
+    double written = gStatsCur.writeTime;
+    unsigned long long trace = TextScreen_TraceBegin();
+    int    ret;
+    
+    TextScreen_UpdateTranslate();
+    ret = TextScreen_ShowBitmapFrame(bitmap, dx, dy);
+    TextScreen_TraceEnd("encode", trace, 0);
+    gStatsCur.encodeTime   += (TextScreen_GetTime() - start) * 1000 - (gStatsCur.writeTime - written);
+    gStatsCur.cellsScanned += (long)gSetting.width * gSetting.height;
+    if (gSetting.renderingMethod != TEXTSCREEN_RENDERING_METHOD_DIFF)  // whole screen is output
+        gStatsCur.cellsChanged += (long)gSetting.width * gSetting.height;
+    return ret;
+}
+
+// copy screen area of bitmap (shown at dx,dy) to *snap (created or resized to screen size)
+// return 0:successful  -1:error
+static int TextScreen_SnapshotBitmap(TextScreenBitmap **snap, TextScreenBitmap *bitmap, int dx, int dy)
+{
+    TextScreenBitmap *dst = *snap;
+    char *data;
+    int   size = gSetting.width * gSetting.height;
+    int   y;
+    
+    if (!dst) {
+        dst = (TextScreenBitmap *)malloc(sizeof(TextScreenBitmap));
+        if (!dst) return -1;
+        dst->width  = 0;
+        dst->height = 0;
+        dst->exdata = NULL;
+        dst->data   = NULL;
+        dst->attr   = NULL;
+        dst->code   = NULL;
+        *snap = dst;
+    }
+    if ((dst->width != gSetting.width) || (dst->height != gSetting.height)) {
+        data = (char *)realloc(dst->data, (size > 0) ? size : 1);
+        if (!data) return -1;
+        dst->data   = data;
+        dst->width  = gSetting.width;
+        dst->height = gSetting.height;
+        TextScreen_FreeAttrPlane(dst);
+        TextScreen_FreeCodePlane(dst);
+    }
+    if (!bitmap->attr) {
+        TextScreen_FreeAttrPlane(dst);
+    } else if (!dst->attr) {
+        if (TextScreen_CreateAttrPlane(dst)) return -1;
+    }
+    if (!bitmap->code) {
+        TextScreen_FreeCodePlane(dst);
+    } else if (!dst->code) {
+        if (TextScreen_CreateCodePlane(dst)) return -1;
+    }
+    for (y = 0; y < dst->height; y++) {
+        TextScreen_ClipRow(dst->data + y * dst->width, dst->width, bitmap, -dx, y - dy, NULL);
+        if (dst->attr)
+            TextScreen_ClipAttrRow(dst->attr + y * dst->width, dst->width, bitmap, -dx, y - dy);
+        if (dst->code)
+            TextScreen_ClipCodeRow(dst->code + y * dst->width, dst->width, bitmap, -dx, y - dy, 1);
+    }
+    return 0;
+}
+
+// keep bitmap not shown (or shown partly) as skipped frame,  return 0:successful  -1:error
+static int TextScreen_KeepSkippedFrame(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    if ((bitmap != gSkipFrame) && TextScreen_SnapshotBitmap(&gSkipFrame, bitmap, dx, dy)) return -1;
+    gSkipFrameValid = 1;
+    return 0;
+}
+
+// show bitmap as one frame (not in TextScreen_BeginFrame()),  return 0:successful  -1:error
+static int TextScreen_RenderFrame(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    int ret;
+    int block = !(gSetting.renderingFlags & TEXTSCREEN_RENDERING_FLAG_NONBLOCK);
+    
+    if (!block && TextScreen_OutDrain(0)) {
+        // console is busy with last frame: skip this frame (shown when console is ready)
+        gOutSaturated = 1;
+        return TextScreen_KeepSkippedFrame(bitmap, dx, dy);
+    }
+    gSkipFrameValid = 0;
+    gDiffIncomplete = 0;
+    TextScreen_OutBeginFrame();
+    ret = TextScreen_EncodeFrame(bitmap, dx, dy);
+    if (TextScreen_OutEndFrame(block))
+        ret = -1;
+    // rows over budget are drawn later
+    if (gDiffIncomplete && TextScreen_KeepSkippedFrame(bitmap, dx, dy))
+        ret = -1;
+    return ret;
+}
+
+/********************************
+ Asynchronous Rendering
+ ********************************/
+
+#ifdef _WIN32
+static void TextScreen_AsyncWait(void)
+{
+}
+
+int TextScreen_SetAsyncRendering(int enable)
+{
+    return enable ? -1 : 0;
+}
+
+static void TextScreen_DropSkippedFrame(void)
+{
+    gSkipFrameValid = 0;
+}
+#else
+// triple buffer: main thread fills gAsyncSlot[gAsyncWrite], render thread shows gAsyncSlot[gAsyncRead],
+// gAsyncSlot[gAsyncReady] is newest frame (gAsyncNew = 1) or spare
+static int               gAsyncRunning = 0;
+static int               gAsyncStop    = 0;
+static int               gAsyncNew     = 0;  // 1: gAsyncSlot[gAsyncReady] is not shown yet
+static int               gAsyncBusy    = 0;  // 1: render thread is writing gAsyncSlot[gAsyncRead]
+static int               gAsyncResult  = 0;  // return value of last rendering
+static TextScreenBitmap *gAsyncSlot[3] = {NULL, NULL, NULL};
+static int               gAsyncWrite   = 0;
+static int               gAsyncReady   = 1;
+static int               gAsyncRead    = 2;
+static pthread_t         gAsyncThread;
+static pthread_mutex_t   gAsyncLock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    gAsyncCond    = PTHREAD_COND_INITIALIZER;
+#define TEXTSCREEN_ASYNC_RETRY  10  // msec
+
+// drop skipped frame (screen is changed by other output)
+static void TextScreen_DropSkippedFrame(void)
+{
+    pthread_mutex_lock(&gAsyncLock);
+    gSkipFrameValid = 0;
+    pthread_mutex_unlock(&gAsyncLock);
+}
+
+// wait until render thread has written all frames (and skipped frame)
+static void TextScreen_AsyncWait(void)
+{
+    if (!gAsyncRunning || pthread_equal(pthread_self(), gAsyncThread))
+        return;
+    pthread_mutex_lock(&gAsyncLock);
+    while (gAsyncNew || gAsyncBusy || gSkipFrameValid)
+        pthread_cond_wait(&gAsyncCond, &gAsyncLock);
+    pthread_mutex_unlock(&gAsyncLock);
+}
+
+static void *TextScreen_AsyncThread(void *arg)
+{
+    int ret, tmp;
+    
+    struct timespec t;
+    
+    pthread_mutex_lock(&gAsyncLock);
+    for (;;) {
+        while (!gAsyncNew && !gAsyncStop) {
+            if (!gSkipFrameValid) {
+                pthread_cond_wait(&gAsyncCond, &gAsyncLock);
+                continue;
+            }
+            // show skipped frame when console is ready (retry every TEXTSCREEN_ASYNC_RETRY msec)
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_nsec += TEXTSCREEN_ASYNC_RETRY * 1000000L;
+            if (t.tv_nsec >= 1000000000L) {
+                t.tv_sec++;
+                t.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&gAsyncCond, &gAsyncLock, &t);
+            if (gAsyncNew || gAsyncStop || !gSkipFrameValid) continue;
+            gSkipFrameValid = 0;
+            gAsyncBusy = 1;
+            pthread_mutex_unlock(&gAsyncLock);
+            
+            ret = TextScreen_RenderFrame(gSkipFrame, 0, 0);
+            
+            pthread_mutex_lock(&gAsyncLock);
+            gAsyncResult = ret;
+            gAsyncBusy = 0;
+            pthread_cond_broadcast(&gAsyncCond);
+        }
+        if (!gAsyncNew) break;  // stop (all frames are written)
+        tmp = gAsyncRead;
+        gAsyncRead  = gAsyncReady;
+        gAsyncReady = tmp;
+        gAsyncNew  = 0;
+        gAsyncBusy = 1;
+        pthread_mutex_unlock(&gAsyncLock);
+        
+        ret = TextScreen_RenderFrame(gAsyncSlot[gAsyncRead], 0, 0);
+        
+        pthread_mutex_lock(&gAsyncLock);
+        gAsyncResult = ret;
+        gAsyncBusy = 0;
+        pthread_cond_broadcast(&gAsyncCond);
+    }
+    pthread_mutex_unlock(&gAsyncLock);
+    return NULL;
+}
+
+int TextScreen_SetAsyncRendering(int enable)
+{
+    int i;
+    
+    if (enable && !gAsyncRunning) {
+        gAsyncStop   = 0;
+        gAsyncNew    = 0;
+        gAsyncBusy   = 0;
+        gAsyncResult = 0;
+        if (pthread_create(&gAsyncThread, NULL, TextScreen_AsyncThread, NULL))
+            return -1;
+        gAsyncRunning = 1;
+    } else if (!enable && gAsyncRunning) {
+        pthread_mutex_lock(&gAsyncLock);
+        gAsyncStop = 1;
+        pthread_cond_broadcast(&gAsyncCond);
+        pthread_mutex_unlock(&gAsyncLock);
+        pthread_join(gAsyncThread, NULL);
+        gAsyncRunning = 0;
+        for (i = 0; i < 3; i++) {
+            TextScreen_FreeBitmap(gAsyncSlot[i]);
+            gAsyncSlot[i] = NULL;
+        }
+    }
+    return 0;
+}
+
+// copy bitmap to write slot and pass it to render thread,  return result of last rendering
+static int TextScreen_AsyncShowBitmap(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    int  tmp;
+    
+    if (TextScreen_SnapshotBitmap(&gAsyncSlot[gAsyncWrite], bitmap, dx, dy)) return -1;
+    
+    pthread_mutex_lock(&gAsyncLock);
+    tmp = gAsyncWrite;
+    gAsyncWrite = gAsyncReady;  // unshown frame in ready slot is dropped
+    gAsyncReady = tmp;
+    gAsyncNew = 1;
+    pthread_cond_broadcast(&gAsyncCond);
+    tmp = gAsyncResult;
+    pthread_mutex_unlock(&gAsyncLock);
+    return tmp;
+}
+#endif
+
+static int TextScreen_ShowSkippedFrame(void)
+{
+#ifdef _WIN32
+#else
+    if (gAsyncRunning) return 0;  // (shown by render thread)
+#endif
+    if (!gSkipFrameValid || (gUserFrameDepth > 0)) return 0;
+    gSkipFrameValid = 0;
+    return TextScreen_RenderFrame(gSkipFrame, 0, 0);
+}
+
+static void TextScreen_FlushUserFrame(void)
+{
+    if (!gUserFrameValid) return;
+    gUserFrameValid = 0;
+    TextScreen_RecordFrame(gUserFrame, 0, 0);
+    TextScreen_BroadcastFrame(gUserFrame, 0, 0);
+}
+
+// show bitmap as one frame (or part of frame made by TextScreen_BeginFrame()),  return 0:successful  -1:error
+static int TextScreen_PresentBitmap(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    int ret;
+    
+    if (gUserFrameDepth > 0) {
+        // part of frame: screen at end of frame is recorded (whole screen is redrawn by each bitmap)
+        if ((TextScreen_IsRecording() || TextScreen_IsBroadcasting()) && 
+            !TextScreen_SnapshotBitmap(&gUserFrame, bitmap, dx, dy))
+            gUserFrameValid = 1;
+    } else {
+        TextScreen_RecordFrame(bitmap, dx, dy);
+        TextScreen_BroadcastFrame(bitmap, dx, dy);
+    }
+#ifdef _WIN32
+#else
+    if (gAsyncRunning && (gUserFrameDepth == 0))
+        return TextScreen_AsyncShowBitmap(bitmap, dx, dy);
+#endif
+    TextScreen_AsyncWait();
+    gSkipFrameValid = 0;  // (newer frame is shown)
+    if (gUserFrameDepth > 0) {
+        TextScreen_OutBeginFrame();
+        ret = TextScreen_EncodeFrame(bitmap, dx, dy);
+        if (TextScreen_OutEndFrame(1))
+            ret = -1;
+        return ret;
+    }
+    return TextScreen_RenderFrame(bitmap, dx, dy);
+}
+
+/********************************
+ Frame Pacing
+ ********************************/
+
+static double            gFramePeriod  = 0;     // sec/frame (0: no pacing)
+static double            gFrameNext    = 0;     // time of next frame
+static double            gFrameWaited  = 0;     // frame time waited by TextScreen_WaitFrame()
+static double            gFrameLast    = 0;     // time of last shown frame
+static double            gFrameRate    = 0;     // achieved frame rate (average)
+static double            gFrameTime    = 0;     // time to show frame (average, sec)
+static TextScreenBitmap *gFramePending = NULL;  // newest bitmap not shown yet (screen size)
+static int               gFramePendingValid = 0;
+
+// monotonic time (sec)
+static double TextScreen_GetTime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#endif
+}
+
+// show frame and measure,  return 0:successful  -1:error
+static int TextScreen_PaceShowBitmap(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    double start, end;
+    int    ret;
+    
+    start = TextScreen_GetTime();
+    ret = TextScreen_PresentBitmap(bitmap, dx, dy);
+    end = TextScreen_GetTime();
+    
+    gFrameTime = (gFrameTime > 0) ? (gFrameTime * 0.9 + (end - start) * 0.1) : (end - start);
+    if ((gFrameLast > 0) && (start > gFrameLast)) {
+        gFrameRate = (gFrameRate > 0) ? (gFrameRate * 0.9 + 0.1 / (start - gFrameLast)) : (1.0 / (start - gFrameLast));
+    }
+    gFrameLast = start;
+    // next frame time: keep period without drift. skip missed frames, and wait for slow console
+    gFrameNext += gFramePeriod;
+    if (gFrameNext < start)
+        gFrameNext = start + gFramePeriod;
+    if (gFrameNext < end)
+        gFrameNext = end;
+    return ret;
+}
+
+void TextScreen_SetFrameRate(double fps)
+{
+    if (fps > 0) {
+        gFramePeriod = 1.0 / fps;
+        gFrameNext = TextScreen_GetTime();
+    } else {
+        gFramePeriod = 0;
+        if (gFramePendingValid)  // show kept bitmap
+            TextScreen_PaceShowBitmap(gFramePending, 0, 0);
+        gFramePendingValid = 0;
+    }
+}
+
+int TextScreen_WaitFrame(void)
+{
+    double now;
+    int    ret;
+    
+    ret = TextScreen_ShowSkippedFrame();
+    TextScreen_PollBroadcast();
+    if (gFramePeriod <= 0) return ret;
+    if (gFrameNext <= gFrameWaited)  // no frame after last wait: keep rate
+        gFrameNext = gFrameWaited + gFramePeriod;
+    now = TextScreen_GetTime();
+    if (gFrameNext > now) {
+#ifdef _WIN32
+        Sleep((DWORD)((gFrameNext - now) * 1000));
+#else
+        struct timespec t;
+        
+        t.tv_sec  = (time_t)(gFrameNext - now);
+        t.tv_nsec = (long)((gFrameNext - now - t.tv_sec) * 1e9);
+        nanosleep(&t, NULL);
+#endif
+    }
+    gFrameWaited = gFrameNext;
+    if (gFramePendingValid) {
+        gFramePendingValid = 0;
+        ret = TextScreen_PaceShowBitmap(gFramePending, 0, 0);
+    } else if (TextScreen_ShowSkippedFrame()) {
+        ret = -1;
+    }
+    return ret;
+}
+
+double TextScreen_GetFrameRate(void)
+{
+    return gFrameRate;
+}
+
+double TextScreen_GetFrameTime(void)
+{
+    return gFrameTime * 1000;
+}
+
+int TextScreen_ShowBitmap(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    unsigned long long trace;
+    int ret;
+    
+    if (!gSetting.width || !gSetting.height)
+        TextScreen_Init(NULL);
+    if (!bitmap) return 0;
+    
+    trace = TextScreen_TraceBegin();
+    if (gUserFrameDepth > 0) {  // part of frame
+        ret = TextScreen_PresentBitmap(bitmap, dx, dy);
+    } else if ((gFramePeriod > 0) && (TextScreen_GetTime() < gFrameNext)) {
+        // too early: keep newest bitmap (shown by TextScreen_WaitFrame())
+        ret = TextScreen_SnapshotBitmap(&gFramePending, bitmap, dx, dy) ? -1 : 0;
+        if (!ret)
+            gFramePendingValid = 1;
+    } else {
+        gFramePendingValid = 0;
+        ret = TextScreen_PaceShowBitmap(bitmap, dx, dy);
+    }
+    TextScreen_TraceEnd("ShowBitmap", trace, 0);
+    return ret;
+}
+
+/********************************
+ Rendering Statistics
+ ********************************/
+
+// bucket of frame time histogram (4 buckets per octave of usec)
+static int TextScreen_StatsBucket(double ms)
+{
+    double m;
+    int    e, bucket;
+    
+    if (ms < 0.001) return 0;
+    m = frexp(ms * 1000, &e);  // usec = m * 2^e  (0.5 <= m < 1)
+    bucket = 1 + (e - 1) * 4 + (int)((m - 0.5) * 8);
+    return (bucket < TEXTSCREEN_STATS_BUCKETS) ? bucket : TEXTSCREEN_STATS_BUCKETS - 1;
+}
+
+static void TextScreen_StatsEndFrame(void)
+{
+    double t = gStatsCur.encodeTime + gStatsCur.writeTime;
+    
+    gStatsCur.frames       = 1;
+    gStatsCur.frameTime    = t;
+    gStatsCur.frameTimeMin = t;
+    gStatsCur.frameTimeAvg = t;
+    gStatsCur.frameTimeP99 = t;
+    gStatsCur.frameTimeMax = t;
+    gStatsFrame = gStatsCur;
+    
+    if (!gStatsTotal.frames || (t < gStatsTotal.frameTimeMin))
+        gStatsTotal.frameTimeMin = t;
+    if (t > gStatsTotal.frameTimeMax)
+        gStatsTotal.frameTimeMax = t;
+    gStatsTotal.frames++;
+    gStatsTotal.cellsScanned += gStatsCur.cellsScanned;
+    gStatsTotal.cellsChanged += gStatsCur.cellsChanged;
+    gStatsTotal.bytes        += gStatsCur.bytes;
+    gStatsTotal.writes       += gStatsCur.writes;
+    gStatsTotal.encodeTime   += gStatsCur.encodeTime;
+    gStatsTotal.writeTime    += gStatsCur.writeTime;
+    gStatsTotal.frameTime    += t;
+    gStatsHist[TextScreen_StatsBucket(t)]++;
+    memset(&gStatsCur, 0, sizeof(gStatsCur));
+}
+
+void TextScreen_GetStats(TextScreenStats *frame, TextScreenStats *total)
+{
+    long rest;
+    int  i, e;
+    
+    TextScreen_AsyncWait();  // (render thread updates statistics)
+    if (frame)
+        *frame = gStatsFrame;
+    if (!total) return;
+    *total = gStatsTotal;
+    if (!total->frames) return;
+    total->frameTimeAvg = total->frameTime / total->frames;
+    // 99 percentile: upper end of bucket (not over max)
+    rest = total->frames - (long)ceil(total->frames * 0.99);
+    for (i = TEXTSCREEN_STATS_BUCKETS - 1; (i > 0) && (rest >= gStatsHist[i]); i--)
+        rest -= gStatsHist[i];
+    e = (i - 1) / 4 + 1;
+    total->frameTimeP99 = i ? ldexp(0.5 + ((i - 1) % 4 + 1) / 8.0, e) / 1000 : 0.001;
+    if (total->frameTimeP99 > total->frameTimeMax)
+        total->frameTimeP99 = total->frameTimeMax;
+}
+
+void TextScreen_ResetStats(void)
+{
+    TextScreen_AsyncWait();
+    memset(&gStatsCur, 0, sizeof(gStatsCur));
+    memset(&gStatsFrame, 0, sizeof(gStatsFrame));
+    memset(&gStatsTotal, 0, sizeof(gStatsTotal));
+    memset(gStatsHist, 0, sizeof(gStatsHist));
+}
+
+// TEXTSCREEN_STATS=1: stderr, other value: file name
+static void TextScreen_PrintStats(void)
+{
+    const char *env = getenv("TEXTSCREEN_STATS");
+    TextScreenStats total;
+    FILE *fp;
+    
+    if (!env || !env[0] || !strcmp(env, "0")) return;
+    fp = strcmp(env, "1") ? fopen(env, "a") : stderr;
+    if (!fp) return;
+    TextScreen_GetStats(NULL, &total);
+    fprintf(fp, "textscreen: %ld frames, %ld cells scanned, %ld cells changed, %ld bytes, %ld writes\n",
+            total.frames, total.cellsScanned, total.cellsChanged, total.bytes, total.writes);
+    if (total.frames) {
+        fprintf(fp, "textscreen: per frame %.1f cells changed, %.1f bytes, encode %.3f ms, write %.3f ms\n",
+                (double)total.cellsChanged / total.frames, (double)total.bytes / total.frames,
+                total.encodeTime / total.frames, total.writeTime / total.frames);
+        fprintf(fp, "textscreen: frame time min %.3f ms, avg %.3f ms, p99 %.3f ms, max %.3f ms\n",
+                total.frameTimeMin, total.frameTimeAvg, total.frameTimeP99, total.frameTimeMax);
+    }
+    if (fp != stderr)
+        fclose(fp);
+}
+
+/********************************
+ Output Backend
+ ********************************/
+
+typedef struct TextScreenMemoryBackend {
+    TextScreenBackend backend;
+    int   width;
+    int   height;
+    int   keepData;
+    char *data;
+    long  size;
+    long  bytes;
+    long  frames;
+} TextScreenMemoryBackend;
+
+static int TextScreen_TtyWrite(void *userdata, const char *data, int len)
+{
+    return (fwrite(data, 1, len, (FILE *)userdata) == (size_t)len) ? 0 : -1;
+}
+
+static int TextScreen_TtyFlush(void *userdata, int endOfFrame)
+{
+    return fflush((FILE *)userdata) ? -1 : 0;
+}
+
+static int TextScreen_TtyGetSize(void *userdata, int *width, int *height)
+{
+#ifdef _WIN32
+#else
+    struct winsize ws;
+    
+    if (ioctl(fileno((FILE *)userdata), TIOCGWINSZ, &ws) != -1) {
+        *width  = ws.ws_col;
+        *height = ws.ws_row;
+        return 0;
+    }
+#endif
+    *width  = 80;
+    *height = 25;
+    return -1;
+}
+
+static int TextScreen_MemoryWrite(void *userdata, const char *data, int len)
+{
+    TextScreenMemoryBackend *mem = (TextScreenMemoryBackend *)userdata;
+    char *p;
+    long  size;
+    
+    if (mem->keepData) {
+        if (mem->bytes + len > mem->size) {
+            size = (mem->size > 0) ? mem->size : 4096;
+            while (size < mem->bytes + len)
+                size *= 2;
+            p = (char *)realloc(mem->data, size);
+            if (!p) return -1;
+            mem->data = p;
+            mem->size = size;
+        }
+        memcpy(mem->data + mem->bytes, data, len);
+    }
+    mem->bytes += len;
+    return 0;
+}
+
+static int TextScreen_MemoryFlush(void *userdata, int endOfFrame)
+{
+    TextScreenMemoryBackend *mem = (TextScreenMemoryBackend *)userdata;
+    
+    if (endOfFrame)
+        mem->frames++;
+    return 0;
+}
+
+static int TextScreen_MemoryGetSize(void *userdata, int *width, int *height)
+{
+    TextScreenMemoryBackend *mem = (TextScreenMemoryBackend *)userdata;
+    
+    *width  = mem->width;
+    *height = mem->height;
+    return 0;
+}
+
+// headless VT emulator (VT100/xterm subset) of TextScreen_CreateVtBackend()
+#define TEXTSCREEN_VT_MAXPARAM  16
+enum TextScreenVtState {
+    TEXTSCREEN_VT_GROUND = 0,
+    TEXTSCREEN_VT_ESC,          // after ESC
+    TEXTSCREEN_VT_ESC_INTER,    // ESC and intermediate (eg. "ESC ( B")
+    TEXTSCREEN_VT_CSI,          // control sequence
+    TEXTSCREEN_VT_OSC,          // operating system command (until BEL or ST)
+    TEXTSCREEN_VT_OSC_ESC
+};
+
+typedef struct TextScreenVtBackend {
+    TextScreenBackend backend;
+    int   width;
+    int   height;
+    unsigned int   *cell;    // character (byte or code point, TEXTSCREEN_CODE_RIGHT: right half of wide character)
+    unsigned short *attr;    // attribute (TEXTSCREEN_ATTR_*)
+    int   x, y;              // cursor position
+    int   wrap;              // 1: cursor is after last column (next character is put to next line)
+    int   top, bottom;       // scroll region (DECSTBM)
+    int   sgr;               // current attribute
+    int   autowrap;
+    int   cursorVisible;
+    int   savedX, savedY, savedSgr;
+    unsigned int last;       // last character (REP)
+    int   lastWidth;
+    // parser state
+    int   state;
+    int   param[TEXTSCREEN_VT_MAXPARAM];
+    int   nparam;
+    char  prefix;            // private parameter prefix of CSI ('?', '>', ...)
+    char  inter;             // intermediate of CSI ('$', ' ', ...)
+    unsigned char utf8[TEXTSCREEN_UTF8_MAXLEN];
+    int   utf8len;
+    int   utf8need;
+    TextScreenVtStats count;  // current frame
+    TextScreenVtStats frame;  // last frame
+    TextScreenVtStats total;
+} TextScreenVtBackend;
+
+// erase cells [from, to) (index of screen)
+static void TextScreen_VtErase(TextScreenVtBackend *vt, long from, long to)
+{
+    unsigned short blank = (unsigned short)(vt->sgr & 0x3ff);  // erased cell has colors (not bold and underline)
+    long i;
+    
+    for (i = from; i < to; i++) {
+        vt->cell[i] = ' ';
+        vt->attr[i] = blank;
+    }
+}
+
+// blank broken half of wide character in row y (after erase, insert and delete)
+static void TextScreen_VtFixRow(TextScreenVtBackend *vt, int y)
+{
+    unsigned int *row = vt->cell + (long)y * vt->width;
+    int x;
+    
+    for (x = 0; x < vt->width; x++) {
+        if (row[x] == TEXTSCREEN_CODE_RIGHT) {
+            if ((x == 0) || (row[x - 1] == TEXTSCREEN_CODE_RIGHT) || (TextScreen_GetCodeWidth(row[x - 1]) != 2))
+                row[x] = ' ';
+        } else if ((row[x] >= 0x80) && (TextScreen_GetCodeWidth(row[x]) == 2)) {
+            if ((x + 1 >= vt->width) || (row[x + 1] != TEXTSCREEN_CODE_RIGHT))
+                row[x] = ' ';
+        }
+    }
+}
+
+// scroll up (n > 0) or down (n < 0) rows top to bottom
+static void TextScreen_VtScroll(TextScreenVtBackend *vt, int n, int top, int bottom)
+{
+    long w = vt->width;
+    int  rows = bottom - top + 1;
+    int  k = (n < 0) ? -n : n;
+    
+    if ((rows <= 0) || !n) return;
+    if (k > rows) k = rows;
+    if (n > 0) {
+        memmove(vt->cell + top * w, vt->cell + (top + k) * w, sizeof(unsigned int) * (rows - k) * w);
+        memmove(vt->attr + top * w, vt->attr + (top + k) * w, sizeof(unsigned short) * (rows - k) * w);
+        TextScreen_VtErase(vt, (bottom - k + 1) * w, (bottom + 1) * w);
+    } else {
+        memmove(vt->cell + (top + k) * w, vt->cell + top * w, sizeof(unsigned int) * (rows - k) * w);
+        memmove(vt->attr + (top + k) * w, vt->attr + top * w, sizeof(unsigned short) * (rows - k) * w);
+        TextScreen_VtErase(vt, top * w, (top + k) * w);
+    }
+}
+
+static void TextScreen_VtLineFeed(TextScreenVtBackend *vt)
+{
+    if (vt->y == vt->bottom) {
+        TextScreen_VtScroll(vt, 1, vt->top, vt->bottom);
+    } else if (vt->y < vt->height - 1) {
+        vt->y++;
+    }
+}
+
+static void TextScreen_VtReset(TextScreenVtBackend *vt)
+{
+    vt->sgr = 0;
+    TextScreen_VtErase(vt, 0, (long)vt->width * vt->height);
+    vt->x = vt->y = 0;
+    vt->wrap      = 0;
+    vt->top       = 0;
+    vt->bottom    = vt->height - 1;
+    vt->autowrap  = 1;
+    vt->cursorVisible = 1;
+    vt->savedX = vt->savedY = vt->savedSgr = 0;
+    vt->last      = 0;
+    vt->lastWidth = 0;
+    vt->state     = TEXTSCREEN_VT_GROUND;
+    vt->utf8len   = 0;
+    vt->utf8need  = 0;
+}
+
+// put character c (width w) at cursor
+static void TextScreen_VtPut(TextScreenVtBackend *vt, unsigned int c, int w)
+{
+    unsigned int   *row;
+    unsigned short *attr;
+    int x;
+    
+    if (w <= 0) return;  // combining character is not kept
+    if (vt->wrap) {
+        vt->x = 0;
+        TextScreen_VtLineFeed(vt);
+        vt->wrap = 0;
+    }
+    if ((w == 2) && (vt->x + 1 >= vt->width)) {
+        // wide character at last column: put to next line
+        if (!vt->autowrap || (vt->width < 2)) return;
+        TextScreen_VtErase(vt, (long)vt->y * vt->width + vt->x, (long)vt->y * vt->width + vt->x + 1);
+        vt->x = 0;
+        TextScreen_VtLineFeed(vt);
+    }
+    x    = vt->x;
+    row  = vt->cell + (long)vt->y * vt->width;
+    attr = vt->attr + (long)vt->y * vt->width;
+    // overwriting half of wide character blanks other half
+    if ((row[x] == TEXTSCREEN_CODE_RIGHT) && (x > 0))
+        row[x - 1] = ' ';
+    if ((x + w < vt->width) && (row[x + w] == TEXTSCREEN_CODE_RIGHT))
+        row[x + w] = ' ';
+    row[x]  = c;
+    attr[x] = (unsigned short)vt->sgr;
+    if (w == 2) {
+        row[x + 1]  = TEXTSCREEN_CODE_RIGHT;
+        attr[x + 1] = (unsigned short)vt->sgr;
+    }
+    vt->last      = c;
+    vt->lastWidth = w;
+    vt->count.printed++;
+    vt->x += w;
+    if (vt->x >= vt->width) {
+        vt->x = vt->width - 1;
+        vt->wrap = vt->autowrap;
+    }
+}
+
+// put bytes of incomplete UTF-8 sequence as characters
+static void TextScreen_VtFlushUtf8(TextScreenVtBackend *vt)
+{
+    int i, len = vt->utf8len;
+    
+    vt->utf8len  = 0;
+    vt->utf8need = 0;
+    for (i = 0; i < len; i++)
+        TextScreen_VtPut(vt, vt->utf8[i], 1);
+}
+
+// parameter i of CSI (def: default value for missing or 0)
+static int TextScreen_VtParam(TextScreenVtBackend *vt, int i, int def)
+{
+    return ((i < vt->nparam) && (vt->param[i] > 0)) ? vt->param[i] : def;
+}
+
+static void TextScreen_VtSgr(TextScreenVtBackend *vt)
+{
+    int i, v;
+    
+    for (i = 0; i < vt->nparam; i++) {
+        v = vt->param[i];
+        if (v == 0) {
+            vt->sgr = 0;
+        } else if (v == 1) {
+            vt->sgr |= TEXTSCREEN_ATTR_BOLD;
+        } else if (v == 22) {
+            vt->sgr &= ~TEXTSCREEN_ATTR_BOLD;
+        } else if (v == 4) {
+            vt->sgr |= TEXTSCREEN_ATTR_UNDERLINE;
+        } else if (v == 24) {
+            vt->sgr &= ~TEXTSCREEN_ATTR_UNDERLINE;
+        } else if (((v >= 30) && (v <= 37)) || ((v >= 90) && (v <= 97)) || (v == 39)) {
+            vt->sgr = (vt->sgr & ~0x1f) | ((v == 39) ? 0 : (v <= 37) ? v - 29 : v - 81);
+        } else if (((v >= 40) && (v <= 47)) || ((v >= 100) && (v <= 107)) || (v == 49)) {
+            vt->sgr = (vt->sgr & ~(0x1f << 5)) | (((v == 49) ? 0 : (v <= 47) ? v - 39 : v - 91) << 5);
+        } else if ((v == 38) || (v == 48)) {
+            // 256 color and 24 bit color are not kept (default color)
+            if ((i + 1 < vt->nparam) && (vt->param[i + 1] == 5)) {
+                i += 2;
+            } else if ((i + 1 < vt->nparam) && (vt->param[i + 1] == 2)) {
+                i += 4;
+            }
+            vt->sgr &= (v == 38) ? ~0x1f : ~(0x1f << 5);
+        }
+    }
+}
+
+static void TextScreen_VtCsi(TextScreenVtBackend *vt, char final)
+{
+    long w = vt->width;
+    long pos = vt->y * w + vt->x;
+    int  n = TextScreen_VtParam(vt, 0, 1);
+    int  i;
+    
+    if (vt->prefix == '?') {
+        if ((final == 'h') || (final == 'l')) {
+            for (i = 0; i < vt->nparam; i++) {
+                if (vt->param[i] == 25)
+                    vt->cursorVisible = (final == 'h');
+                if (vt->param[i] == 7)
+                    vt->autowrap = (final == 'h');
+            }
+        }
+        return;
+    }
+    if (vt->prefix || vt->inter) return;  // not supported (DA, DECRQM, ...)
+    switch (final) {
+    case 'A':  // CUU
+        vt->y -= n;
+        if (vt->y < ((vt->y + n >= vt->top) ? vt->top : 0))
+            vt->y = (vt->y + n >= vt->top) ? vt->top : 0;
+        break;
+    case 'B':  // CUD
+        vt->y += n;
+        if (vt->y > ((vt->y - n <= vt->bottom) ? vt->bottom : vt->height - 1))
+            vt->y = (vt->y - n <= vt->bottom) ? vt->bottom : vt->height - 1;
+        break;
+    case 'C':  // CUF
+        vt->x = (vt->x + n < vt->width) ? vt->x + n : vt->width - 1;
+        break;
+    case 'D':  // CUB
+        vt->x = (vt->x > n) ? vt->x - n : 0;
+        break;
+    case 'G':  // CHA
+    case '`':
+        vt->x = (n <= vt->width) ? n - 1 : vt->width - 1;
+        break;
+    case 'd':  // VPA
+        vt->y = (n <= vt->height) ? n - 1 : vt->height - 1;
+        break;
+    case 'H':  // CUP
+    case 'f':
+        vt->y = TextScreen_VtParam(vt, 0, 1) - 1;
+        vt->x = TextScreen_VtParam(vt, 1, 1) - 1;
+        if (vt->y >= vt->height) vt->y = vt->height - 1;
+        if (vt->x >= vt->width)  vt->x = vt->width - 1;
+        break;
+    case 'J':  // ED
+        i = TextScreen_VtParam(vt, 0, 0);
+        if (i == 0) {
+            TextScreen_VtErase(vt, pos, w * vt->height);
+        } else if (i == 1) {
+            TextScreen_VtErase(vt, 0, pos + 1);
+        } else {
+            TextScreen_VtErase(vt, 0, w * vt->height);
+        }
+        TextScreen_VtFixRow(vt, vt->y);
+        return;
+    case 'K':  // EL
+        i = TextScreen_VtParam(vt, 0, 0);
+        TextScreen_VtErase(vt, (i == 0) ? pos : vt->y * w, (i == 1) ? pos + 1 : (vt->y + 1) * w);
+        TextScreen_VtFixRow(vt, vt->y);
+        return;
+    case 'X':  // ECH
+        TextScreen_VtErase(vt, pos, pos + ((n < w - vt->x) ? n : w - vt->x));
+        TextScreen_VtFixRow(vt, vt->y);
+        return;
+    case '@':  // ICH
+        if (n > w - vt->x) n = (int)(w - vt->x);
+        memmove(vt->cell + pos + n, vt->cell + pos, sizeof(unsigned int) * (w - vt->x - n));
+        memmove(vt->attr + pos + n, vt->attr + pos, sizeof(unsigned short) * (w - vt->x - n));
+        TextScreen_VtErase(vt, pos, pos + n);
+        TextScreen_VtFixRow(vt, vt->y);
+        break;
+    case 'P':  // DCH
+        if (n > w - vt->x) n = (int)(w - vt->x);
+        memmove(vt->cell + pos, vt->cell + pos + n, sizeof(unsigned int) * (w - vt->x - n));
+        memmove(vt->attr + pos, vt->attr + pos + n, sizeof(unsigned short) * (w - vt->x - n));
+        TextScreen_VtErase(vt, (vt->y + 1) * w - n, (vt->y + 1) * w);
+        TextScreen_VtFixRow(vt, vt->y);
+        break;
+    case 'b':  // REP
+        for (i = 0; (i < n) && vt->lastWidth; i++)
+            TextScreen_VtPut(vt, vt->last, vt->lastWidth);
+        return;
+    case 'L':  // IL
+    case 'M':  // DL
+        if ((vt->y >= vt->top) && (vt->y <= vt->bottom))
+            TextScreen_VtScroll(vt, (final == 'L') ? -n : n, vt->y, vt->bottom);
+        vt->x = 0;
+        break;
+    case 'S':  // SU
+        TextScreen_VtScroll(vt, n, vt->top, vt->bottom);
+        return;
+    case 'T':  // SD
+        TextScreen_VtScroll(vt, -n, vt->top, vt->bottom);
+        return;
+    case 'r':  // DECSTBM
+        i = TextScreen_VtParam(vt, 1, vt->height);
+        if (i > vt->height) i = vt->height;
+        if (TextScreen_VtParam(vt, 0, 1) < i) {
+            vt->top    = TextScreen_VtParam(vt, 0, 1) - 1;
+            vt->bottom = i - 1;
+            vt->x = vt->y = 0;
+        }
+        break;
+    case 'm':  // SGR
+        TextScreen_VtSgr(vt);
+        return;
+    case 's':
+        vt->savedX = vt->x;
+        vt->savedY = vt->y;
+        return;
+    case 'u':
+        vt->x = vt->savedX;
+        vt->y = vt->savedY;
+        break;
+    default:
+        return;
+    }
+    if (strchr("ABCDG`dHf", final))
+        vt->count.cursorMoves++;
+    vt->wrap = 0;
+}
+
+// control character
+static void TextScreen_VtControl(TextScreenVtBackend *vt, unsigned char c)
+{
+    switch (c) {
+    case 0x08:  // BS
+        if (vt->x > 0) vt->x--;
+        break;
+    case 0x09:  // HT
+        vt->x = ((vt->x / 8 + 1) * 8 < vt->width) ? (vt->x / 8 + 1) * 8 : vt->width - 1;
+        break;
+    case 0x0a:  // LF (tty converts to CR LF)
+    case 0x0b:
+    case 0x0c:
+        vt->x = 0;
+        TextScreen_VtLineFeed(vt);
+        break;
+    case 0x0d:  // CR
+        vt->x = 0;
+        break;
+    default:
+        return;
+    }
+    vt->count.cursorMoves++;
+    vt->wrap = 0;
+}
+
+static void TextScreen_VtEsc(TextScreenVtBackend *vt, unsigned char c)
+{
+    vt->state = TEXTSCREEN_VT_GROUND;
+    switch (c) {
+    case '[':
+        vt->state  = TEXTSCREEN_VT_CSI;
+        vt->nparam = 1;
+        vt->param[0] = 0;
+        vt->prefix = 0;
+        vt->inter  = 0;
+        break;
+    case ']':
+        vt->state = TEXTSCREEN_VT_OSC;
+        break;
+    case 'c':  // RIS
+        TextScreen_VtReset(vt);
+        break;
+    case '7':  // DECSC
+        vt->savedX   = vt->x;
+        vt->savedY   = vt->y;
+        vt->savedSgr = vt->sgr;
+        break;
+    case '8':  // DECRC
+        vt->x    = vt->savedX;
+        vt->y    = vt->savedY;
+        vt->sgr  = vt->savedSgr;
+        vt->wrap = 0;
+        break;
+    case 'D':  // IND
+        TextScreen_VtLineFeed(vt);
+        vt->wrap = 0;
+        break;
+    case 'E':  // NEL
+        vt->x = 0;
+        TextScreen_VtLineFeed(vt);
+        vt->wrap = 0;
+        break;
+    case 'M':  // RI
+        if (vt->y == vt->top) {
+            TextScreen_VtScroll(vt, -1, vt->top, vt->bottom);
+        } else if (vt->y > 0) {
+            vt->y--;
+        }
+        vt->wrap = 0;
+        break;
+    default:
+        if ((c >= 0x20) && (c <= 0x2f))
+            vt->state = TEXTSCREEN_VT_ESC_INTER;
+        break;
+    }
+}
+
+static int TextScreen_VtWrite(void *userdata, const char *data, int len)
+{
+    TextScreenVtBackend *vt = (TextScreenVtBackend *)userdata;
+    unsigned int code;
+    unsigned char c;
+    int i, k;
+    
+    vt->count.bytes += len;
+    for (i = 0; i < len; i++) {
+        c = (unsigned char)data[i];
+        switch (vt->state) {
+        case TEXTSCREEN_VT_GROUND:
+            if (vt->utf8need) {
+                if ((c & 0xc0) == 0x80) {
+                    vt->utf8[vt->utf8len++] = c;
+                    if (vt->utf8len > vt->utf8need) {
+                        code = vt->utf8[0] & (0x3f >> vt->utf8need);
+                        for (k = 1; k < vt->utf8len; k++)
+                            code = (code << 6) | (vt->utf8[k] & 0x3f);
+                        vt->utf8len  = 0;
+                        vt->utf8need = 0;
+                        TextScreen_VtPut(vt, code, TextScreen_GetCodeWidth(code));
+                    }
+                    break;
+                }
+                TextScreen_VtFlushUtf8(vt);  // not UTF-8: each byte is character
+            }
+            if (c == 0x1b) {
+                vt->state = TEXTSCREEN_VT_ESC;
+                vt->count.escapes++;
+            } else if ((c < 0x20) || (c == 0x7f)) {
+                TextScreen_VtControl(vt, c);
+            } else if (c < 0x80) {
+                TextScreen_VtPut(vt, c, 1);
+            } else if ((c >= 0xc2) && (c <= 0xf4)) {
+                vt->utf8[0]  = c;
+                vt->utf8len  = 1;
+                vt->utf8need = (c < 0xe0) ? 1 : (c < 0xf0) ? 2 : 3;
+            } else {
+                TextScreen_VtPut(vt, c, 1);
+            }
+            break;
+        case TEXTSCREEN_VT_ESC:
+            TextScreen_VtEsc(vt, c);
+            break;
+        case TEXTSCREEN_VT_ESC_INTER:
+            if ((c >= 0x30) && (c <= 0x7e))
+                vt->state = TEXTSCREEN_VT_GROUND;
+            break;
+        case TEXTSCREEN_VT_CSI:
+            if ((c >= '0') && (c <= '9')) {
+                if (vt->param[vt->nparam - 1] < 100000)
+                    vt->param[vt->nparam - 1] = vt->param[vt->nparam - 1] * 10 + (c - '0');
+            } else if ((c == ';') || (c == ':')) {
+                if (vt->nparam < TEXTSCREEN_VT_MAXPARAM)
+                    vt->param[vt->nparam++] = 0;
+            } else if ((c >= '<') && (c <= '?')) {
+                vt->prefix = (char)c;
+            } else if ((c >= 0x20) && (c <= 0x2f)) {
+                vt->inter = (char)c;
+            } else if ((c >= 0x40) && (c <= 0x7e)) {
+                vt->state = TEXTSCREEN_VT_GROUND;
+                TextScreen_VtCsi(vt, (char)c);
+            } else if (c == 0x1b) {
+                vt->state = TEXTSCREEN_VT_ESC;
+                vt->count.escapes++;
+            } else if (c < 0x20) {
+                TextScreen_VtControl(vt, c);
+            }
+            break;
+        case TEXTSCREEN_VT_OSC:
+            if (c == 0x07) {
+                vt->state = TEXTSCREEN_VT_GROUND;
+            } else if (c == 0x1b) {
+                vt->state = TEXTSCREEN_VT_OSC_ESC;
+            }
+            break;
+        default:  // TEXTSCREEN_VT_OSC_ESC (ST: "ESC \")
+            vt->state = TEXTSCREEN_VT_GROUND;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int TextScreen_VtFlush(void *userdata, int endOfFrame)
+{
+    TextScreenVtBackend *vt = (TextScreenVtBackend *)userdata;
+    
+    if (endOfFrame) {
+        vt->count.frames = 1;
+        vt->frame = vt->count;
+        vt->total.bytes       += vt->count.bytes;
+        vt->total.escapes     += vt->count.escapes;
+        vt->total.cursorMoves += vt->count.cursorMoves;
+        vt->total.printed     += vt->count.printed;
+        vt->total.frames++;
+        memset(&vt->count, 0, sizeof(vt->count));
+    }
+    return 0;
+}
+
+static int TextScreen_VtGetSize(void *userdata, int *width, int *height)
+{
+    TextScreenVtBackend *vt = (TextScreenVtBackend *)userdata;
+    
+    *width  = vt->width;
+    *height = vt->height;
+    return 0;
+}
+
+TextScreenBackend *TextScreen_CreateTtyBackend(FILE *fp)
+{
+    TextScreenBackend *backend;
+    
+    if (!fp) return NULL;
+    backend = (TextScreenBackend *)malloc(sizeof(TextScreenBackend));
+    if (!backend) return NULL;
+    backend->userdata = (void *)fp;
+    backend->write    = TextScreen_TtyWrite;
+    backend->flush    = TextScreen_TtyFlush;
+    backend->getSize  = TextScreen_TtyGetSize;
+    return backend;
+}
+
+TextScreenBackend *TextScreen_CreateMemoryBackend(int width, int height, int keepData)
+{
+    TextScreenMemoryBackend *mem;
+    
+    if ((width <= 0) || (width > TEXTSCREEN_MAXSIZE) || (height <= 0) || (height > TEXTSCREEN_MAXSIZE))
+        return NULL;
+    mem = (TextScreenMemoryBackend *)malloc(sizeof(TextScreenMemoryBackend));
+    if (!mem) return NULL;
+    mem->backend.userdata = (void *)mem;
+    mem->backend.write    = TextScreen_MemoryWrite;
+    mem->backend.flush    = TextScreen_MemoryFlush;
+    mem->backend.getSize  = TextScreen_MemoryGetSize;
+    mem->width    = width;
+    mem->height   = height;
+    mem->keepData = keepData;
+    mem->data     = NULL;
+    mem->size     = 0;
+    mem->bytes    = 0;
+    mem->frames   = 0;
+    return &mem->backend;
+}
+
+TextScreenBackend *TextScreen_CreateVtBackend(int width, int height)
+{
+    TextScreenVtBackend *vt;
+    
+    if ((width <= 0) || (width > TEXTSCREEN_MAXSIZE) || (height <= 0) || (height > TEXTSCREEN_MAXSIZE))
+        return NULL;
+    vt = (TextScreenVtBackend *)calloc(1, sizeof(TextScreenVtBackend));
+    if (!vt) return NULL;
+    vt->cell = (unsigned int *)malloc(sizeof(unsigned int) * width * height);
+    vt->attr = (unsigned short *)malloc(sizeof(unsigned short) * width * height);
+    if (!vt->cell || !vt->attr) {
+        free(vt->cell);
+        free(vt->attr);
+        free(vt);
+        return NULL;
+    }
+    vt->backend.userdata = (void *)vt;
+    vt->backend.write    = TextScreen_VtWrite;
+    vt->backend.flush    = TextScreen_VtFlush;
+    vt->backend.getSize  = TextScreen_VtGetSize;
+    vt->width  = width;
+    vt->height = height;
+    TextScreen_VtReset(vt);
+    return &vt->backend;
+}
+
+void TextScreen_FreeBackend(TextScreenBackend *backend)
+{
+    if (!backend) return;
+    if (backend->write == TextScreen_MemoryWrite) {
+        TextScreenMemoryBackend *mem = (TextScreenMemoryBackend *)backend->userdata;
+        
+        if (mem->data) free(mem->data);
+    }
+    if (backend->write == TextScreen_VtWrite) {
+        TextScreenVtBackend *vt = (TextScreenVtBackend *)backend->userdata;
+        
+        free(vt->cell);
+        free(vt->attr);
+    }
+    free(backend);
+}
+
+int TextScreen_GetMemoryBackendData(TextScreenBackend *backend, const char **data, long *bytes, long *frames)
+{
+    TextScreenMemoryBackend *mem;
+    
+    if (!backend || (backend->write != TextScreen_MemoryWrite)) return -1;
+    mem = (TextScreenMemoryBackend *)backend->userdata;
+    if (data)   *data   = mem->keepData ? mem->data : NULL;
+    if (bytes)  *bytes  = mem->bytes;
+    if (frames) *frames = mem->frames;
+    return 0;
+}
+
+void TextScreen_ClearMemoryBackend(TextScreenBackend *backend)
+{
+    TextScreenMemoryBackend *mem;
+    
+    if (!backend || (backend->write != TextScreen_MemoryWrite)) return;
+    mem = (TextScreenMemoryBackend *)backend->userdata;
+    mem->bytes  = 0;
+    mem->frames = 0;
+}
+
+int TextScreen_GetVtCell(TextScreenBackend *backend, int x, int y, unsigned int *code, unsigned short *attr)
+{
+    TextScreenVtBackend *vt;
+    long i;
+    
+    if (!backend || (backend->write != TextScreen_VtWrite)) return -1;
+    vt = (TextScreenVtBackend *)backend->userdata;
+    if ((x < 0) || (x >= vt->width) || (y < 0) || (y >= vt->height)) return -1;
+    i = (long)y * vt->width + x;
+    if (code) *code = (vt->cell[i] == TEXTSCREEN_CODE_RIGHT) ? 0 : vt->cell[i];
+    if (attr) *attr = vt->attr[i];
+    return 0;
+}
+
+int TextScreen_GetVtCursor(TextScreenBackend *backend, int *x, int *y, int *visible)
+{
+    TextScreenVtBackend *vt;
+    
+    if (!backend || (backend->write != TextScreen_VtWrite)) return -1;
+    vt = (TextScreenVtBackend *)backend->userdata;
+    if (x)       *x       = vt->x;
+    if (y)       *y       = vt->y;
+    if (visible) *visible = vt->cursorVisible;
+    return 0;
+}
+
+int TextScreen_GetVtStats(TextScreenBackend *backend, TextScreenVtStats *frame, TextScreenVtStats *total)
+{
+    TextScreenVtBackend *vt;
+    
+    if (!backend || (backend->write != TextScreen_VtWrite)) return -1;
+    vt = (TextScreenVtBackend *)backend->userdata;
+    if (frame) *frame = vt->frame;
+    if (total) *total = vt->total;
+    return 0;
+}
+
+int TextScreen_CompareVtScreen(TextScreenBackend *backend, TextScreenBitmap *bitmap, int dx, int dy)
+{
+    const char *translate = gSetting.translate ? gSetting.translate : (const char *)gTranslateTable;
+    TextScreenVtBackend *vt;
+    char           *str;
+    unsigned short *attr;
+    unsigned int   *code, expect;
+    unsigned short  mask;
+    int  width = gSetting.width;
+    int  x, y, cx, cy, diff;
+    long i;
+    
+    if (!backend || (backend->write != TextScreen_VtWrite) || !bitmap || (width <= 0)) return -1;
+    TextScreen_UpdateTranslate();
+    vt   = (TextScreenVtBackend *)backend->userdata;
+    str  = (char *)malloc(width);
+    attr = (unsigned short *)malloc(sizeof(unsigned short) * width);
+    code = (unsigned int *)malloc(sizeof(unsigned int) * width);
+    if (!str || !attr || !code) {
+        free(str);
+        free(attr);
+        free(code);
+        return -1;
+    }
+    // expected row is made same as renderer (position of bitmap(0,0) = console(dx,dy))
+    dx = -dx;
+    dy = -dy;
+    diff = 0;
+    for (y = 0; y < gSetting.height; y++) {
+        cy = gSetting.topMargin + y;
+        if ((cy < 0) || (cy >= vt->height)) continue;
+        TextScreen_ClipRow(str, width, bitmap, dx, y + dy, translate);
+        TextScreen_ClipAttrRow(attr, width, bitmap, dx, y + dy);
+        if (TextScreen_ClipCodeRow(code, width, bitmap, dx, y + dy, 0))
+            TextScreen_FixCodeRow(str, attr, code, width);
+        for (x = 0; x < width; x++) {
+            cx = gSetting.leftMargin + x;
+            if ((cx < 0) || (cx >= vt->width)) continue;
+            i = (long)cy * vt->width + cx;
+            expect = code[x] ? code[x] : (unsigned char)str[x];
+            // space may be erased by renderer (ECH): only background and underline are kept (fg and bold are not seen)
+            mask = (expect == ' ') ? (TEXTSCREEN_ATTR(0, 0x1f) | TEXTSCREEN_ATTR_UNDERLINE) : 0xffff;
+            if ((vt->cell[i] != expect) || ((vt->attr[i] ^ attr[x]) & mask))
+                diff++;
+        }
+    }
+    free(str);
+    free(attr);
+    free(code);
+    return diff;
+}
+
+/********************************
+ Compositor
+ ********************************/
+
+#define TEXTSCREEN_DAMAGE_MAX 16
+
+struct CompositorLayer {
+    TextScreenBitmap *bitmap;  // NULL: removed layer
+    int x, y, z;
+    int transparent;
+    int visible;
+    int serial;                // added order
+    int rect[4];               // area of layer at last change (x, y, width, height)
+};
+
+struct TextScreenCompositor {
+    TextScreenBitmap       *output;
+    struct CompositorLayer *layer;
+    int                     layerSize;
+    int                    *order;       // layer index sorted by z (same z: added order)
+    int                     orderNum;
+    int                     serial;      // serial number of next added layer
+    int                     orderValid;  // 0: sort order before next compose
+    int                     damage[TEXTSCREEN_DAMAGE_MAX][4];  // damage rectangles (x0, y0, x1, y1)
+    int                     damageNum;
+};
+
+// check layer id,  return layer or NULL
+static struct CompositorLayer *TextScreen_GetLayer(TextScreenCompositor *comp, int layer)
+{
+    if (!comp || (layer < 0) || (layer >= comp->layerSize) || !comp->layer[layer].bitmap) return NULL;
+    return &comp->layer[layer];
+}
+
+TextScreenCompositor *TextScreen_CreateCompositor(int width, int height)
+{
+    TextScreenCompositor *comp;
+    
+    comp = (TextScreenCompositor *)malloc(sizeof(TextScreenCompositor));
+    if (!comp) return NULL;
+    comp->output = TextScreen_CreateBitmap(width, height);
+    if (!comp->output) {
+        free(comp);
+        return NULL;
+    }
+    comp->layer      = NULL;
+    comp->layerSize  = 0;
+    comp->order      = NULL;
+    comp->orderNum   = 0;
+    comp->orderValid = 0;
+    comp->serial     = 0;
+    comp->damageNum  = 0;
+    TextScreen_DamageRect(comp, 0, 0, comp->output->width, comp->output->height);
+    return comp;
+}
+
+void TextScreen_FreeCompositor(TextScreenCompositor *comp)
+{
+    if (!comp) return;
+    TextScreen_FreeBitmap(comp->output);
+    if (comp->layer) free(comp->layer);
+    if (comp->order) free(comp->order);
+    free(comp);
+}
+
+void TextScreen_DamageRect(TextScreenCompositor *comp, int x, int y, int w, int h)
+{
+    int x0, y0, x1, y1;
+    int i, best, cost, bestcost;
+    int *d;
+    
+    if (!comp) return;
+    // clip to output
+    x0 = (x < 0) ? 0 : x;
+    y0 = (y < 0) ? 0 : y;
+    x1 = (x + w > comp->output->width)  ? comp->output->width  : x + w;
+    y1 = (y + h > comp->output->height) ? comp->output->height : y + h;
+    if ((x0 >= x1) || (y0 >= y1)) return;
+    
+    // merge with overlapping or touching rectangle (merged rectangle may touch others: check again)
+    i = 0;
+    while (i < comp->damageNum) {
+        d = comp->damage[i];
+        if ((x0 > d[2]) || (x1 < d[0]) || (y0 > d[3]) || (y1 < d[1])) {
+            i++;
+            continue;
+        }
+        if (x0 > d[0]) x0 = d[0];
+        if (y0 > d[1]) y0 = d[1];
+        if (x1 < d[2]) x1 = d[2];
+        if (y1 < d[3]) y1 = d[3];
+        comp->damageNum--;
+        memcpy(d, comp->damage[comp->damageNum], sizeof(comp->damage[0]));
+        i = 0;
+    }
+    if (comp->damageNum == TEXTSCREEN_DAMAGE_MAX) {
+        // no space: merge with rectangle of least area increase
+        best = 0;
+        bestcost = -1;
+        for (i = 0; i < comp->damageNum; i++) {
+            d = comp->damage[i];
+            cost = (((x1 > d[2]) ? x1 : d[2]) - ((x0 < d[0]) ? x0 : d[0])) * 
+                   (((y1 > d[3]) ? y1 : d[3]) - ((y0 < d[1]) ? y0 : d[1])) - 
+                   (d[2] - d[0]) * (d[3] - d[1]);
+            if ((bestcost < 0) || (cost < bestcost)) {
+                best = i;
+                bestcost = cost;
+            }
+        }
+        d = comp->damage[best];
+        if (x0 > d[0]) x0 = d[0];
+        if (y0 > d[1]) y0 = d[1];
+        if (x1 < d[2]) x1 = d[2];
+        if (y1 < d[3]) y1 = d[3];
+        comp->damageNum--;
+        memcpy(d, comp->damage[comp->damageNum], sizeof(comp->damage[0]));
+        TextScreen_DamageRect(comp, x0, y0, x1 - x0, y1 - y0);
+        return;
+    }
+    d = comp->damage[comp->damageNum++];
+    d[0] = x0;
+    d[1] = y0;
+    d[2] = x1;
+    d[3] = y1;
+}
+
+// damage area of layer at last change and current area (then current area is kept)
+static void TextScreen_DamageLayerArea(TextScreenCompositor *comp, struct CompositorLayer *lp)
+{
+    TextScreen_DamageRect(comp, lp->rect[0], lp->rect[1], lp->rect[2], lp->rect[3]);
+    lp->rect[0] = lp->x;
+    lp->rect[1] = lp->y;
+    lp->rect[2] = lp->bitmap->width;
+    lp->rect[3] = lp->bitmap->height;
+    TextScreen_DamageRect(comp, lp->rect[0], lp->rect[1], lp->rect[2], lp->rect[3]);
+}
+
+int TextScreen_AddLayer(TextScreenCompositor *comp, TextScreenBitmap *bitmap, int x, int y, int z, int transparent)
+{
+    struct CompositorLayer *layer, *lp;
+    int *order;
+    int  i;
+    
+    if (!comp || !bitmap) return -1;
+    for (i = 0; i < comp->layerSize; i++) {
+        if (!comp->layer[i].bitmap) break;
+    }
+    if (i == comp->layerSize) {
+        layer = (struct CompositorLayer *)realloc(comp->layer, sizeof(struct CompositorLayer) * (i + 1));
+        if (!layer) return -1;
+        comp->layer = layer;
+        order = (int *)realloc(comp->order, sizeof(int) * (i + 1));
+        if (!order) return -1;
+        comp->order = order;
+        comp->layerSize = i + 1;
+    }
+    lp = &comp->layer[i];
+    lp->bitmap      = bitmap;
+    lp->x           = x;
+    lp->y           = y;
+    lp->z           = z;
+    lp->transparent = transparent;
+    lp->visible     = 1;
+    lp->serial      = comp->serial++;
+    lp->rect[0]     = x;
+    lp->rect[1]     = y;
+    lp->rect[2]     = 0;
+    lp->rect[3]     = 0;
+    TextScreen_DamageLayerArea(comp, lp);
+    comp->orderValid = 0;
+    return i;
+}
+
+void TextScreen_RemoveLayer(TextScreenCompositor *comp, int layer)
+{
+    struct CompositorLayer *lp = TextScreen_GetLayer(comp, layer);
+    
+    if (!lp) return;
+    TextScreen_DamageRect(comp, lp->rect[0], lp->rect[1], lp->rect[2], lp->rect[3]);
+    lp->bitmap = NULL;
+    comp->orderValid = 0;
+}
+
+void TextScreen_MoveLayer(TextScreenCompositor *comp, int layer, int x, int y)
+{
+    struct CompositorLayer *lp = TextScreen_GetLayer(comp, layer);
+    
+    if (!lp || ((lp->x == x) && (lp->y == y))) return;
+    lp->x = x;
+    lp->y = y;
+    if (lp->visible)
+        TextScreen_DamageLayerArea(comp, lp);
+}
+
+void TextScreen_SetLayerZ(TextScreenCompositor *comp, int layer, int z)
+{
+    struct CompositorLayer *lp = TextScreen_GetLayer(comp, layer);
+    
+    if (!lp || (lp->z == z)) return;
+    lp->z = z;
+    comp->orderValid = 0;
+    if (lp->visible)
+        TextScreen_DamageLayerArea(comp, lp);
+}
+
+void TextScreen_SetLayerVisible(TextScreenCompositor *comp, int layer, int visible)
+{
+    struct CompositorLayer *lp = TextScreen_GetLayer(comp, layer);
+    
+    if (!lp || (lp->visible == (visible != 0))) return;
+    lp->visible = (visible != 0);
+    TextScreen_DamageLayerArea(comp, lp);
+}
+
+void TextScreen_DamageLayer(TextScreenCompositor *comp, int layer, int x, int y, int w, int h)
+{
+    struct CompositorLayer *lp = TextScreen_GetLayer(comp, layer);
+    
+    if (!lp || !lp->visible) return;
+    if ((w <= 0) || (h <= 0) || 
+            (lp->rect[2] != lp->bitmap->width) || (lp->rect[3] != lp->bitmap->height)) {
+        TextScreen_DamageLayerArea(comp, lp);
+    } else {
+        TextScreen_DamageRect(comp, lp->x + x, lp->y + y, w, h);
+    }
+}
+
+// composite layers in area (x0, y0)-(x1, y1) of output
+static void TextScreen_ComposeArea(TextScreenCompositor *comp, int x0, int y0, int x1, int y1)
+{
+    TextScreenBitmap *out = comp->output, *src;
+    struct CompositorLayer *lp;
+    int  i, x, y, lx0, ly0, lx1, ly1;
+    int  dst, pos;
+    
+    for (y = y0; y < y1; y++) {
+        memset(out->data + y * out->width + x0, gSetting.space, x1 - x0);
+        if (out->attr)
+            memset(out->attr + y * out->width + x0, 0, sizeof(unsigned short) * (x1 - x0));
+        if (out->code)
+            memset(out->code + y * out->width + x0, 0, sizeof(unsigned int) * (x1 - x0));
+    }
+    for (i = 0; i < comp->orderNum; i++) {
+        lp  = &comp->layer[comp->order[i]];
+        src = lp->bitmap;
+        if (!lp->visible) continue;
+        lx0 = (lp->x > x0) ? lp->x : x0;
+        ly0 = (lp->y > y0) ? lp->y : y0;
+        lx1 = (lp->x + src->width  < x1) ? lp->x + src->width  : x1;
+        ly1 = (lp->y + src->height < y1) ? lp->y + src->height : y1;
+        if ((lx0 >= lx1) || (ly0 >= ly1)) continue;
+        for (y = ly0; y < ly1; y++) {
+            dst = y * out->width;
+            pos = (y - lp->y) * src->width - lp->x;
+            if (!lp->transparent) {
+                memcpy(out->data + dst + lx0, src->data + pos + lx0, lx1 - lx0);
+                if (out->attr) {
+                    if (src->attr)
+                        memcpy(out->attr + dst + lx0, src->attr + pos + lx0, sizeof(unsigned short) * (lx1 - lx0));
+                    else
+                        memset(out->attr + dst + lx0, 0, sizeof(unsigned short) * (lx1 - lx0));
+                }
+                if (out->code) {
+                    if (src->code)
+                        memcpy(out->code + dst + lx0, src->code + pos + lx0, sizeof(unsigned int) * (lx1 - lx0));
+                    else
+                        memset(out->code + dst + lx0, 0, sizeof(unsigned int) * (lx1 - lx0));
+                }
+                continue;
+            }
+            for (x = lx0; x < lx1; x++) {
+                if (src->data[pos + x] == gSetting.space) continue;
+                out->data[dst + x] = src->data[pos + x];
+                if (out->attr)
+                    out->attr[dst + x] = src->attr ? src->attr[pos + x] : 0;
+                if (out->code)
+                    out->code[dst + x] = src->code ? src->code[pos + x] : 0;
+            }
+        }
     }
 }
 
-void TextScreen_DrawFillRect(TextScreenBitmap *bitmap, int x, int y, int w, int h, char ch)
+TextScreenBitmap *TextScreen_ComposeLayers(TextScreenCompositor *comp)
 {
-    int xmin, xmax, ymin, ymax;
-    int xc, yc;
+    struct CompositorLayer *lp;
+    int  i, j, k;
     
-    if (!bitmap) return;
-    xmin = x;
-    xmax = x + w;
-    ymin = y;
-    ymax = y + h;
+    if (!comp) return NULL;
+    // output has attribute or code point plane if any layer has it
+    for (i = 0; i < comp->layerSize; i++) {
+        lp = &comp->layer[i];
+        if (!lp->bitmap) continue;
+        if ((lp->bitmap->attr && !comp->output->attr) || (lp->bitmap->code && !comp->output->code)) {
+            if (lp->bitmap->attr && TextScreen_CreateAttrPlane(comp->output)) return NULL;
+            if (lp->bitmap->code && TextScreen_CreateCodePlane(comp->output)) return NULL;
+            TextScreen_DamageRect(comp, 0, 0, comp->output->width, comp->output->height);
+        }
+    }
+    if (!comp->orderValid) {
+        // insertion sort by z and added order
+        comp->orderNum = 0;
+        for (i = 0; i < comp->layerSize; i++) {
+            lp = &comp->layer[i];
+            if (!lp->bitmap) continue;
+            for (j = comp->orderNum; j > 0; j--) {
+                if ((comp->layer[comp->order[j - 1]].z < lp->z) || 
+                    ((comp->layer[comp->order[j - 1]].z == lp->z) && (comp->layer[comp->order[j - 1]].serial < lp->serial)))
+                    break;
+                comp->order[j] = comp->order[j - 1];
+            }
+            comp->order[j] = i;
+            comp->orderNum++;
+        }
+        comp->orderValid = 1;
+    }
+    for (k = 0; k < comp->damageNum; k++) {
+        TextScreen_ComposeArea(comp, comp->damage[k][0], comp->damage[k][1], comp->damage[k][2], comp->damage[k][3]);
+    }
+    comp->damageNum = 0;
+    return comp->output;
+}
+
+/********************************
+ Frame Recording
+ ********************************/
+
+// capture file (numbers are unsigned LEB128: 7 bits per byte, low bits first, except noted)
+//   header : "TXSCAP01", start time (unix time in sec, 8 bytes little endian)
+//   frame  : 'F', time (usec from last frame), flags (1 byte, TEXTSCREEN_CAPTURE_*),
+//            [width, height (keyframe)], spans, 0 (end of spans)
+//   span   : length, skip (cells from end of last span), characters, [attributes (2 bytes little endian each)],
+//            [code points of TEXTSCREEN_CHAR_CODE cells]
+//   index  : 'I', number of frames, time of last frame (usec), number of keyframes,
+//            keyframes: time, position in file, frame number (difference from last keyframe each)
+//   footer : position of index (8 bytes little endian), "TXSCIDX1"
+// cells are numbered row by row from left-top of screen. keyframe has all cells of screen
+// index and footer are written by TextScreen_StopRecording() (index is made by scan of frames without it)
+#define TEXTSCREEN_CAPTURE_MAGIC     "TXSCAP01"
+#define TEXTSCREEN_CAPTURE_FOOTER_MAGIC  "TXSCIDX1"
+#define TEXTSCREEN_CAPTURE_FOOTER    16
+#define TEXTSCREEN_CAPTURE_HEADER    16
+#define TEXTSCREEN_CAPTURE_KEYFRAME  0x01  // all cells (size or planes are changed)
+#define TEXTSCREEN_CAPTURE_ATTR      0x02  // screen has attribute plane
+#define TEXTSCREEN_CAPTURE_CODE      0x04  // screen has code point plane
+// default keyframe interval (frames)
+#define TEXTSCREEN_CAPTURE_INTERVAL  300
+// unchanged cells fewer than this between changed cells are written in same span
+#define TEXTSCREEN_CAPTURE_GAP       4
+// max bytes of one cell (character, attribute, code point) and one span header
+#define TEXTSCREEN_CAPTURE_CELL_MAXLEN  8
+#define TEXTSCREEN_CAPTURE_SPAN_MAXLEN  10
+// max bytes of frame of screen (cells)
+#define TEXTSCREEN_CAPTURE_FRAME_MAXLEN(cells)  (32 + (cells) * (TEXTSCREEN_CAPTURE_CELL_MAXLEN + TEXTSCREEN_CAPTURE_SPAN_MAXLEN))
+
+static FILE              *gRecordFile     = NULL;
+static int                gRecordError    = 0;     // 1: write error while recording
+static int                gRecordInterval = TEXTSCREEN_CAPTURE_INTERVAL;
+static long               gRecordFrames   = 0;
+static double             gRecordStart    = 0;     // time of start (TextScreen_GetTime())
+static unsigned long long gRecordTime     = 0;     // time of last frame (usec from start)
+static TextScreenBitmap  *gRecordPrev     = NULL;  // screen of last frame
+static TextScreenBitmap  *gRecordCur      = NULL;
+static unsigned char     *gRecordBuf      = NULL;  // keep and reuse. grow only
+static long               gRecordBufSize  = 0;
+static long long          gRecordPos      = 0;     // file position of next frame
+// keyframes of index (encoded as file), and last keyframe
+static unsigned char     *gRecordIndex     = NULL;
+static long               gRecordIndexSize = 0;
+static long               gRecordIndexLen  = 0;
+static long               gRecordKeyNum    = 0;
+static unsigned long long gRecordKeyTime   = 0;
+static long long          gRecordKeyPos    = 0;
+static long               gRecordKeyFrame  = 0;
+
+// seek point of capture
+struct CaptureIndex {
+    unsigned long long time;   // time of frame (usec)
+    long               pos;    // position of frame (snap = NULL: keyframe) or next frame (snap != NULL)
+    long               frame;  // frame number
+    TextScreenBitmap  *snap;   // decoded screen of frame (made by scan when keyframes are sparse)
+};
+
+struct TextScreenCapture {
+    unsigned char     *data;    // whole capture file (memory mapped or read)
+    long               size;
+    int                mapped;
+    long               pos;     // position of next frame
+    long long          start;   // start time of recording (unix time)
+    unsigned long long time;    // time of last read frame (usec from start)
+    long               frames;  // number of read frames
+    TextScreenBitmap  *frame;   // screen of last read frame
+    struct CaptureIndex *index;
+    long               indexNum;
+    long               frameNum;  // number of frames in capture
+    long               end;       // end of frames
+    unsigned long long duration;  // time of last frame (usec)
+    int                sock;      // socket of broadcast (TextScreen_ConnectBroadcast), -1: capture file
+    long               received;  // received bytes in data (broadcast)
+};
+
+// put n as LEB128 to buf,  return length
+static int TextScreen_PutVarint(unsigned char *buf, unsigned long long n)
+{
+    int len = 0;
     
-    if (xmin < 0) xmin = 0;
-    if (xmax > bitmap->width) xmax = bitmap->width;
-    if (ymin < 0) ymin = 0;
-    if (ymax > bitmap->height) ymax = bitmap->height;
+    while (n >= 0x80) {
+        buf[len++] = (unsigned char)(n | 0x80);
+        n >>= 7;
+    }
+    buf[len++] = (unsigned char)n;
+    return len;
+}
+
+// get LEB128 at buf[*pos] (buf is size bytes) to *n, and advance *pos,  return 0:successful  -1:error
+static int TextScreen_GetVarint(const unsigned char *buf, long size, long *pos, unsigned long long *n)
+{
+    int shift;
     
-    for (yc = ymin; yc < ymax; yc++) {
-        for (xc = xmin; xc < xmax; xc++) {
-            TextScreen_PutCell(bitmap, xc, yc, ch);
+    *n = 0;
+    for (shift = 0; (*pos < size) && (shift < 64); shift += 7) {
+        unsigned char b = buf[(*pos)++];
+        
+        *n |= (unsigned long long)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+// put span of cells [start, end) of screen to buf (*last: end of last span),  return length
+static long TextScreen_PutCaptureSpan(unsigned char *buf, const TextScreenBitmap *screen, long start, long end, long *last)
+{
+    long index, i;
+    
+    index  = TextScreen_PutVarint(buf, end - start);
+    index += TextScreen_PutVarint(buf + index, start - *last);
+    memcpy(buf + index, screen->data + start, end - start);
+    index += end - start;
+    if (screen->attr) {
+        for (i = start; i < end; i++) {
+            buf[index++] = (unsigned char)screen->attr[i];
+            buf[index++] = (unsigned char)(screen->attr[i] >> 8);
         }
     }
+    if (screen->code) {
+        for (i = start; i < end; i++) {
+            if (screen->data[i] == TEXTSCREEN_CHAR_CODE)
+                index += TextScreen_PutVarint(buf + index, screen->code[i]);
+        }
+    }
+    *last = end;
+    return index;
 }
 
-void TextScreen_DrawRect(TextScreenBitmap *bitmap, int x, int y, int w, int h, char ch, int mode)
+// add keyframe (frame gRecordFrames at gRecordPos) to index
+static void TextScreen_RecordKeyframe(unsigned long long time)
 {
-    int xc, yc;
+    unsigned char *buf;
     
-    if (!bitmap) return;
-    if (mode == 1) {
-        TextScreen_DrawFillRect(bitmap, x, y, w, h, ch);
-        return;
+    if (gRecordIndexLen + 32 > gRecordIndexSize) {
+        buf = (unsigned char *)realloc(gRecordIndex, gRecordIndexSize + 4096);
+        if (!buf) {
+            gRecordError = 1;
+            return;
+        }
+        gRecordIndex = buf;
+        gRecordIndexSize += 4096;
     }
-    if (mode == 2) {
-        TextScreen_DrawFillRect(bitmap, x+1, y+1, w-2, h-2, gSetting.space); 
+    buf = gRecordIndex + gRecordIndexLen;
+    gRecordIndexLen += TextScreen_PutVarint(buf, time - gRecordKeyTime);
+    gRecordIndexLen += TextScreen_PutVarint(gRecordIndex + gRecordIndexLen, gRecordPos - gRecordKeyPos);
+    gRecordIndexLen += TextScreen_PutVarint(gRecordIndex + gRecordIndexLen, gRecordFrames - gRecordKeyFrame);
+    gRecordKeyTime  = time;
+    gRecordKeyPos   = gRecordPos;
+    gRecordKeyFrame = gRecordFrames;
+    gRecordKeyNum++;
+}
+
+// keyframe is needed after last frame prev (NULL: no last frame) for cur
+static int TextScreen_NeedKeyframe(const TextScreenBitmap *cur, const TextScreenBitmap *prev)
+{
+    return !prev || (prev->width != cur->width) || (prev->height != cur->height) || 
+           (!prev->attr != !cur->attr) || (!prev->code != !cur->code);
+}
+
+// encode screen cur as frame to buf (keyframe = 0: difference from prev, time: usec from last frame)
+// buf needs TEXTSCREEN_CAPTURE_FRAME_MAXLEN(cells) bytes,  return length
+static long TextScreen_EncodeCaptureFrame(unsigned char *buf, const TextScreenBitmap *cur, const TextScreenBitmap *prev, 
+                                          unsigned long long time, int keyframe)
+{
+    long  index, size, start, end, last, i;
+    int   flags, width, y, x;
+    
+    width = cur->width;
+    size  = (long)cur->width * cur->height;
+    flags = (cur->attr ? TEXTSCREEN_CAPTURE_ATTR : 0) | (cur->code ? TEXTSCREEN_CAPTURE_CODE : 0);
+    if (keyframe)
+        flags |= TEXTSCREEN_CAPTURE_KEYFRAME;
+    index = 0;
+    buf[index++] = 'F';
+    index += TextScreen_PutVarint(buf + index, time);
+    buf[index++] = (unsigned char)flags;
+    last = 0;
+    if (flags & TEXTSCREEN_CAPTURE_KEYFRAME) {
+        index += TextScreen_PutVarint(buf + index, cur->width);
+        index += TextScreen_PutVarint(buf + index, cur->height);
+        if (size > 0)
+            index += TextScreen_PutCaptureSpan(buf + index, cur, 0, size, &last);
+    } else {
+        // spans of changed cells (short run of unchanged cells is included)
+        start = -1;
+        end   = 0;
+        for (y = 0; y < cur->height; y++) {
+            i = (long)y * width;
+            if (!memcmp(cur->data + i, prev->data + i, width) && 
+                (!cur->attr || !memcmp(cur->attr + i, prev->attr + i, sizeof(unsigned short) * width)) &&
+                (!cur->code || !memcmp(cur->code + i, prev->code + i, sizeof(unsigned int) * width)))
+                continue;
+            for (x = 0; x < width; x++, i++) {
+                if ((cur->data[i] == prev->data[i]) && (!cur->attr || (cur->attr[i] == prev->attr[i])) &&
+                    (!cur->code || (cur->data[i] != TEXTSCREEN_CHAR_CODE) || (cur->code[i] == prev->code[i])))
+                    continue;
+                if ((start >= 0) && (i - end < TEXTSCREEN_CAPTURE_GAP)) {
+                    end = i + 1;
+                    continue;
+                }
+                if (start >= 0)
+                    index += TextScreen_PutCaptureSpan(buf + index, cur, start, end, &last);
+                start = i;
+                end   = i + 1;
+            }
+        }
+        if (start >= 0)
+            index += TextScreen_PutCaptureSpan(buf + index, cur, start, end, &last);
     }
+    buf[index++] = 0;
+    return index;
+}
+
+static int TextScreen_IsRecording(void)
+{
+    return gRecordFile && !gRecordError;
+}
+
+static void TextScreen_RecordFrame(TextScreenBitmap *bitmap, int dx, int dy)
+{
+    TextScreenBitmap *cur, *prev;
+    unsigned char *buf;
+    unsigned long long now;
+    long  index, need;
+    int   keyframe;
     
-    for (xc = x; xc < x + w; xc++) {
-        TextScreen_PutCell(bitmap, xc, y        , ch);
-        TextScreen_PutCell(bitmap, xc, y + h - 1, ch);
+    if (!gRecordFile || gRecordError) return;
+    if (TextScreen_SnapshotBitmap(&gRecordCur, bitmap, dx, dy)) {
+        gRecordError = 1;
+        return;
     }
-    for (yc = y; yc < y + h; yc++) {
-        TextScreen_PutCell(bitmap, x        , yc, ch);
-        TextScreen_PutCell(bitmap, x + w - 1, yc, ch);
+    cur  = gRecordCur;
+    prev = gRecordPrev;
+    need = TEXTSCREEN_CAPTURE_FRAME_MAXLEN((long)cur->width * cur->height);
+    if (need > gRecordBufSize) {
+        buf = (unsigned char *)realloc(gRecordBuf, need);
+        if (!buf) {
+            gRecordError = 1;
+            return;
+        }
+        gRecordBuf = buf;
+        gRecordBufSize = need;
     }
+    buf = gRecordBuf;
+    
+    keyframe = TextScreen_NeedKeyframe(cur, prev) || !(gRecordFrames % gRecordInterval);
+    now = (unsigned long long)((TextScreen_GetTime() - gRecordStart) * 1e6);
+    if (now < gRecordTime)
+        now = gRecordTime;
+    index = TextScreen_EncodeCaptureFrame(buf, cur, prev, now - gRecordTime, keyframe);
+    if (fwrite(buf, 1, index, gRecordFile) != (size_t)index)
+        gRecordError = 1;
+    if (keyframe)
+        TextScreen_RecordKeyframe(now);
+    gRecordPos  += index;
+    gRecordTime  = now;
+    gRecordPrev  = cur;
+    gRecordCur   = prev;
+    gRecordFrames++;
 }
 
-void TextScreen_DrawFillRectP(TextScreenBitmap *bitmap, int x, int y, int x1, int y1, char ch)
+int TextScreen_StartRecording(const char *path, int keyframeInterval)
 {
-    TextScreen_DrawRectP(bitmap, x, y, x1, y1, ch, 1);
+    unsigned char header[TEXTSCREEN_CAPTURE_HEADER];
+    unsigned long long now;
+    int i;
+    
+    TextScreen_StopRecording();
+    if (!path) return -1;
+    gRecordFile = fopen(path, "wb");
+    if (!gRecordFile) return -1;
+    // frames are small: write by large block
+    setvbuf(gRecordFile, NULL, _IOFBF, 65536);
+    now = (unsigned long long)time(NULL);
+    memcpy(header, TEXTSCREEN_CAPTURE_MAGIC, 8);
+    for (i = 0; i < 8; i++)
+        header[8 + i] = (unsigned char)(now >> (i * 8));
+    gRecordError    = (fwrite(header, 1, sizeof(header), gRecordFile) != sizeof(header));
+    gRecordInterval = (keyframeInterval > 0) ? keyframeInterval : TEXTSCREEN_CAPTURE_INTERVAL;
+    gRecordFrames   = 0;
+    gRecordStart    = TextScreen_GetTime();
+    gRecordTime     = 0;
+    gRecordPos      = TEXTSCREEN_CAPTURE_HEADER;
+    gRecordIndexLen = 0;
+    gRecordKeyNum   = 0;
+    gRecordKeyTime  = 0;
+    gRecordKeyPos   = 0;
+    gRecordKeyFrame = 0;
+    return gRecordError ? -1 : 0;
 }
 
-void TextScreen_DrawRectP(TextScreenBitmap *bitmap, int x, int y, int x1, int y1, char ch, int mode)
+int TextScreen_StopRecording(void)
 {
-    int xs, ys, w, h;
+    int ret;
     
-    if (x <= x1) {
-        xs = x;
-        w  = x1 - x + 1;
-    } else {
-        xs = x1;
-        w  = x - x1 + 1;
+    if (!gRecordFile) return 0;
+    if (!gRecordError) {
+        // index and footer
+        unsigned char buf[64];
+        int len, i;
+        
+        buf[0] = 'I';
+        len  = 1 + TextScreen_PutVarint(buf + 1, gRecordFrames);
+        len += TextScreen_PutVarint(buf + len, gRecordTime);
+        len += TextScreen_PutVarint(buf + len, gRecordKeyNum);
+        if ((fwrite(buf, 1, len, gRecordFile) != (size_t)len) || 
+            (fwrite(gRecordIndex, 1, gRecordIndexLen, gRecordFile) != (size_t)gRecordIndexLen))
+            gRecordError = 1;
+        for (i = 0; i < 8; i++)
+            buf[i] = (unsigned char)((unsigned long long)gRecordPos >> (i * 8));
+        memcpy(buf + 8, TEXTSCREEN_CAPTURE_FOOTER_MAGIC, 8);
+        if (fwrite(buf, 1, TEXTSCREEN_CAPTURE_FOOTER, gRecordFile) != TEXTSCREEN_CAPTURE_FOOTER)
+            gRecordError = 1;
     }
-    if (y <= y1) {
-        ys = y;
-        h  = y1 - y + 1;
-    } else {
-        ys = y1;
-        h  = y - y1 + 1;
+    ret = gRecordError ? -1 : 0;
+    if (fclose(gRecordFile))
+        ret = -1;
+    gRecordFile = NULL;
+    TextScreen_FreeBitmap(gRecordPrev);
+    TextScreen_FreeBitmap(gRecordCur);
+    gRecordPrev = NULL;
+    gRecordCur  = NULL;
+    free(gRecordBuf);
+    gRecordBuf = NULL;
+    gRecordBufSize = 0;
+    free(gRecordIndex);
+    gRecordIndex = NULL;
+    gRecordIndexSize = 0;
+    return ret;
+}
+
+// decode frame at capture->pos to capture->frame,  return 1:successful  0:end of capture  -1:error
+static int TextScreen_DecodeCaptureFrame(TextScreenCapture *capture)
+{
+    const unsigned char *data = capture->data;
+    TextScreenBitmap *frame = capture->frame;
+    unsigned long long dt, w, h, len, skip, code;
+    long size = capture->end;
+    long pos  = capture->pos;
+    long cell, total, i;
+    int  flags;
+    
+    if ((pos >= size) || (data[pos] != 'F')) return 0;
+    pos++;
+    if (TextScreen_GetVarint(data, size, &pos, &dt) || (pos >= size)) return -1;
+    flags = data[pos++];
+    if (flags & TEXTSCREEN_CAPTURE_KEYFRAME) {
+        if (TextScreen_GetVarint(data, size, &pos, &w) || TextScreen_GetVarint(data, size, &pos, &h) ||
+            (w < 1) || (w > TEXTSCREEN_MAXSIZE) || (h < 1) || (h > TEXTSCREEN_MAXSIZE))
+            return -1;
+        if (!frame || (frame->width != (int)w) || (frame->height != (int)h)) {
+            TextScreen_FreeBitmap(frame);
+            frame = capture->frame = TextScreen_CreateBitmap((int)w, (int)h);
+            if (!frame) return -1;
+        }
+        if (!(flags & TEXTSCREEN_CAPTURE_ATTR)) {
+            TextScreen_FreeAttrPlane(frame);
+        } else if (!frame->attr && TextScreen_CreateAttrPlane(frame)) {
+            return -1;
+        }
+        if (!(flags & TEXTSCREEN_CAPTURE_CODE)) {
+            TextScreen_FreeCodePlane(frame);
+        } else if (!frame->code && TextScreen_CreateCodePlane(frame)) {
+            return -1;
+        }
+    } else if (!frame || (!(flags & TEXTSCREEN_CAPTURE_ATTR) != !frame->attr) || 
+               (!(flags & TEXTSCREEN_CAPTURE_CODE) != !frame->code)) {
+        return -1;
     }
-    TextScreen_DrawRect(bitmap, xs, ys, w, h, ch, mode);
+    total = (long)frame->width * frame->height;
+    cell  = 0;
+    for (;;) {
+        if (TextScreen_GetVarint(data, size, &pos, &len)) return -1;
+        if (!len) break;
+        if (TextScreen_GetVarint(data, size, &pos, &skip) || (skip > (unsigned long long)(total - cell)) ||
+            (len > (unsigned long long)(total - cell - (long)skip)) || (len > (unsigned long long)(size - pos)))
+            return -1;
+        cell += (long)skip;
+        memcpy(frame->data + cell, data + pos, (size_t)len);
+        pos += (long)len;
+        if (frame->attr) {
+            if (len * 2 > (unsigned long long)(size - pos)) return -1;
+            for (i = cell; i < cell + (long)len; i++, pos += 2)
+                frame->attr[i] = (unsigned short)(data[pos] | (data[pos + 1] << 8));
+        }
+        if (frame->code) {
+            for (i = cell; i < cell + (long)len; i++) {
+                code = 0;
+                if ((frame->data[i] == TEXTSCREEN_CHAR_CODE) && TextScreen_GetVarint(data, size, &pos, &code))
+                    return -1;
+                frame->code[i] = (unsigned int)code;
+            }
+        }
+        cell += (long)len;
+    }
+    capture->pos   = pos;
+    capture->time += dt;
+    capture->frames++;
+    return 1;
 }
 
-void TextScreen_DrawLine(TextScreenBitmap *bitmap, int x1, int y1, int x2, int y2, char ch)
+int TextScreen_ReadCapture(TextScreenCapture *capture, TextScreenBitmap **frame, double *time)
 {
-    int xd, yd;
-    int xda, yda;
-    int xn, yn;
-    int x, y;
+    int ret;
     
-    xd = x2 - x1;
-    yd = y2 - y1;
-    xda = (xd >= 0) ? xd : -xd;
-    yda = (yd >= 0) ? yd : -yd;
+    if (!capture) return -1;
+    ret = TextScreen_DecodeCaptureFrame(capture);
+    if (ret == 1) {
+        if (frame)
+            *frame = capture->frame;
+        if (time)
+            *time = capture->time * 1e-6;
+    }
+    return ret;
+}
+
+// get time (usec from last frame) and flags of frame at pos,  return 0:successful  -1:no frame
+static int TextScreen_PeekCaptureFrame(TextScreenCapture *capture, long pos, unsigned long long *dt, int *flags)
+{
+    if ((pos >= capture->end) || (capture->data[pos] != 'F')) return -1;
+    pos++;
+    if (TextScreen_GetVarint(capture->data, capture->end, &pos, dt) || (pos >= capture->end)) return -1;
+    *flags = capture->data[pos];
+    return 0;
+}
+
+// add seek point to index of capture,  return 0:successful  -1:error
+static int TextScreen_AddCaptureIndex(TextScreenCapture *capture, unsigned long long time, long pos, long frame, 
+                                      TextScreenBitmap *snap)
+{
+    struct CaptureIndex *index;
     
-    if (!bitmap) return;
-    if (!xd) {
-        if (yd >= 0) {
-            for (y = y1; y <= y2; y++)
-                TextScreen_PutCell(bitmap, x1, y, ch);
-        } else {
-            for (y = y1; y >= y2; y--)
-                TextScreen_PutCell(bitmap, x1, y, ch);
+    if (!(capture->indexNum & 255)) {
+        index = (struct CaptureIndex *)realloc(capture->index, sizeof(struct CaptureIndex) * (capture->indexNum + 256));
+        if (!index) return -1;
+        capture->index = index;
+    }
+    index = capture->index + capture->indexNum++;
+    index->time  = time;
+    index->pos   = pos;
+    index->frame = frame;
+    index->snap  = snap;
+    return 0;
+}
+
+// read index written by TextScreen_StopRecording(),  return 0:successful  -1:no index
+static int TextScreen_ReadCaptureIndex(TextScreenCapture *capture)
+{
+    const unsigned char *data = capture->data;
+    unsigned long long frames, duration, num, dt, dpos, dframe;
+    unsigned long long time = 0;
+    long long offset = 0;
+    long size = capture->size - TEXTSCREEN_CAPTURE_FOOTER;
+    long pos, keypos, keyframe, i;
+    
+    if ((size < TEXTSCREEN_CAPTURE_HEADER) || memcmp(data + size + 8, TEXTSCREEN_CAPTURE_FOOTER_MAGIC, 8)) return -1;
+    for (i = 0; i < 8; i++)
+        offset |= (long long)data[size + i] << (i * 8);
+    if ((offset < TEXTSCREEN_CAPTURE_HEADER) || (offset >= size) || (data[offset] != 'I')) return -1;
+    pos = (long)offset + 1;
+    if (TextScreen_GetVarint(data, size, &pos, &frames) || TextScreen_GetVarint(data, size, &pos, &duration) ||
+        TextScreen_GetVarint(data, size, &pos, &num))
+        return -1;
+    keypos   = 0;
+    keyframe = 0;
+    for (i = 0; i < (long)num; i++) {
+        if (TextScreen_GetVarint(data, size, &pos, &dt) || TextScreen_GetVarint(data, size, &pos, &dpos) ||
+            TextScreen_GetVarint(data, size, &pos, &dframe)) {
+            capture->indexNum = 0;
+            return -1;
+        }
+        time     += dt;
+        keypos   += (long)dpos;
+        keyframe += (long)dframe;
+        if ((keypos < TEXTSCREEN_CAPTURE_HEADER) || (keypos >= offset) || (data[keypos] != 'F') ||
+            TextScreen_AddCaptureIndex(capture, time, keypos, keyframe, NULL)) {
+            capture->indexNum = 0;
+            return -1;
         }
-        return;
     }
-    if (!yd) {
-        if (xd >= 0) {
-            for (x = x1; x <= x2; x++)
-                TextScreen_PutCell(bitmap, x, y1, ch);
-        } else {
-            for (x = x1; x >= x2; x--)
-                TextScreen_PutCell(bitmap, x, y1, ch);
+    capture->end      = (long)offset;
+    capture->frameNum = (long)frames;
+    capture->duration = duration;
+    return 0;
+}
+
+// make index by decoding all frames (capture without index: recording was not stopped)
+// seek points are keyframes, and decoded screen every TEXTSCREEN_CAPTURE_INTERVAL frames without keyframe
+static void TextScreen_ScanCapture(TextScreenCapture *capture)
+{
+    TextScreenBitmap *snap;
+    unsigned long long dt;
+    long pos, last;
+    int  flags;
+    
+    last = -TEXTSCREEN_CAPTURE_INTERVAL;
+    while (!TextScreen_PeekCaptureFrame(capture, capture->pos, &dt, &flags)) {
+        pos = capture->pos;
+        if (TextScreen_DecodeCaptureFrame(capture) != 1) break;
+        if (flags & TEXTSCREEN_CAPTURE_KEYFRAME) {
+            if (TextScreen_AddCaptureIndex(capture, capture->time, pos, capture->frames - 1, NULL)) break;
+            last = capture->frames - 1;
+        } else if (capture->frames - 1 - last >= TEXTSCREEN_CAPTURE_INTERVAL) {
+            snap = TextScreen_DupBitmap(capture->frame);
+            if (!snap) break;
+            if (TextScreen_AddCaptureIndex(capture, capture->time, capture->pos, capture->frames - 1, snap)) {
+                TextScreen_FreeBitmap(snap);
+                break;
+            }
+            last = capture->frames - 1;
         }
-        return;
     }
+    // broken frame at end (eg. process was killed while recording) is not used
+    capture->end      = capture->pos;
+    capture->frameNum = capture->frames;
+    capture->duration = capture->time;
+    capture->pos      = TEXTSCREEN_CAPTURE_HEADER;
+    capture->time     = 0;
+    capture->frames   = 0;
+}
+
+// map (or read) capture file to capture->data,  return 0:successful  -1:error
+static int TextScreen_LoadCaptureFile(TextScreenCapture *capture, const char *path)
+{
+#ifdef _WIN32
+    FILE *fp;
+    long  size;
     
-    if (xda >= yda) {
-       if ((xd >= 0) && (yd >= 0)) {
-           for (x = x1; x <= x2; x++) {
-               yn = y1 + ((yda*(x-x1)*256)/(xda) +128)/256;
-               TextScreen_PutCell(bitmap, x, yn, ch);
-           }
-       }
-       if ((xd >= 0) && (yd < 0)) {
-           for (x = x1; x <= x2; x++) {
-               yn = y1 - ((yda*(x-x1)*256)/(xda) +128)/256;
-               TextScreen_PutCell(bitmap, x, yn, ch);
-           }
-       }
-       if ((xd < 0) && (yd >= 0)) {
-           for (x = x1; x >= x2; x--) {
-               yn = y1 + ((yda*(x1-x)*256)/(xda) +128)/256;
-               TextScreen_PutCell(bitmap, x, yn, ch);
-           }
-       }
-       if ((xd < 0) && (yd < 0)) {
-           for (x = x1; x >= x2; x--) {
-               yn = y1 - ((yda*(x1-x)*256)/(xda) +128)/256;
-               TextScreen_PutCell(bitmap, x, yn, ch);
-           }
-       }
-    } else {
-       if ((xd >= 0) && (yd >= 0)) {
-           for (y = y1; y <= y2; y++) {
-               xn = x1 + ((xda*(y-y1)*256)/(yda) +128)/256;
-               TextScreen_PutCell(bitmap, xn, y, ch);
-           }
-       }
-       if ((xd < 0) && (yd >= 0)) {
-           for (y = y1; y <= y2; y++) {
-               xn = x1 - ((xda*(y-y1)*256)/(yda) +128)/256;
-               TextScreen_PutCell(bitmap, xn, y, ch);
-           }
-       }
-       if ((xd >= 0) && (yd < 0)) {
-           for (y = y1; y >= y2; y--) {
-               xn = x1 + ((xda*(y1-y)*256)/(yda) +128)/256;
-               TextScreen_PutCell(bitmap, xn, y, ch);
-           }
-       }
-       if ((xd < 0) && (yd < 0)) {
-           for (y = y1; y >= y2; y--) {
-               xn = x1 - ((xda*(y1-y)*256)/(yda) +128)/256;
-               TextScreen_PutCell(bitmap, xn, y, ch);
-           }
-       }
+    fp = fopen(path, "rb");
+    if (!fp) return -1;
+    if (fseek(fp, 0, SEEK_END) || ((size = ftell(fp)) < TEXTSCREEN_CAPTURE_HEADER) || fseek(fp, 0, SEEK_SET) ||
+        !(capture->data = (unsigned char *)malloc(size)) || (fread(capture->data, 1, size, fp) != (size_t)size)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    capture->size = size;
+#else
+    struct stat st;
+    void *data;
+    int   fd;
+    
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) || (st.st_size < TEXTSCREEN_CAPTURE_HEADER) || (st.st_size > LONG_MAX)) {
+        close(fd);
+        return -1;
+    }
+    // frames are decoded in place (seek reads only near the keyframe)
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    capture->data   = (unsigned char *)data;
+    capture->size   = (long)st.st_size;
+    capture->mapped = 1;
+#endif
+    return 0;
+}
+
+TextScreenCapture *TextScreen_OpenCapture(const char *path)
+{
+    TextScreenCapture *capture;
+    int   i;
+    
+    if (!path) return NULL;
+    capture = (TextScreenCapture *)calloc(1, sizeof(TextScreenCapture));
+    if (!capture) return NULL;
+    capture->sock = -1;
+    if (TextScreen_LoadCaptureFile(capture, path) || memcmp(capture->data, TEXTSCREEN_CAPTURE_MAGIC, 8)) {
+        TextScreen_CloseCapture(capture);
+        return NULL;
+    }
+    for (i = 0; i < 8; i++)
+        capture->start |= (long long)capture->data[8 + i] << (i * 8);
+    capture->pos = TEXTSCREEN_CAPTURE_HEADER;
+    capture->end = capture->size;
+    if (TextScreen_ReadCaptureIndex(capture))
+        TextScreen_ScanCapture(capture);
+    return capture;
+}
+
+void TextScreen_CloseCapture(TextScreenCapture *capture)
+{
+    long i;
+    
+    if (!capture) return;
+#ifdef _WIN32
+#else
+    if (capture->sock >= 0)
+        close(capture->sock);
+#endif
+    if (capture->data) {
+#ifdef _WIN32
+        free(capture->data);
+#else
+        if (capture->mapped) {
+            munmap(capture->data, capture->size);
+        } else {
+            free(capture->data);
+        }
+#endif
     }
+    for (i = 0; i < capture->indexNum; i++)
+        TextScreen_FreeBitmap(capture->index[i].snap);
+    free(capture->index);
+    TextScreen_FreeBitmap(capture->frame);
+    free(capture);
 }
 
-void TextScreen_DrawText(TextScreenBitmap *bitmap, int x, int y, const char *str)
+int TextScreen_SeekCapture(TextScreenCapture *capture, double time)
 {
-    if ((!bitmap) || (!str)) return;
-    while (*str != '\0') {
-        TextScreen_PutCell(bitmap, x, y, *str);
-        x++;
-        str++;
+    struct CaptureIndex *ip;
+    unsigned long long target, dt;
+    long lo, hi, mid;
+    int  flags;
+    
+    if (!capture || !capture->indexNum) return -1;
+    target = (time > 0) ? (unsigned long long)(time * 1e6 + 1e-3) : 0;
+    // last seek point at or before target (first seek point for earlier time)
+    lo = 0;
+    hi = capture->indexNum - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (capture->index[mid].time <= target) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    ip = capture->index + lo;
+    // decode from seek point. current frame is used if it is between seek point and target (playback)
+    if (!capture->frames || (capture->time > target) || (capture->frames - 1 < ip->frame)) {
+        capture->pos = ip->pos;
+        if (ip->snap) {
+            TextScreen_FreeBitmap(capture->frame);
+            capture->frame = TextScreen_DupBitmap(ip->snap);
+            if (!capture->frame) return -1;
+        } else if (TextScreen_DecodeCaptureFrame(capture) != 1) {
+            return -1;
+        }
+        capture->time   = ip->time;
+        capture->frames = ip->frame + 1;
     }
+    while (!TextScreen_PeekCaptureFrame(capture, capture->pos, &dt, &flags) && (capture->time + dt <= target)) {
+        if (TextScreen_DecodeCaptureFrame(capture) != 1) return -1;
+    }
+    return 0;
 }
 
-char TextScreen_GetCell(TextScreenBitmap *bitmap, int x, int y)
+TextScreenBitmap *TextScreen_GetCaptureFrame(TextScreenCapture *capture, double *time)
 {
-    if (!bitmap) return 0;
-    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
-        return *(bitmap->data + y * bitmap->width + x);
-    else
-        return 0;
+    if (!capture || !capture->frames) return NULL;
+    if (time)
+        *time = capture->time * 1e-6;
+    return capture->frame;
 }
 
-void TextScreen_PutCell(TextScreenBitmap *bitmap, int x, int y, char ch)
+void TextScreen_GetCaptureInfo(TextScreenCapture *capture, double *duration, long *frames)
 {
-    if (!bitmap) return;
-    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
-        *(bitmap->data + y * bitmap->width + x) = ch;
+    if (duration)
+        *duration = capture ? capture->duration * 1e-6 : 0;
+    if (frames)
+        *frames = capture ? capture->frameNum : 0;
 }
 
-void TextScreen_ClearCell(TextScreenBitmap *bitmap, int x, int y)
+// write data (len bytes) as content of JSON string. bytes not in UTF-8 sequence are written as Latin-1
+static void TextScreen_PutJsonString(FILE *fp, const unsigned char *data, int len)
 {
-    if (!bitmap) return;
-    if ((x >= 0) && (x < bitmap->width) && (y >= 0) && (y < bitmap->height))
-        *(bitmap->data + y * bitmap->width + x) = gSetting.space;
+    int i, k, n;
+    
+    for (i = 0; i < len; i++) {
+        if ((data[i] == '"') || (data[i] == '\\')) {
+            fputc('\\', fp);
+            fputc(data[i], fp);
+        } else if (data[i] < 0x20) {
+            fprintf(fp, "\\u%04x", data[i]);
+        } else if (data[i] < 0x80) {
+            fputc(data[i], fp);
+        } else {
+            n = ((data[i] >= 0xc2) && (data[i] <= 0xdf)) ? 1 : 
+                ((data[i] >= 0xe0) && (data[i] <= 0xef)) ? 2 : 
+                ((data[i] >= 0xf0) && (data[i] <= 0xf4)) ? 3 : 0;
+            for (k = 1; (k <= n) && (i + k < len) && ((data[i + k] & 0xc0) == 0x80); k++)
+                ;
+            if (n && (k == n + 1)) {
+                fwrite(data + i, 1, n + 1, fp);
+                i += n;
+            } else {
+                fprintf(fp, "\\u%04x", data[i]);
+            }
+        }
+    }
 }
 
-void TextScreen_CopyRect(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, 
-                         int dstx, int dsty, 
-                         int srcx, int srcy, int srcw, int srch, 
-                         int transparent)
+int TextScreen_ExportAsciicast(const char *capturePath, const char *castPath)
 {
-    int  x, y;
-    char ch;
-    TextScreenBitmap *src, *dst, *tmp = NULL;
-    
-    if (!srcmap || !dstmap) return;
+    TextScreenCapture *capture;
+    TextScreenBitmap  *frame, *shown = NULL;
+    const char *translate = gSetting.translate ? gSetting.translate : (const char *)gTranslateTable;
+    FILE  *fp;
+    char  *str = NULL, *out = NULL;
+    unsigned short *attr = NULL;
+    unsigned int   *code = NULL;
+    double time;
+    int    ret, y, w, index, sgr, event, rowcode;
     
-    src = srcmap;
-    dst = dstmap;
-    if (src == dst) {  // duplicate bitmap when source = destinate
-        tmp = TextScreen_DupBitmap(src);
-        src = tmp;
+    capture = TextScreen_OpenCapture(capturePath);
+    if (!capture) return -1;
+    TextScreen_UpdateTranslate();
+    fp = castPath ? fopen(castPath, "w") : NULL;
+    ret = fp ? TextScreen_ReadCapture(capture, &frame, &time) : -1;
+    if (ret == 1) {
+        fprintf(fp, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld}\n", 
+                frame->width, frame->height, capture->start);
     }
-    for (y = 0; y < srch; y++) {
-        for (x = 0; x < srcw; x++) {
-            ch = TextScreen_GetCell(src, srcx + x, srcy + y);
-            if (ch != gSetting.space || !transparent)
-                TextScreen_PutCell(dst, dstx + x, dsty + y, ch);
+    sgr = 0;
+    while (ret == 1) {
+        w = frame->width;
+        if (!shown || (shown->width != w) || (shown->height != frame->height)) {
+            if (shown)
+                fprintf(fp, "[%.6f, \"r\", \"%dx%d\"]\n", time, w, frame->height);
+            TextScreen_FreeBitmap(shown);
+            shown = NULL;
+            free(str);
+            free(attr);
+            free(code);
+            free(out);
+            str  = (char *)malloc(w);
+            attr = (unsigned short *)malloc(sizeof(unsigned short) * w);
+            code = (unsigned int *)malloc(sizeof(unsigned int) * w);
+            out  = (char *)malloc(P_CURSOR_POS_MAXLEN + P_SGR_MAXLEN + w * (TEXTSCREEN_UTF8_MAXLEN + P_SGR_MAXLEN));
+            if (!str || !attr || !code || !out) {
+                ret = -1;
+                break;
+            }
+        }
+        // rows changed from last frame
+        event = 0;
+        for (y = 0; y < frame->height; y++) {
+            // (planes are compared before cells: plane is added or removed without change of size)
+            if (shown && (!frame->attr == !shown->attr) && (!frame->code == !shown->code) &&
+                !memcmp(frame->data + y * w, shown->data + y * w, w) && 
+                (!frame->attr || !memcmp(frame->attr + y * w, shown->attr + y * w, sizeof(unsigned short) * w)) &&
+                (!frame->code || !memcmp(frame->code + y * w, shown->code + y * w, sizeof(unsigned int) * w)))
+                continue;
+            if (!event)
+                fprintf(fp, "[%.6f, \"o\", \"", time);
+            event = 1;
+            TextScreen_ClipRow(str, w, frame, 0, y, translate);
+            TextScreen_ClipAttrRow(attr, w, frame, 0, y);
+            rowcode = TextScreen_ClipCodeRow(code, w, frame, 0, y, 0);
+            if (rowcode)
+                TextScreen_FixCodeRow(str, attr, code, w);
+            index  = TextScreen_PutCursorPosSeq(out, 0, y);
+            index += TextScreen_PutCellRun(out + index, str, frame->attr ? attr : NULL, rowcode ? code : NULL, 
+                                           w, 0, 1, &sgr);
+            TextScreen_PutJsonString(fp, (unsigned char *)out, index);
+        }
+        if (event)
+            fprintf(fp, "\"]\n");
+        TextScreen_FreeBitmap(shown);
+        shown = TextScreen_DupBitmap(frame);
+        if (!shown) {
+            ret = -1;
+            break;
         }
+        ret = TextScreen_ReadCapture(capture, &frame, &time);
     }
-    if (tmp)
-        TextScreen_FreeBitmap(tmp);
+    if (fp && fclose(fp))
+        ret = -1;
+    TextScreen_FreeBitmap(shown);
+    free(str);
+    free(attr);
+    free(code);
+    free(out);
+    TextScreen_CloseCapture(capture);
+    return (ret == 0) ? 0 : -1;
 }
 
 /********************************
- Bitmap Tools
+ Broadcast
  ********************************/
 
-TextScreenBitmap *TextScreen_CreateBitmap(int width, int height)
+#ifdef _WIN32
+static void TextScreen_BroadcastFrame(TextScreenBitmap *bitmap, int dx, int dy)
 {
-    TextScreenBitmap *bitmap;
-    char *data;
+}
+
+static int TextScreen_IsBroadcasting(void)
+{
+    return 0;
+}
+
+int TextScreen_StartBroadcast(const char *path)
+{
+    return -1;
+}
+
+void TextScreen_StopBroadcast(void)
+{
+}
+
+void TextScreen_PollBroadcast(void)
+{
+}
+
+int TextScreen_GetBroadcastClients(void)
+{
+    return -1;
+}
+
+TextScreenCapture *TextScreen_ConnectBroadcast(const char *path)
+{
+    return NULL;
+}
+
+int TextScreen_ReceiveBroadcast(TextScreenCapture *capture, TextScreenBitmap **frame, int timeout)
+{
+    return -1;
+}
+#else
+// stream of broadcast: header of capture file, then messages: length of frame (LEB128), frame of capture file
+// frame is encoded once for all viewers which have last frame (difference), and once for others (keyframe)
+#define TEXTSCREEN_BROADCAST_MAXCLIENT  16
+#define TEXTSCREEN_BROADCAST_MAXFRAME   (64 * 1024 * 1024)  // max length of frame (viewer)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+struct BroadcastClient {
+    int   sock;
+    int   synced;   // 1: viewer has last frame (or it is in pending)
+    char *pending;  // rest of message not sent yet (viewer is slow)
+    long  pendingSize;
+    long  pendingPos;
+    long  pendingLen;
+};
+
+static int                    gBroadcastSock = -1;  // listening socket
+static char                   gBroadcastPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct BroadcastClient gBroadcastClient[TEXTSCREEN_BROADCAST_MAXCLIENT];
+static int                    gBroadcastNum  = 0;
+static TextScreenBitmap      *gBroadcastPrev = NULL;  // last frame sent
+static TextScreenBitmap      *gBroadcastCur  = NULL;
+static unsigned char         *gBroadcastBuf  = NULL;  // difference and keyframe (keep and reuse. grow only)
+static long                   gBroadcastBufSize = 0;
+static double                 gBroadcastTime = 0;     // time of last frame (TextScreen_GetTime())
+
+static int TextScreen_IsBroadcasting(void)
+{
+    return gBroadcastSock >= 0;
+}
+
+static void TextScreen_CloseBroadcastClient(int i)
+{
+    close(gBroadcastClient[i].sock);
+    free(gBroadcastClient[i].pending);
+    gBroadcastClient[i] = gBroadcastClient[--gBroadcastNum];
+}
+
+// send iov to client without waiting (pending of client is empty), rest is kept in pending
+// return 0:successful  -1:error (closed by viewer)
+static int TextScreen_SendBroadcast(struct BroadcastClient *client, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t n;
+    long    len;
+    char   *p;
+    int     i;
     
-    if ((width < 0) || (width > TEXTSCREEN_MAXSIZE) || (height < 0) || (height > TEXTSCREEN_MAXSIZE)) {
-        return NULL;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+    do {
+        n = sendmsg(client->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while ((n < 0) && (errno == EINTR));
+    if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) return -1;
+        n = 0;
     }
-    if (width == 0)
-        width = gSetting.width;
-    if (height == 0)
-        height = gSetting.height;
-    
-    bitmap = (TextScreenBitmap *)malloc(sizeof(TextScreenBitmap));
-    data   = (char *)malloc(width * height);
-    if (!bitmap || !data) {
-        if (bitmap) free(bitmap);
-        if (data)   free(data);
-        return NULL;
+    // keep rest
+    for (i = 0, len = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    len -= n;
+    if (len <= 0) return 0;
+    if (len > client->pendingSize) {
+        p = (char *)realloc(client->pending, len);
+        if (!p) return -1;
+        client->pending     = p;
+        client->pendingSize = len;
     }
-    
-    bitmap->width  = width;
-    bitmap->height = height;
-    bitmap->exdata = NULL;
-    bitmap->data   = data;
-    TextScreen_ClearBitmap(bitmap);
-    
-    return bitmap;
+    client->pendingPos = 0;
+    client->pendingLen = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if ((size_t)n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            continue;
+        }
+        memcpy(client->pending + client->pendingLen, (char *)iov[i].iov_base + n, iov[i].iov_len - n);
+        client->pendingLen += iov[i].iov_len - n;
+        n = 0;
+    }
+    return 0;
 }
 
-void TextScreen_FreeBitmap(TextScreenBitmap *bitmap)
+// send pending of client (pendingPos is advanced),  return 0:all sent  1:still pending  -1:error
+static int TextScreen_FlushBroadcastClient(struct BroadcastClient *client)
 {
-    if (bitmap) {
-        if (bitmap->data)
-            free(bitmap->data);
-        free(bitmap);
+    ssize_t n;
+    
+    while (client->pendingPos < client->pendingLen) {
+        n = send(client->sock, client->pending + client->pendingPos, client->pendingLen - client->pendingPos, 
+                 MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 1 : -1;
+        }
+        client->pendingPos += n;
     }
+    client->pendingPos = 0;
+    client->pendingLen = 0;
+    return 0;
 }
 
-void TextScreen_CopyBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy)
+// accept new viewers (header is sent, and keyframe is sent at next frame or TextScreen_PollBroadcast())
+static void TextScreen_AcceptBroadcast(void)
 {
-    int x, y;
-    
-    if (!srcmap || !dstmap) return;
+    struct BroadcastClient *client;
+    unsigned char header[TEXTSCREEN_CAPTURE_HEADER];
+    unsigned long long now;
+    struct iovec iov;
+    int   sock, i;
     
-    for (y = 0; y < srcmap->height; y++) {
-        for (x = 0; x < srcmap->width; x++) {
-            TextScreen_PutCell(dstmap, x + dx, y + dy, TextScreen_GetCell(srcmap, x, y));
+    while ((sock = accept(gBroadcastSock, NULL, NULL)) >= 0) {
+        if (gBroadcastNum >= TEXTSCREEN_BROADCAST_MAXCLIENT) {
+            close(sock);
+            continue;
         }
+        fcntl(sock, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        i = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &i, sizeof(i));
+#endif
+        client = &gBroadcastClient[gBroadcastNum++];
+        memset(client, 0, sizeof(*client));
+        client->sock = sock;
+        now = (unsigned long long)time(NULL);
+        memcpy(header, TEXTSCREEN_CAPTURE_MAGIC, 8);
+        for (i = 0; i < 8; i++)
+            header[8 + i] = (unsigned char)(now >> (i * 8));
+        iov.iov_base = header;
+        iov.iov_len  = sizeof(header);
+        if (TextScreen_SendBroadcast(client, &iov, 1))
+            TextScreen_CloseBroadcastClient(gBroadcastNum - 1);
     }
 }
 
-TextScreenBitmap *TextScreen_DupBitmap(TextScreenBitmap *bitmap)
+static void TextScreen_BroadcastFrame(TextScreenBitmap *bitmap, int dx, int dy)
 {
-    TextScreenBitmap *newmap;
+    struct BroadcastClient *client;
+    TextScreenBitmap *tmp;
+    unsigned char *buf, prefix[2][10];
+    unsigned long long dt;
+    struct iovec iov[2];
+    long   need, len[2];
+    double now;
+    int    i, k, keyframe, ret;
     
-    if (!bitmap) return NULL;
+    if (gBroadcastSock < 0) return;
+    TextScreen_AcceptBroadcast();
+    if (!gBroadcastNum) {
+        // frames without viewer are not kept: last frame is unknown (TextScreen_PollBroadcast() waits next frame)
+        TextScreen_FreeBitmap(gBroadcastPrev);
+        gBroadcastPrev = NULL;
+        return;
+    }
+    if (TextScreen_SnapshotBitmap(&gBroadcastCur, bitmap, dx, dy)) return;
+    need = TEXTSCREEN_CAPTURE_FRAME_MAXLEN((long)gBroadcastCur->width * gBroadcastCur->height);
+    if (need * 2 > gBroadcastBufSize) {
+        buf = (unsigned char *)realloc(gBroadcastBuf, need * 2);
+        if (!buf) return;
+        gBroadcastBuf     = buf;
+        gBroadcastBufSize = need * 2;
+    }
+    now = TextScreen_GetTime();
+    dt  = (gBroadcastTime > 0) && (now > gBroadcastTime) ? (unsigned long long)((now - gBroadcastTime) * 1e6) : 0;
+    gBroadcastTime = now;
+    keyframe = TextScreen_NeedKeyframe(gBroadcastCur, gBroadcastPrev);
+    len[0] = -1;  // difference (made when needed)
+    len[1] = -1;  // keyframe
     
-    newmap = TextScreen_CreateBitmap(bitmap->width, bitmap->height);
-    if (newmap) {
-        TextScreen_CopyBitmap(newmap, bitmap, 0, 0);
+    for (i = 0; i < gBroadcastNum; i++) {
+        client = &gBroadcastClient[i];
+        ret = TextScreen_FlushBroadcastClient(client);
+        if (ret == 1) {
+            // viewer is behind: skip frames, and send keyframe when pending is sent
+            client->synced = 0;
+            continue;
+        }
+        k = (!client->synced || keyframe) ? 1 : 0;
+        if (!ret && (len[k] < 0))
+            len[k] = TextScreen_EncodeCaptureFrame(gBroadcastBuf + need * k, gBroadcastCur, gBroadcastPrev, dt, k);
+        if (!ret) {
+            iov[0].iov_base = prefix[k];
+            iov[0].iov_len  = TextScreen_PutVarint(prefix[k], len[k]);
+            iov[1].iov_base = gBroadcastBuf + need * k;
+            iov[1].iov_len  = len[k];
+            ret = TextScreen_SendBroadcast(client, iov, 2);
+        }
+        if (ret) {
+            TextScreen_CloseBroadcastClient(i--);
+            continue;
+        }
+        client->synced = 1;
     }
-    return newmap;
+    tmp = gBroadcastPrev;
+    gBroadcastPrev = gBroadcastCur;
+    gBroadcastCur  = tmp;
 }
 
-void TextScreen_OverlayBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy)
+void TextScreen_PollBroadcast(void)
 {
-    char ch;
-    int x, y;
+    struct BroadcastClient *client;
+    unsigned char prefix[10];
+    struct iovec iov[2];
+    long   need, len;
+    int    i, ret;
     
-    if (!srcmap || !dstmap) return;
-    
-    for (y = 0; y < srcmap->height; y++) {
-        for (x = 0; x < srcmap->width; x++) {
-            ch = TextScreen_GetCell(srcmap, x, y);
-            if (ch != gSetting.space)
-                TextScreen_PutCell(dstmap, x + dx, y + dy, ch);
+    if (gBroadcastSock < 0) return;
+    TextScreen_AcceptBroadcast();
+    len = -1;
+    for (i = 0; i < gBroadcastNum; i++) {
+        client = &gBroadcastClient[i];
+        ret = TextScreen_FlushBroadcastClient(client);
+        if (ret == 1) continue;
+        if (!ret && !client->synced && gBroadcastPrev) {
+            // viewer is new or has sent pending: keyframe of last frame (buffer is grown for it by TextScreen_BroadcastFrame())
+            need = TEXTSCREEN_CAPTURE_FRAME_MAXLEN((long)gBroadcastPrev->width * gBroadcastPrev->height);
+            if (len < 0)
+                len = TextScreen_EncodeCaptureFrame(gBroadcastBuf + need, gBroadcastPrev, NULL, 0, 1);
+            iov[0].iov_base = prefix;
+            iov[0].iov_len  = TextScreen_PutVarint(prefix, len);
+            iov[1].iov_base = gBroadcastBuf + need;
+            iov[1].iov_len  = len;
+            ret = TextScreen_SendBroadcast(client, iov, 2);
+            if (!ret)
+                client->synced = 1;
         }
+        if (ret)
+            TextScreen_CloseBroadcastClient(i--);
     }
 }
 
-int TextScreen_CropBitmap(TextScreenBitmap *bitmap, int x, int y, int width, int height)
+int TextScreen_StartBroadcast(const char *path)
 {
-    char *data, *olddata;
-    int  oldwidth, oldheight;
-    int  xc, yc;
-    char ch;
+    struct sockaddr_un addr;
+    struct stat st;
+    int sock;
     
-    if (!bitmap) return -1;
-    if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
+    TextScreen_StopBroadcast();
+    if (!path || (strlen(path) >= sizeof(addr.sun_path))) return -1;
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // remove socket left by last process (other file and socket of running process are not removed)
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        if (!connect(sock, (struct sockaddr *)&addr, sizeof(addr)) || (errno != ECONNREFUSED)) {
+            close(sock);
+            return -1;
+        }
+        close(sock);
+        unlink(path);
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0) return -1;
+    }
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, TEXTSCREEN_BROADCAST_MAXCLIENT)) {
+        close(sock);
         return -1;
     }
-    data   = (char *)malloc(width * height);
-    if (!data) return -1;
-    
-    oldwidth  = bitmap->width;
-    oldheight = bitmap->height;
-    olddata   = bitmap->data;
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    gBroadcastSock = sock;
+    strcpy(gBroadcastPath, path);
+    gBroadcastTime = 0;
+    return 0;
+}
+
+void TextScreen_StopBroadcast(void)
+{
+    if (gBroadcastSock < 0) return;
+    while (gBroadcastNum > 0)
+        TextScreen_CloseBroadcastClient(gBroadcastNum - 1);
+    close(gBroadcastSock);
+    unlink(gBroadcastPath);
+    gBroadcastSock = -1;
+    TextScreen_FreeBitmap(gBroadcastPrev);
+    TextScreen_FreeBitmap(gBroadcastCur);
+    gBroadcastPrev = NULL;
+    gBroadcastCur  = NULL;
+    free(gBroadcastBuf);
+    gBroadcastBuf     = NULL;
+    gBroadcastBufSize = 0;
+}
+
+int TextScreen_GetBroadcastClients(void)
+{
+    return (gBroadcastSock < 0) ? 0 : gBroadcastNum;
+}
+
+TextScreenCapture *TextScreen_ConnectBroadcast(const char *path)
+{
+    TextScreenCapture *capture;
+    struct sockaddr_un addr;
     
-    bitmap->width  = width;
-    bitmap->height = height;
-    bitmap->data   = data;
+    if (!path || (strlen(path) >= sizeof(addr.sun_path))) return NULL;
+    capture = (TextScreenCapture *)calloc(1, sizeof(TextScreenCapture));
+    if (!capture) return NULL;
+    capture->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (capture->sock < 0) {
+        free(capture);
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(capture->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+        TextScreen_CloseCapture(capture);
+        return NULL;
+    }
+    fcntl(capture->sock, F_SETFD, FD_CLOEXEC);
+    return capture;
+}
+
+// decode received messages (capture->data[0, received)),  return number of decoded frames  -1:error
+static int TextScreen_DecodeBroadcast(TextScreenCapture *capture)
+{
+    unsigned long long len;
+    long pos = 0, next;
+    int  frames = 0, i;
     
-    TextScreen_ClearBitmap(bitmap);
+    if (!capture->start) {  // header
+        if (capture->received < TEXTSCREEN_CAPTURE_HEADER) return 0;
+        if (memcmp(capture->data, TEXTSCREEN_CAPTURE_MAGIC, 8)) return -1;
+        for (i = 0; i < 8; i++)
+            capture->start |= (long long)capture->data[8 + i] << (i * 8);
+        pos = TEXTSCREEN_CAPTURE_HEADER;
+    }
+    for (;;) {
+        next = pos;
+        if (TextScreen_GetVarint(capture->data, capture->received, &next, &len)) {
+            if (capture->received - pos >= 10) return -1;
+            break;  // length is not received yet
+        }
+        if (len > TEXTSCREEN_BROADCAST_MAXFRAME) return -1;
+        if (len > (unsigned long long)(capture->received - next)) break;
+        capture->pos = next;
+        capture->end = next + (long)len;
+        if ((TextScreen_DecodeCaptureFrame(capture) != 1) || (capture->pos != capture->end)) return -1;
+        pos = capture->end;
+        frames++;
+    }
+    // remove decoded messages
+    memmove(capture->data, capture->data + pos, capture->received - pos);
+    capture->received -= pos;
+    return frames;
+}
+
+int TextScreen_ReceiveBroadcast(TextScreenCapture *capture, TextScreenBitmap **frame, int timeout)
+{
+    struct pollfd pfd;
+    unsigned char *data;
+    ssize_t n;
+    int  frames, closed;
     
-    for (yc = 0; yc < height; yc++) {
-        for (xc = 0; xc < width; xc++) {
-            if (((xc + x) >= 0) && ((yc + y) >= 0) && ((xc + x) < oldwidth) && ((yc + y) < oldheight)) {
-                ch = *(olddata + ((yc + y) * oldwidth + (xc + x)));
-                *(data + (yc * width + xc)) = ch;
+    if (!capture || (capture->sock < 0)) return -1;
+    for (;;) {
+        // read all received data
+        closed = 0;
+        for (;;) {
+            if (capture->size - capture->received < 4096) {
+                data = (unsigned char *)realloc(capture->data, capture->size ? capture->size * 2 : 65536);
+                if (!data) return -1;
+                capture->data = data;
+                capture->size = capture->size ? capture->size * 2 : 65536;
             }
+            n = recv(capture->sock, capture->data + capture->received, capture->size - capture->received, MSG_DONTWAIT);
+            if (n > 0) {
+                capture->received += n;
+                continue;
+            }
+            if ((n < 0) && (errno == EINTR)) continue;
+            closed = !n || ((errno != EAGAIN) && (errno != EWOULDBLOCK));
+            break;
         }
+        // newest frame
+        frames = TextScreen_DecodeBroadcast(capture);
+        if (frames < 0) return -1;
+        if (frames > 0) {
+            if (frame)
+                *frame = capture->frame;
+            return 1;
+        }
+        if (closed) return -1;
+        if (!timeout) return 0;
+        pfd.fd      = capture->sock;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        n = poll(&pfd, 1, timeout);
+        if (!n) return 0;
+        if ((n < 0) && (errno != EINTR)) return -1;
     }
+}
+#endif
+
+/********************************
+ Shared Bitmap
+ ********************************/
+
+#ifdef _WIN32
+static int TextScreen_IsSharedBitmap(const TextScreenBitmap *bitmap)
+{
+    return 0;
+}
+
+static void TextScreen_FreeSharedBitmap(TextScreenBitmap *bitmap)
+{
+}
+
+TextScreenBitmap *TextScreen_CreateSharedBitmap(const char *name, int width, int height, int planes)
+{
+    return NULL;
+}
+
+TextScreenBitmap *TextScreen_OpenSharedBitmap(const char *name)
+{
+    return NULL;
+}
+
+void TextScreen_BeginSharedFrame(TextScreenBitmap *bitmap)
+{
+}
+
+void TextScreen_EndSharedFrame(TextScreenBitmap *bitmap)
+{
+}
+
+int TextScreen_SnapshotSharedBitmap(TextScreenBitmap *shared, TextScreenBitmap *snapshot, unsigned long long *generation)
+{
+    return -1;
+}
+#else
+// segment: header, data (width x height), attr (width x height + 1, TEXTSCREEN_SHARED_ATTR), code (TEXTSCREEN_SHARED_CODE)
+#define TEXTSCREEN_SHARED_MAGIC   "TXSSHM01"
+#define TEXTSCREEN_SHARED_HEADER  64      // bytes of header (offset of data)
+#define TEXTSCREEN_SHARED_RETRY   1000    // max retry of snapshot while producer writes cells
+#define TEXTSCREEN_SHARED_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+
+struct SharedHeader {
+    char               magic[8];
+    int                width;
+    int                height;
+    int                planes;      // TEXTSCREEN_SHARED_ATTR, TEXTSCREEN_SHARED_CODE
+    int                closed;      // 1: producer freed bitmap
+    unsigned long long generation;  // seqlock: odd while producer writes cells, +2 each frame
+    unsigned long long size;        // bytes of segment
+    int                pid;         // process id of producer
+};
+
+struct SharedBitmap {
+    TextScreenBitmap     bitmap;  // (first member: TextScreenBitmap * of user is struct SharedBitmap *)
+    struct SharedHeader *header;
+    size_t               size;
+    int                  owner;   // 1: producer (TextScreen_CreateSharedBitmap)  0: viewer (TextScreen_OpenSharedBitmap)
+    char                 name[256];
+    struct SharedBitmap *next;
+};
+
+static struct SharedBitmap *gSharedBitmap = NULL;  // list of shared bitmaps of this process
+
+static struct SharedBitmap *TextScreen_FindSharedBitmap(const TextScreenBitmap *bitmap)
+{
+    struct SharedBitmap *shared;
     
-    free(olddata);
-    
-    return 0;
+    for (shared = gSharedBitmap; shared; shared = shared->next) {
+        if (&shared->bitmap == bitmap) return shared;
+    }
+    return NULL;
 }
 
-int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height)
+static int TextScreen_IsSharedBitmap(const TextScreenBitmap *bitmap)
 {
-    char *data, *olddata;
-    int  oldwidth, oldheight;
-    int  xc, yc;
-    char ch;
+    return gSharedBitmap && bitmap && TextScreen_FindSharedBitmap(bitmap);
+}
+
+// bytes of segment, and offset of planes
+static size_t TextScreen_GetSharedLayout(int width, int height, int planes, size_t *attr, size_t *code)
+{
+    size_t size = TEXTSCREEN_SHARED_HEADER + TEXTSCREEN_SHARED_ALIGN((size_t)width * height);
     
-    if (!bitmap) return -1;
-    if ((width < 1) || (width > TEXTSCREEN_MAXSIZE) || (height < 1) || (height > TEXTSCREEN_MAXSIZE)) {
-        return -1;
+    *attr = 0;
+    *code = 0;
+    if (planes & TEXTSCREEN_SHARED_ATTR) {
+        *attr = size;
+        size += TEXTSCREEN_SHARED_ALIGN(((size_t)width * height + 1) * sizeof(unsigned short));
     }
-    data   = (char *)malloc(width * height);
-    if (!data) return -1;
+    if (planes & TEXTSCREEN_SHARED_CODE) {
+        *code = size;
+        size += TEXTSCREEN_SHARED_ALIGN(((size_t)width * height + 1) * sizeof(unsigned int));
+    }
+    return size;
+}
+
+// map segment and add to list,  return NULL:error
+static struct SharedBitmap *TextScreen_MapSharedBitmap(int fd, size_t size, int owner)
+{
+    struct SharedBitmap *shared;
+    void *map;
     
-    oldwidth  = bitmap->width;
-    oldheight = bitmap->height;
-    olddata   = bitmap->data;
+    shared = (struct SharedBitmap *)calloc(1, sizeof(struct SharedBitmap));
+    if (!shared) return NULL;
+    map = mmap(NULL, size, owner ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        free(shared);
+        return NULL;
+    }
+    shared->header = (struct SharedHeader *)map;
+    shared->size   = size;
+    shared->owner  = owner;
+    shared->next   = gSharedBitmap;
+    gSharedBitmap  = shared;
+    return shared;
+}
+
+static void TextScreen_FreeSharedBitmap(TextScreenBitmap *bitmap)
+{
+    struct SharedBitmap *shared = (struct SharedBitmap *)bitmap, **p;
     
-    bitmap->width  = width;
-    bitmap->height = height;
-    bitmap->data   = data;
+    for (p = &gSharedBitmap; *p; p = &(*p)->next) {
+        if (*p == shared) {
+            *p = shared->next;
+            break;
+        }
+    }
+    if (shared->owner) {
+        __atomic_store_n(&shared->header->closed, 1, __ATOMIC_RELEASE);
+        shm_unlink(shared->name);
+    }
+    munmap(shared->header, shared->size);
+    free(shared);
+}
+
+// segment name is left by producer which exited without TextScreen_FreeBitmap(),  return 1:stale  0:in use (or being created)
+static int TextScreen_IsStaleSharedBitmap(const char *name)
+{
+    struct SharedHeader *header;
+    struct stat st;
+    void *map;
+    int   fd, stale = 0;
     
-    TextScreen_ClearBitmap(bitmap);
-    // scaling with nearest neighbor
-    for (yc = 0; yc < height; yc++) {
-        for (xc = 0; xc < width; xc++) {
-            ch = *(olddata + ((oldheight * yc / height) * oldwidth) + (oldwidth * xc / width));
-            *(data + (yc * width + xc)) = ch;
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return 0;
+    if (!fstat(fd, &st) && (st.st_size >= TEXTSCREEN_SHARED_HEADER)) {
+        map = mmap(NULL, TEXTSCREEN_SHARED_HEADER, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            header = (struct SharedHeader *)map;
+            if (!memcmp(header->magic, TEXTSCREEN_SHARED_MAGIC, 8))
+                stale = __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) || 
+                        ((kill(header->pid, 0) < 0) && (errno == ESRCH));
+            munmap(map, TEXTSCREEN_SHARED_HEADER);
         }
     }
+    close(fd);
+    return stale;
+}
+
+TextScreenBitmap *TextScreen_CreateSharedBitmap(const char *name, int width, int height, int planes)
+{
+    struct SharedBitmap *shared;
+    struct SharedHeader *header;
+    size_t size, attr, code;
+    int    fd;
     
-    free(olddata);
+    if (!name || (strlen(name) >= sizeof(shared->name))) return NULL;
+    if ((width < 0) || (width > TEXTSCREEN_MAXSIZE) || (height < 0) || (height > TEXTSCREEN_MAXSIZE)) return NULL;
+    if (width == 0)
+        width = gSetting.width;
+    if (height == 0)
+        height = gSetting.height;
+    if ((width < 1) || (height < 1)) return NULL;  // (screen size before TextScreen_Init())
+    size = TextScreen_GetSharedLayout(width, height, planes, &attr, &code);
     
-    return 0;
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) && (errno == EEXIST) && TextScreen_IsStaleSharedBitmap(name)) {
+        // remove segment left by exited producer
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, size) || !(shared = TextScreen_MapSharedBitmap(fd, size, 1))) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    close(fd);
+    strcpy(shared->name, name);
+    header = shared->header;
+    shared->bitmap.width  = width;
+    shared->bitmap.height = height;
+    shared->bitmap.exdata = NULL;
+    shared->bitmap.data   = (char *)header + TEXTSCREEN_SHARED_HEADER;
+    shared->bitmap.attr   = attr ? (unsigned short *)((char *)header + attr) : NULL;
+    shared->bitmap.code   = code ? (unsigned int *)((char *)header + code) : NULL;
+    TextScreen_ClearBitmap(&shared->bitmap);
+    
+    header->width      = width;
+    header->height     = height;
+    header->planes     = planes & (TEXTSCREEN_SHARED_ATTR | TEXTSCREEN_SHARED_CODE);
+    header->size       = size;
+    header->pid        = (int)getpid();
+    header->generation = 2;
+    // magic is written at last (viewer checks magic)
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, TEXTSCREEN_SHARED_MAGIC, 8);
+    return &shared->bitmap;
 }
 
-int TextScreen_CompareBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy)
+TextScreenBitmap *TextScreen_OpenSharedBitmap(const char *name)
 {
-    int  x, y;
-    char chsrc, chdst;
-    
-    if (!srcmap || !dstmap) return -1;
+    struct SharedBitmap *shared;
+    struct SharedHeader *header;
+    struct stat st;
+    size_t attr, code;
+    int    fd;
     
-    for (y = 0; y < srcmap->height; y++) {
-        for (x = 0; x < srcmap->width; x++) {
-            chsrc = TextScreen_GetCell(srcmap, x, y);
-            chdst = TextScreen_GetCell(dstmap, x + dx, y + dy);
-            if (chsrc > chdst) return 1;
-            if (chsrc < chdst) return -1;
-        }
+    if (!name || (strlen(name) >= sizeof(shared->name))) return NULL;
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) || (st.st_size < TEXTSCREEN_SHARED_HEADER) || 
+        !(shared = TextScreen_MapSharedBitmap(fd, (size_t)st.st_size, 0))) {
+        close(fd);
+        return NULL;
     }
-    return 0;
+    close(fd);
+    strcpy(shared->name, name);
+    header = shared->header;
+    if (memcmp(header->magic, TEXTSCREEN_SHARED_MAGIC, 8)) {
+        TextScreen_FreeSharedBitmap(&shared->bitmap);
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((header->width < 1) || (header->width > TEXTSCREEN_MAXSIZE) || 
+        (header->height < 1) || (header->height > TEXTSCREEN_MAXSIZE) || 
+        (TextScreen_GetSharedLayout(header->width, header->height, header->planes, &attr, &code) > shared->size)) {
+        TextScreen_FreeSharedBitmap(&shared->bitmap);
+        return NULL;
+    }
+    shared->bitmap.width  = header->width;
+    shared->bitmap.height = header->height;
+    shared->bitmap.exdata = NULL;
+    shared->bitmap.data   = (char *)header + TEXTSCREEN_SHARED_HEADER;
+    shared->bitmap.attr   = attr ? (unsigned short *)((char *)header + attr) : NULL;
+    shared->bitmap.code   = code ? (unsigned int *)((char *)header + code) : NULL;
+    return &shared->bitmap;
 }
 
-void TextScreen_ClearBitmap(TextScreenBitmap *bitmap)
+void TextScreen_BeginSharedFrame(TextScreenBitmap *bitmap)
 {
-    if (!bitmap) return;
-    TextScreen_DrawFillRect(bitmap, 0, 0, bitmap->width, bitmap->height, gSetting.space);
+    struct SharedBitmap *shared = TextScreen_FindSharedBitmap(bitmap);
+    unsigned long long generation;
+    
+    if (!shared || !shared->owner) return;
+    generation = __atomic_load_n(&shared->header->generation, __ATOMIC_RELAXED);
+    if (generation & 1) return;
+    __atomic_store_n(&shared->header->generation, generation + 1, __ATOMIC_RELAXED);
+    // cells are written after odd generation is seen
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
-int TextScreen_ShowBitmap(TextScreenBitmap *bitmap, int dx, int dy)
+void TextScreen_EndSharedFrame(TextScreenBitmap *bitmap)
 {
-    char *buf;
-    char ch;
-    int  index;
-    int  i, x, y;
+    struct SharedBitmap *shared = TextScreen_FindSharedBitmap(bitmap);
+    unsigned long long generation;
     
-    if (!gSetting.width || !gSetting.height)
-        TextScreen_Init(NULL);
+    if (!shared || !shared->owner) return;
+    generation = __atomic_load_n(&shared->header->generation, __ATOMIC_RELAXED);
+    if (!(generation & 1)) return;
+    __atomic_store_n(&shared->header->generation, generation + 1, __ATOMIC_RELEASE);
+}
+
+int TextScreen_SnapshotSharedBitmap(TextScreenBitmap *shared, TextScreenBitmap *snapshot, unsigned long long *generation)
+{
+    struct SharedBitmap *sb = TextScreen_FindSharedBitmap(shared);
+    struct SharedHeader *header;
+    unsigned long long start, end;
+    size_t size;
+    int    retry;
     
-    if (!bitmap) return 0;
-    buf = NULL;
-    switch (gSetting.renderingMethod) {  // Create buffer
-        case TEXTSCREEN_RENDERING_METHOD_WINCONSOLE:
-        case TEXTSCREEN_RENDERING_METHOD_FAST:
-            buf = (char *)malloc( (gSetting.topMargin * 2) + 
-                    (gSetting.width+gSetting.leftMargin+2) * gSetting.height + 4 );
-            if (!buf) return -1;
-            break;
-        case TEXTSCREEN_RENDERING_METHOD_NORMAL:
-            buf = (char *)malloc(gSetting.width+gSetting.leftMargin+2);
-            if (!buf) return -1;
-            break;
-        case TEXTSCREEN_RENDERING_METHOD_SLOW:
-        default:
-            break;
+    if (!sb || !snapshot) return -1;
+    header = sb->header;
+    if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) return -1;
+    if ((snapshot->width != shared->width) || (snapshot->height != shared->height)) {
+        if (TextScreen_ResizeBitmap(snapshot, shared->width, shared->height)) return -1;
     }
-    
-#ifdef _WIN32
-    {  // set cursor position to 0,0 (top-left corner)
-        HANDLE stdh;
-        COORD  coord;
-        stdh = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (stdh) {
-            coord.X = 0;
-            coord.Y = 0;
-            SetConsoleCursorPosition(stdh ,coord);
-        } else {
-            free(buf);
-            return -1;
+    if (!shared->attr) {
+        TextScreen_FreeAttrPlane(snapshot);
+    } else if (TextScreen_CreateAttrPlane(snapshot)) {
+        return -1;
+    }
+    if (!shared->code) {
+        TextScreen_FreeCodePlane(snapshot);
+    } else if (TextScreen_CreateCodePlane(snapshot)) {
+        return -1;
+    }
+    size = (size_t)shared->width * shared->height;
+    for (retry = 0; retry < TEXTSCREEN_SHARED_RETRY; retry++) {
+        start = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+        if (generation && (start == *generation)) return 0;
+        if (start & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(snapshot->data, shared->data, size);
+        if (shared->attr)
+            memcpy(snapshot->attr, shared->attr, size * sizeof(unsigned short));
+        if (shared->code)
+            memcpy(snapshot->code, shared->code, size * sizeof(unsigned int));
+        // cells are read before generation is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+        if (start == end) {
+            if (generation)
+                *generation = start;
+            return 1;
         }
     }
-#else
-    P_CURSOR_POS(0, 0);
+    return 0;
+}
 #endif
+
+/********************************
+ Trace Output
+ ********************************/
+
+#ifdef _WIN32
+static unsigned long long TextScreen_TraceBegin(void)
+{
+    return 0;
+}
+
+static void TextScreen_TraceEnd(const char *name, unsigned long long start, long arg)
+{
+}
+
+int TextScreen_StartTrace(const char *path)
+{
+    return -1;
+}
+
+void TextScreen_StopTrace(void)
+{
+}
+#else
+#define TEXTSCREEN_TRACE_RING      4096  // events of ring buffer (power of 2)
+#define TEXTSCREEN_TRACE_MAXTHREAD 16
+#define TEXTSCREEN_TRACE_INTERVAL  50    // msec (interval of writing events to file)
+
+struct TraceEvent {
+    const char *name;          // static string
+    unsigned long long start;  // nsec (monotonic)
+    unsigned long long dur;    // nsec
+    long arg;
+};
+
+// ring buffer of one thread: the thread writes head, background thread writes tail (lock free)
+// rings are kept until process exit (thread may add event while trace is stopped)
+struct TraceRing {
+    struct TraceEvent event[TEXTSCREEN_TRACE_RING];
+    unsigned long head;
+    unsigned long tail;
+    unsigned long dropped;
+    int  tid;
+};
+
+static struct TraceRing *gTraceRing[TEXTSCREEN_TRACE_MAXTHREAD];
+static int                gTraceRingNum = 0;
+static pthread_key_t      gTraceKey;
+static pthread_once_t     gTraceOnce    = PTHREAD_ONCE_INIT;
+static pthread_mutex_t    gTraceLock    = PTHREAD_MUTEX_INITIALIZER;  // ring list and file
+static pthread_cond_t     gTraceCond    = PTHREAD_COND_INITIALIZER;
+static pthread_t          gTraceThread;
+static int                gTraceStop    = 0;
+static FILE              *gTraceFile    = NULL;
+static unsigned long long gTraceBase    = 0;  // start time of trace
+static int                gTraceCount   = 0;  // events written to file
+
+static unsigned long long TextScreen_TraceNow(void)
+{
+    struct timespec t;
     
-    // these 'change sign' is historical reason.
-    dx = -dx;
-    dy = -dy;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void TextScreen_TraceInitKey(void)
+{
+    pthread_key_create(&gTraceKey, NULL);
+}
+
+// ring of current thread (made at first event of thread),  return NULL: too many threads
+static struct TraceRing *TextScreen_TraceGetRing(void)
+{
+    struct TraceRing *ring = (struct TraceRing *)pthread_getspecific(gTraceKey);
     
-    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_NORMAL) {
-        
-        for (i = 0; i < gSetting.topMargin; i++)
-            printf("\n");
-        
-        for (y = 0; y < gSetting.height; y++) {
-            if (y) { printf("\n"); };
-            index = 0;
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                buf[index++] = ' ';
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                buf[index++] = gSetting.translate[(unsigned char)ch];
-            }
-            buf[index++] = 0;
-            printf("%s", buf);
+    if (ring) return ring;
+    pthread_mutex_lock(&gTraceLock);
+    if (gTraceRingNum < TEXTSCREEN_TRACE_MAXTHREAD) {
+        ring = (struct TraceRing *)calloc(1, sizeof(struct TraceRing));
+        if (ring) {
+            ring->tid = gTraceRingNum + 1;
+            gTraceRing[gTraceRingNum++] = ring;
+            pthread_setspecific(gTraceKey, ring);
         }
     }
+    pthread_mutex_unlock(&gTraceLock);
+    return ring;
+}
+
+static unsigned long long TextScreen_TraceBegin(void)
+{
+    return gTraceRunning ? TextScreen_TraceNow() : 0;
+}
+
+static void TextScreen_TraceEnd(const char *name, unsigned long long start, long arg)
+{
+    struct TraceRing  *ring;
+    struct TraceEvent *ev;
+    unsigned long head;
     
-    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_SLOW) {
-        
-        for (i = 0; i < gSetting.topMargin; i++)
-            printf("\n");
-        
-        for (y = 0; y < gSetting.height; y++) {
-            if (y) { printf("\n"); };
-            index = 0;
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                fputc(' ', stdout);
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                fputc(gSetting.translate[(unsigned char)ch], stdout);
-            }
-            TextScreen_Wait(0);
-        }
+    if (!start || !gTraceRunning) return;
+    ring = TextScreen_TraceGetRing();
+    if (!ring) return;
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= TEXTSCREEN_TRACE_RING) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
     }
+    ev = &ring->event[head & (TEXTSCREEN_TRACE_RING - 1)];
+    ev->name  = name;
+    ev->start = start;
+    ev->dur   = TextScreen_TraceNow() - start;
+    ev->arg   = arg;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// write events of all rings to file (with gTraceLock)
+static void TextScreen_TraceFlush(void)
+{
+    struct TraceRing  *ring;
+    struct TraceEvent *ev;
+    unsigned long head, tail;
+    int i;
     
-    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_FAST) {
-        index = 0;
-        for (i = 0; i < gSetting.topMargin; i++) {
-#ifdef _WIN32
-            // buf[index++] = 0x0d;
-            buf[index++] = 0x0a;
-#else
-            buf[index++] = 0x0a;
-#endif
-        }
-        for (y = 0; y < gSetting.height; y++) {
-            if (y) {
-#ifdef _WIN32
-                // buf[index++] = 0x0d;
-                buf[index++] = 0x0a;
-#else
-                buf[index++] = 0x0a;
-#endif
-            }
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                buf[index++] = ' ';
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                buf[index++] = gSetting.translate[(unsigned char)ch];
+    for (i = 0; i < gTraceRingNum; i++) {
+        ring = gTraceRing[i];
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (tail = ring->tail; tail != head; tail++) {
+            ev = &ring->event[tail & (TEXTSCREEN_TRACE_RING - 1)];
+            if (ev->start >= gTraceBase) {  // (older event is left by last trace)
+                fprintf(gTraceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"n\":%ld}}",
+                        gTraceCount ? ",\n" : "", ev->name, ring->tid, 
+                        (ev->start - gTraceBase) / 1000.0, ev->dur / 1000.0, ev->arg);
+                gTraceCount++;
             }
         }
-        buf[index++] = 0;
-        printf("%s", buf);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
     }
+    fflush(gTraceFile);
+}
+
+static void *TextScreen_TraceThread(void *arg)
+{
+    struct timespec t;
     
-    if (gSetting.renderingMethod == TEXTSCREEN_RENDERING_METHOD_WINCONSOLE) { // Windows only
-#ifdef _WIN32
-        HANDLE stdh;
-        DWORD  wlen;
-        
-        index = 0;
-        for (i = 0; i < gSetting.topMargin; i++) {
-            // buf[index++] = 0x0d;
-            buf[index++] = 0x0a;
-        }
-        for (y = 0; y < gSetting.height; y++) {
-            if (y) {
-                // buf[index++] = 0x0d;
-                buf[index++] = 0x0a;
-            }
-            for (i = 0; i < gSetting.leftMargin; i++) {
-                buf[index++] = ' ';
-            }
-            for (x = 0; x < gSetting.width; x++) {
-                ch = TextScreen_GetCell(bitmap, x + dx, y + dy);
-                buf[index++] = gSetting.translate[(unsigned char)ch];
-            }
-        }
-        stdh = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (stdh) {
-            WriteConsole(stdh, buf, index, &wlen, NULL);
+    pthread_mutex_lock(&gTraceLock);
+    while (!gTraceStop) {
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_nsec += TEXTSCREEN_TRACE_INTERVAL * 1000000L;
+        if (t.tv_nsec >= 1000000000L) {
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000L;
         }
-#endif
+        pthread_cond_timedwait(&gTraceCond, &gTraceLock, &t);
+        TextScreen_TraceFlush();
     }
+    pthread_mutex_unlock(&gTraceLock);
+    return NULL;
+}
+
+int TextScreen_StartTrace(const char *path)
+{
+    FILE *fp;
+    int   i;
     
-    fflush(stdout);
-    if (buf) free(buf);
+    TextScreen_StopTrace();
+    if (!path) return -1;
+    fp = fopen(path, "w");
+    if (!fp) return -1;
+    pthread_once(&gTraceOnce, TextScreen_TraceInitKey);
+    
+    pthread_mutex_lock(&gTraceLock);
+    gTraceFile  = fp;
+    gTraceBase  = TextScreen_TraceNow();
+    gTraceCount = 0;
+    gTraceStop  = 0;
+    for (i = 0; i < gTraceRingNum; i++)
+        gTraceRing[i]->dropped = 0;
+    fputs("[\n", fp);
+    pthread_mutex_unlock(&gTraceLock);
+    if (pthread_create(&gTraceThread, NULL, TextScreen_TraceThread, NULL)) {
+        fclose(fp);
+        gTraceFile = NULL;
+        return -1;
+    }
+    gTraceRunning = 1;
     return 0;
 }
 
+void TextScreen_StopTrace(void)
+{
+    unsigned long dropped = 0;
+    int i;
+    
+    if (!gTraceRunning) return;
+    gTraceRunning = 0;
+    pthread_mutex_lock(&gTraceLock);
+    gTraceStop = 1;
+    pthread_cond_signal(&gTraceCond);
+    pthread_mutex_unlock(&gTraceLock);
+    pthread_join(gTraceThread, NULL);
+    
+    // rest of events, and number of dropped events (ring was full)
+    pthread_mutex_lock(&gTraceLock);
+    TextScreen_TraceFlush();
+    for (i = 0; i < gTraceRingNum; i++)
+        dropped += __atomic_load_n(&gTraceRing[i]->dropped, __ATOMIC_RELAXED);
+    if (dropped) {
+        fprintf(gTraceFile, "%s{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"args\":{\"n\":%lu}}",
+                gTraceCount ? ",\n" : "", (TextScreen_TraceNow() - gTraceBase) / 1000.0, dropped);
+    }
+    fputs("\n]\n", gTraceFile);
+    fclose(gTraceFile);
+    gTraceFile = NULL;
+    pthread_mutex_unlock(&gTraceLock);
+}
+#endif
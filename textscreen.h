@@ -14,6 +14,8 @@
 #ifndef TEXTSCREEN_TEXTSCREEN_H
 #define TEXTSCREEN_TEXTSCREEN_H
 
+#include <stdio.h>
+
 #define TEXTSCREEN_TEXTSCREEN_VERSION 20160525
 
 // max bitmap width and height
@@ -66,9 +68,49 @@ enum TextScreenRenderingMethod {
     TEXTSCREEN_RENDERING_METHOD_NORMAL,      // normal speed. good quality
     TEXTSCREEN_RENDERING_METHOD_SLOW,        // output character 1 by 1 (use fputc) and sleep(0) by line
     TEXTSCREEN_RENDERING_METHOD_WINCONSOLE,  // use Windows console api (very fast, use WriteConsole())
+    TEXTSCREEN_RENDERING_METHOD_DIFF,        // output changed characters only (compare with last shown screen)
     TEXTSCREEN_RENDERING_METHOD_NB           // number of method
 };
 
+// rendering option flags (TextScreenSetting.renderingFlags)
+// terminal must support these escape sequences. (Windows: not used)
+#define TEXTSCREEN_RENDERING_FLAG_REPEAT  0x00000001  // use REP(repeat) and ECH(erase) for run of same character
+#define TEXTSCREEN_RENDERING_FLAG_SCROLL  0x00000002  // use scroll region (DECSTBM, SU/SD) for scrolled screen (METHOD_DIFF)
+#define TEXTSCREEN_RENDERING_FLAG_PAN     0x00000004  // use ICH(insert)/DCH(delete) for horizontally moved row (METHOD_DIFF)
+#define TEXTSCREEN_RENDERING_FLAG_SYNC    0x00000008  // use synchronized update (DEC mode 2026) for frame
+#define TEXTSCREEN_RENDERING_FLAG_NONBLOCK 0x00000010  // don't wait for slow console. frames are skipped until last frame is written
+#define TEXTSCREEN_RENDERING_FLAG_AUTO    0x00000020  // detect terminal at TextScreen_Init(), and add flags supported by it (REPEAT, SCROLL, PAN, SYNC)
+
+// terminal capabilities (TextScreen_GetCapability)
+typedef struct TextScreenCapability {
+    // 1: terminal answered queries (or cached answer)  0: guessed by TERM and COLORTERM only
+    int  detected;
+    // primary device attributes (DA1) 1st parameter (1:VT100 6:VT102 62:VT220 63:VT320 64:VT420 65:VT5xx, 0:unknown)
+    int  deviceClass;
+    // secondary device attributes (DA2) terminal type and version (-1:unknown)
+    int  deviceType;
+    int  deviceVersion;
+    // features  1:supported  0:not supported
+    int  syncOutput;     // synchronized update (DEC mode 2026)
+    int  repeat;         // REP (repeat character)
+    int  scrollMargins;  // scroll region (DECSTBM) and SU/SD
+    int  insertDelete;   // ICH/DCH (insert/delete character)
+    int  trueColor;      // 24 bit color (SGR 38;2;r;g;b)
+    int  mouse;          // mouse tracking  0:no  1:normal (mode 1000)  2:normal and SGR extended (mode 1006)
+} TextScreenCapability;
+
+// output backend: receives console output instead of stdout (Non Windows)
+typedef struct TextScreenBackend {
+    // user data (1st argument of functions)
+    void *userdata;
+    // write len bytes of data,  return 0:successful  -1:error
+    int  (*write)(void *userdata, const char *data, int len);
+    // end of output (endOfFrame=1: end of frame),  return 0:successful  -1:error
+    int  (*flush)(void *userdata, int endOfFrame);
+    // get console size (NULL: use console),  return 0:successful  -1:error
+    int  (*getSize)(void *userdata, int *width, int *height);
+} TextScreenBackend;
+
 typedef struct TextScreenSetting {
     // character code for space: use for ClearBitmap, except character for OverlayBitmap, ...
     char space;
@@ -88,8 +130,12 @@ typedef struct TextScreenSetting {
     void (*sigintHandler)(int sig, void *userdata);
     // SIGINT callback userdata
     void *sigintHandlerUserData;
-    // translate table
+    // translate table (256 characters. may be changed in place: checked again at each frame)
     char *translate;
+    // rendering option flags (TEXTSCREEN_RENDERING_FLAG_*)
+    int  renderingFlags;
+    // output backend (NULL: console)
+    TextScreenBackend *backend;
 } TextScreenSetting;
 
 typedef struct TextScreenBitmap {
@@ -101,8 +147,34 @@ typedef struct TextScreenBitmap {
     void *exdata;
     // bitmap data handle (size = width x height). Create by TextScreen_CreateBitmap()
     char *data;
+    // attribute of each cell (size = width x height, NULL: no attribute). Create by TextScreen_CreateAttrPlane()
+    unsigned short *attr;
+    // Unicode code point of each cell (size = width x height, NULL: no code point). Create by TextScreen_CreateCodePlane()
+    // used for cell of character TEXTSCREEN_CHAR_CODE (code point 0: right half of wide character)
+    unsigned int *code;
 } TextScreenBitmap;
 
+// character of cell which shows code point of TextScreenBitmap.code
+#define TEXTSCREEN_CHAR_CODE        ((char)0xff)
+
+// cell attribute (TextScreenBitmap.attr) = foreground color | (background color << 5) | TEXTSCREEN_ATTR_*
+// color: TEXTSCREEN_COLOR_*, add TEXTSCREEN_COLOR_BRIGHT for bright color
+#define TEXTSCREEN_COLOR_DEFAULT    0
+#define TEXTSCREEN_COLOR_BLACK      1
+#define TEXTSCREEN_COLOR_RED        2
+#define TEXTSCREEN_COLOR_GREEN      3
+#define TEXTSCREEN_COLOR_YELLOW     4
+#define TEXTSCREEN_COLOR_BLUE       5
+#define TEXTSCREEN_COLOR_MAGENTA    6
+#define TEXTSCREEN_COLOR_CYAN       7
+#define TEXTSCREEN_COLOR_WHITE      8
+#define TEXTSCREEN_COLOR_BRIGHT     8
+#define TEXTSCREEN_ATTR_BOLD        0x0400
+#define TEXTSCREEN_ATTR_UNDERLINE   0x0800
+#define TEXTSCREEN_ATTR(fg, bg)     ((unsigned short)((fg) | ((bg) << 5)))
+#define TEXTSCREEN_ATTR_FG(attr)    ((attr) & 0x1f)
+#define TEXTSCREEN_ATTR_BG(attr)    (((attr) >> 5) & 0x1f)
+
 // set SIGINT handler
 void TextScreen_SetSigintHandler(void (*handler)(int, void*), void *userdata);
 
@@ -127,6 +199,56 @@ int TextScreen_SetCursorPos(int x, int y);
 // set visible/hide cursor  0:hide  1:visible
 int TextScreen_SetCursorVisible(int visible);
 
+// begin frame. console output (ShowBitmap, SetCursorPos, ...) is kept until TextScreen_EndFrame()
+// can be nested.  return 0:successful  -1:error
+int TextScreen_BeginFrame(void);
+
+// end frame. write console output of the frame at once (recorded and broadcast as one frame at end of outermost frame)
+// return 0:successful  -1:error
+int TextScreen_EndFrame(void);
+
+// asynchronous rendering (Non Windows)  0:off  1:on
+// on: TextScreen_ShowBitmap() copies bitmap and returns, render thread writes newest frame to console
+// (frames not written yet are dropped).  return 0:successful  -1:error
+int TextScreen_SetAsyncRendering(int enable);
+
+// frame pacing. fps: target frame rate (0:off)
+// TextScreen_ShowBitmap() faster than target rate is not shown. newest bitmap is kept and shown by TextScreen_WaitFrame()
+void TextScreen_SetFrameRate(double fps);
+
+// wait until next frame time, and show kept bitmap (use instead of TextScreen_Wait() in main loop)
+// return 0:successful  -1:error
+int TextScreen_WaitFrame(void);
+
+// achieved frame rate (shown frames per second)
+double TextScreen_GetFrameRate(void);
+
+// average time to make and write one frame (msec)
+double TextScreen_GetFrameTime(void);
+
+// rendering statistics (TextScreen_GetStats)
+typedef struct TextScreenStats {
+    long   frames;        // frames
+    long   cellsScanned;  // cells of screen compared or converted
+    long   cellsChanged;  // cells output
+    long   bytes;         // bytes written to console or backend
+    long   writes;        // write calls (system call or backend write)
+    double encodeTime;    // time to make output (msec)
+    double writeTime;     // time to write output (msec)
+    double frameTime;     // encodeTime + writeTime (msec)
+    double frameTimeMin;  // min, average, 99 percentile and max of frameTime (msec)
+    double frameTimeAvg;
+    double frameTimeP99;
+    double frameTimeMax;
+} TextScreenStats;
+
+// get statistics of last frame and total (since start or TextScreen_ResetStats()). NULL: not get
+// environment variable TEXTSCREEN_STATS=1 prints summary to stderr at TextScreen_End() (other value: file name to append)
+void TextScreen_GetStats(TextScreenStats *frame, TextScreenStats *total);
+
+// reset total of statistics
+void TextScreen_ResetStats(void);
+
 // wait for ms millisecond (call sleep)
 void TextScreen_Wait(unsigned int ms);
 
@@ -139,6 +261,18 @@ void TextScreen_SetSpaceChar(char ch);
 // set rendering method
 void TextScreen_SetRenderingMethod(int method);
 
+// set rendering option flags (TEXTSCREEN_RENDERING_FLAG_*)
+void TextScreen_SetRenderingFlags(int flags);
+
+// max bytes of one frame for TEXTSCREEN_RENDERING_METHOD_DIFF (0:no limit). rows over budget are drawn by next frames
+// with TEXTSCREEN_RENDERING_FLAG_NONBLOCK, budget is used only while console is slow (Non Windows)
+// skipped frame and rows over budget are also drawn by TextScreen_WaitFrame(), TextScreen_Wait() and TextScreen_GetKey()
+void TextScreen_SetFrameBudget(int bytes);
+
+// forget last shown screen. next TextScreen_ShowBitmap() redraw whole screen (for TEXTSCREEN_RENDERING_METHOD_DIFF)
+// call this after console was written without TextScreen_ShowBitmap() (eg. printf)
+void TextScreen_InvalidateScreen(void);
+
 // get copy of current settings
 void TextScreen_GetSetting(TextScreenSetting *setting);
 
@@ -151,6 +285,18 @@ void TextScreen_GetSettingDefault(TextScreenSetting *setting);
 // get key; return: key code
 int TextScreen_GetKey(void);
 
+// detect terminal capabilities by queries (DA1, DA2, DECRQM) with timeout (msec), TERM and COLORTERM (Non Windows)
+// useCache=1: use result cached for TERM (~/.cache/textscreen/), query and cache it if not cached (no answer is cached too)
+// features by TERM are used only when terminal did not answer. late answers are dropped from input
+// return 0:successful  -1:terminal did not answer (capabilities are guessed by TERM and COLORTERM)
+int TextScreen_DetectCapability(int useCache, int timeout);
+
+// get terminal capabilities detected by TextScreen_DetectCapability() (all 0 if not detected yet)
+void TextScreen_GetCapability(TextScreenCapability *cap);
+
+// rendering flags supported by terminal (TEXTSCREEN_RENDERING_FLAG_REPEAT, SCROLL, PAN, SYNC)
+int TextScreen_GetCapabilityFlags(void);
+
 
 // ******** bitmap draw tools ********
 // bitmap handle=bitmap; center position=(x,y); radius=r; draw character=ch
@@ -190,6 +336,28 @@ void TextScreen_ClearCell(TextScreenBitmap *bitmap, int x, int y);
 void TextScreen_CopyRect(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, 
                          int dstx, int dsty, int srcx, int srcy, int srcw, int srch, int transparent);
 
+// bitmap handle=bitmap; get attribute at (x,y)  (0: no attribute plane)
+unsigned short TextScreen_GetAttr(TextScreenBitmap *bitmap, int x, int y);
+
+// bitmap handle=bitmap; put attribute attr to (x,y)  (ignored if no attribute plane)
+void TextScreen_PutAttr(TextScreenBitmap *bitmap, int x, int y, unsigned short attr);
+
+// bitmap handle=bitmap; left=x; top=y; width=w; height=h; attribute=attr
+void TextScreen_FillAttr(TextScreenBitmap *bitmap, int x, int y, int w, int h, unsigned short attr);
+
+// bitmap handle=bitmap; get Unicode code point at (x,y)  (character if cell is not code point, 0: right half of wide character)
+unsigned int TextScreen_GetCode(TextScreenBitmap *bitmap, int x, int y);
+
+// bitmap handle=bitmap; put Unicode code point to (x,y). wide character uses (x,y) and (x+1,y)
+// ASCII is put as character. without code point plane, other code point is put as '?',  return width (0: not printable)
+int TextScreen_PutCode(TextScreenBitmap *bitmap, int x, int y, unsigned int code);
+
+// bitmap handle=bitmap; draw position(x,y); UTF-8 text string=str,  return width of text
+int TextScreen_DrawTextUtf8(TextScreenBitmap *bitmap, int x, int y, const char *str);
+
+// width of Unicode code point on console,  return 0:not printable (control, combining character)  1:narrow  2:wide
+int TextScreen_GetCodeWidth(unsigned int code);
+
 
 // ******** bitmap tools ********
 
@@ -217,25 +385,218 @@ int TextScreen_ResizeBitmap(TextScreenBitmap *bitmap, int width, int height);
 // compare srcmap and dstmap(dx, dy),  return 0:same   1,-1:different
 int TextScreen_CompareBitmap(TextScreenBitmap *dstmap, TextScreenBitmap *srcmap, int dx, int dy);
 
-// clear bitmap (fill space character)
+// clear bitmap (fill space character, and attribute 0)
 void TextScreen_ClearBitmap(TextScreenBitmap *bitmap);
 
+// create attribute plane of bitmap (all attributes are 0). attributes are shown by
+// TEXTSCREEN_RENDERING_METHOD_FAST and TEXTSCREEN_RENDERING_METHOD_DIFF (Non Windows),  return 0:successful  -1:error
+int TextScreen_CreateAttrPlane(TextScreenBitmap *bitmap);
+
+// free attribute plane of bitmap
+void TextScreen_FreeAttrPlane(TextScreenBitmap *bitmap);
+
+// create code point plane of bitmap (all code points are 0). code points are shown as UTF-8 by
+// TEXTSCREEN_RENDERING_METHOD_FAST and TEXTSCREEN_RENDERING_METHOD_DIFF (Non Windows),  return 0:successful  -1:error
+int TextScreen_CreateCodePlane(TextScreenBitmap *bitmap);
+
+// free code point plane of bitmap
+void TextScreen_FreeCodePlane(TextScreenBitmap *bitmap);
+
 // show bitmap to console. position of bitmap(0,0) = console(dx,dy),  return 0:successful  -1:error
 int TextScreen_ShowBitmap(TextScreenBitmap *bitmap, int dx, int dy);
 
+// -------------------------------- 
+// output backend (set to TextScreenSetting.backend)
+// -------------------------------- 
+
+// create backend writing to fp (escape sequences for ANSI terminal). size is got from fp if it is terminal
+TextScreenBackend *TextScreen_CreateTtyBackend(FILE *fp);
+
+// create headless backend recording output to memory. size is width x height
+// keepData=0: count bytes and frames only (don't keep output data)
+TextScreenBackend *TextScreen_CreateMemoryBackend(int width, int height, int keepData);
+
+// free backend made by TextScreen_Create*Backend()
+void TextScreen_FreeBackend(TextScreenBackend *backend);
+
+// get recorded output of memory backend (data: NULL if not kept),  return 0:successful  -1:error
+int TextScreen_GetMemoryBackendData(TextScreenBackend *backend, const char **data, long *bytes, long *frames);
+
+// clear recorded output of memory backend
+void TextScreen_ClearMemoryBackend(TextScreenBackend *backend);
+
+// output statistics of VT emulator backend
+typedef struct TextScreenVtStats {
+    long bytes;        // bytes of output
+    long escapes;      // escape sequences
+    long cursorMoves;  // cursor movements (CUP, CUU, CUD, CUF, CUB, CHA, VPA, CR, LF, BS, HT)
+    long printed;      // printed characters (including repeated by REP)
+    long frames;       // frames
+} TextScreenVtStats;
+
+// create headless backend with VT100/xterm subset emulator (screen size is width x height).
+// output is interpreted to screen of characters and attributes (UTF-8 sequence is one code point,
+// other byte >= 0x80 is one character. LF moves to start of next line same as tty)
+TextScreenBackend *TextScreen_CreateVtBackend(int width, int height);
+
+// get character (byte or Unicode code point, 0: right half of wide character) and attribute of emulator screen at (x,y)
+// return 0:successful  -1:error
+int TextScreen_GetVtCell(TextScreenBackend *backend, int x, int y, unsigned int *code, unsigned short *attr);
+
+// get cursor position and visibility of emulator,  return 0:successful  -1:error
+int TextScreen_GetVtCursor(TextScreenBackend *backend, int *x, int *y, int *visible);
+
+// get output statistics of last frame and total,  return 0:successful  -1:error
+int TextScreen_GetVtStats(TextScreenBackend *backend, TextScreenVtStats *frame, TextScreenVtStats *total);
+
+// compare emulator screen with bitmap shown by TextScreen_ShowBitmap(bitmap, dx, dy) (with current margins and translate table)
+// attribute of space is compared by background and underline (space is erased without foreground and bold)
+// return number of different cells (0: same)  -1:error
+int TextScreen_CompareVtScreen(TextScreenBackend *backend, TextScreenBitmap *bitmap, int dx, int dy);
+
+// -------------------------------- 
+// compositor: layers (bitmap, position, z order) are composited to output bitmap.
+// only damaged area (moved layer, changed area of layer) is composited again
+// -------------------------------- 
+
+typedef struct TextScreenCompositor TextScreenCompositor;
+
+// create compositor. output size is width x height (0: screen size)
+TextScreenCompositor *TextScreen_CreateCompositor(int width, int height);
+
+// free compositor and output bitmap (bitmaps of layers are not freed)
+void TextScreen_FreeCompositor(TextScreenCompositor *comp);
+
+// add layer of bitmap at (x,y). larger z is upper layer (same z: added later is upper)
+// transparent: 1 = space character is transparent (same as TextScreen_OverlayBitmap()),  return layer id (-1: error)
+int TextScreen_AddLayer(TextScreenCompositor *comp, TextScreenBitmap *bitmap, int x, int y, int z, int transparent);
+
+// remove layer
+void TextScreen_RemoveLayer(TextScreenCompositor *comp, int layer);
+
+// move layer to (x,y)
+void TextScreen_MoveLayer(TextScreenCompositor *comp, int layer, int x, int y);
+
+// change z order of layer
+void TextScreen_SetLayerZ(TextScreenCompositor *comp, int layer, int z);
+
+// show (visible=1) or hide (visible=0) layer
+void TextScreen_SetLayerVisible(TextScreenCompositor *comp, int layer, int visible);
+
+// notify change of layer bitmap: area (x,y) size w x h in layer (w or h <= 0: whole layer, also after resize)
+void TextScreen_DamageLayer(TextScreenCompositor *comp, int layer, int x, int y, int w, int h);
+
+// composite area (x,y) size w x h of output again
+void TextScreen_DamageRect(TextScreenCompositor *comp, int x, int y, int w, int h);
+
+// composite damaged area,  return output bitmap (keep by compositor. show by TextScreen_ShowBitmap())
+TextScreenBitmap *TextScreen_ComposeLayers(TextScreenCompositor *comp);
+
+// -------------------------------- 
+// frame recording: shown frames are appended to capture file as difference from last frame with timestamp
+// -------------------------------- 
+
+typedef struct TextScreenCapture TextScreenCapture;
+
+// start recording to capture file path (overwritten). full frame (keyframe) is written every keyframeInterval frames
+// (0: default),  return 0:successful  -1:error
+int TextScreen_StartRecording(const char *path, int keyframeInterval);
+
+// stop recording (called by TextScreen_End()),  return 0:successful  -1:error (write error while recording)
+int TextScreen_StopRecording(void);
+
+// open capture file to read (memory mapped). index of keyframes is read (or made by scan of frames),  return NULL:error
+TextScreenCapture *TextScreen_OpenCapture(const char *path);
+
+// close capture file
+void TextScreen_CloseCapture(TextScreenCapture *capture);
+
+// read next frame. *frame: screen of frame (kept by capture, changed by next read), *time: sec from start of recording
+// return 1:successful  0:end of capture  -1:error
+int TextScreen_ReadCapture(TextScreenCapture *capture, TextScreenBitmap **frame, double *time);
+
+// seek to time (sec from start of recording): frame shown at the time is decoded from nearest keyframe
+// (got by TextScreen_GetCaptureFrame()), next TextScreen_ReadCapture() reads next frame,  return 0:successful  -1:error
+int TextScreen_SeekCapture(TextScreenCapture *capture, double time);
+
+// get last read frame (kept by capture) and time (sec),  return NULL:no frame is read
+TextScreenBitmap *TextScreen_GetCaptureFrame(TextScreenCapture *capture, double *time);
+
+// get time of last frame (sec) and number of frames
+void TextScreen_GetCaptureInfo(TextScreenCapture *capture, double *duration, long *frames);
+
+// export capture file to asciicast v2 file (castPath),  return 0:successful  -1:error
+int TextScreen_ExportAsciicast(const char *capturePath, const char *castPath);
+
+// broadcast (Non Windows): shown frames are sent to viewers connected to Unix domain socket path
+// viewer gets keyframe at first and after it is behind, and difference from last frame at other time
+// (frame is encoded once for all viewers). environment variable TEXTSCREEN_BROADCAST=path starts broadcast
+// at TextScreen_Init().  return 0:successful  -1:error (other process is broadcasting on path, ...)
+int TextScreen_StartBroadcast(const char *path);
+
+// stop broadcast, disconnect viewers and remove socket file (called by TextScreen_End())
+void TextScreen_StopBroadcast(void);
+
+// accept viewers and send to slow viewers without new frame (keyframe of last frame after it is behind)
+// called by TextScreen_WaitFrame(), TextScreen_Wait() and TextScreen_GetKey(). call it while no frame is shown
+void TextScreen_PollBroadcast(void);
+
+// number of connected viewers
+int TextScreen_GetBroadcastClients(void);
+
+// connect to broadcast as viewer,  return NULL:error (close by TextScreen_CloseCapture())
+TextScreenCapture *TextScreen_ConnectBroadcast(const char *path);
+
+// receive frames, and get newest frame (*frame: kept by capture). timeout: msec to wait for frame (-1: no limit)
+// return 1:successful  0:no new frame  -1:disconnected or error
+int TextScreen_ReceiveBroadcast(TextScreenCapture *capture, TextScreenBitmap **frame, int timeout);
+
+// shared memory bitmap (Non Windows): bitmap of other process on same host without copy of frames
+// planes of TextScreen_CreateSharedBitmap()
+#define TEXTSCREEN_SHARED_ATTR  0x01
+#define TEXTSCREEN_SHARED_CODE  0x02
+
+// create bitmap in POSIX shared memory name ("/name", width or height 0: screen size after TextScreen_Init()) for producer
+// size and planes can not be changed (resize, crop, create or free plane fail). TextScreen_FreeBitmap() removes shared memory
+// shared memory left by exited producer is replaced,  return NULL:error (other producer is using name, ...)
+TextScreenBitmap *TextScreen_CreateSharedBitmap(const char *name, int width, int height, int planes);
+
+// open shared bitmap created by other process for viewer (read only. use TextScreen_SnapshotSharedBitmap()),
+// close by TextScreen_FreeBitmap(),  return NULL:error (not created yet)
+TextScreenBitmap *TextScreen_OpenSharedBitmap(const char *name);
+
+// producer writes cells of shared bitmap between TextScreen_BeginSharedFrame() and TextScreen_EndSharedFrame()
+void TextScreen_BeginSharedFrame(TextScreenBitmap *bitmap);
+void TextScreen_EndSharedFrame(TextScreenBitmap *bitmap);
+
+// copy consistent frame of shared bitmap to snapshot (size and planes are changed as shared).
+// *generation: generation of last snapshot (0 at first. NULL: copy always)
+// return 1:copied  0:no new frame (or producer is writing)  -1:error or producer freed bitmap
+int TextScreen_SnapshotSharedBitmap(TextScreenBitmap *shared, TextScreenBitmap *snapshot, unsigned long long *generation);
+
+// start trace output (Non Windows): write Chrome trace event JSON (chrome://tracing, Perfetto UI) to path
+// spans: ShowBitmap, encode, write (args.n: bytes), CopyRect, CopyBitmap, OverlayBitmap, ResizeBitmap, GetKey (args.n: key)
+// events are kept in ring buffer of each thread and written to file by background thread (events over buffer are dropped)
+// environment variable TEXTSCREEN_TRACE=path starts trace at TextScreen_Init().  return 0:successful  -1:error
+int TextScreen_StartTrace(const char *path);
+
+// stop trace output and close file (called by TextScreen_End())
+void TextScreen_StopTrace(void);
+
 #endif
 
 /* simple usage of this library ----------------------------------------
 // build command (sample.c is this sample)
 // (Windows) gcc sample.c textscreen.c -lm -o sample.exe
-// (Linux  ) gcc sample.c textscreen.c -lm -o sample.out
+// (Linux  ) gcc sample.c textscreen.c -lm -lpthread -o sample.out
 
 #include "textscreen.h"
 
 int main(void)
 {
     TextScreenBitmap   *bitmap, *sprite;      // bitmap pointer
-    int  x, y, xd, yd, key;
+    TextScreenCompositor *comp;               // compositor pointer
+    int  x, y, xd, yd, key, layer;
     const char *helptext =  "Press [q] or [Esc] to exit";
     
     TextScreen_Init(0);                       // Initialize
@@ -243,7 +604,12 @@ int main(void)
     bitmap = TextScreen_CreateBitmap(0, 0);   // create bitmap same size of screen
     sprite = TextScreen_CreateBitmap(17, 9);  // create sprite bitmap. size(17,9)
     TextScreen_DrawFillCircle(sprite, 8, 4, 4, '$');  // draw circle. center(8,4) r=4
+    TextScreen_DrawText(bitmap, 0, bitmap->height - 1, helptext);  // draw text
+    comp = TextScreen_CreateCompositor(0, 0); // create compositor same size of screen
+    TextScreen_AddLayer(comp, bitmap, 0, 0, 0, 0);         // background layer
+    layer = TextScreen_AddLayer(comp, sprite, 5, 5, 1, 1); // sprite layer (space character '.' is transparent)
     TextScreen_ClearScreen();                 // clear console
+    TextScreen_SetFrameRate(10);              // 10 frames per second
     
     x   = 5;    // initial position x
     y   = 5;    // initial position y
@@ -251,11 +617,9 @@ int main(void)
     yd  = 1;    // stride y
     key = 0;
     while( key != 'q' && key != TSK_ESC ) {
-        TextScreen_ClearBitmap(bitmap);       // clear bitmap
-        TextScreen_OverlayBitmap(bitmap, sprite, x, y);  // copy sprite to bitmap
-        TextScreen_DrawText(bitmap, 0, bitmap->height - 1, helptext);  // draw text
-        TextScreen_ShowBitmap(bitmap, 0, 0);  // show bitmap to console
-        TextScreen_Wait(100);                 // wait 100ms
+        TextScreen_MoveLayer(comp, layer, x, y);  // move sprite
+        TextScreen_ShowBitmap(TextScreen_ComposeLayers(comp), 0, 0);  // composite moved area and show
+        TextScreen_WaitFrame();               // wait for next frame (100ms)
         x += xd;
         y += yd;
         // bounding check
@@ -269,6 +633,7 @@ int main(void)
         }
         key = TextScreen_GetKey() & TSK_KEYMASK;  // get key code without waiting
     }
+    TextScreen_FreeCompositor(comp);          // free compositor
     TextScreen_FreeBitmap(sprite);            // free sprite
     TextScreen_FreeBitmap(bitmap);            // free bitmap
     TextScreen_End();                         // end of TextScreen